@@ -0,0 +1,63 @@
+/*---------------------
+* target: 会话内邮箱名的驻留与查找缓存
+* -------------------*/
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sys/types.h>
+
+class Mailbox;
+
+/*------------------------------------------------------------------------------
+* class BoxCache
+* 同一个邮箱名在一个会话中会被反复使用（SELECT、STATUS、FETCH后的COPY等），
+* 每次都要转换小写，再在邮箱树上逐层查找；这里将邮箱名驻留为整数编号：
+*   1） 键为分隔符+小写邮箱名，转换时复用同一个缓冲区，查找已有的名字不需要分配内存；
+*   2） 编号到邮箱指针的映射带有代数，删除、重命名等会改变树结构（或释放邮箱）的
+*       操作之后调用Invalidate，所有缓存的指针一次失效，名字和编号仍然保留；
+*   3） 缓存只记录查找的结果，邮箱的创建和查找仍然由Mailbox完成
+* ----------------------------------------------------------------------------*/
+class BoxCache {
+    struct Entry {
+        std::string Name;   /* 小写后的邮箱名 */
+        char Delimiter;
+        Mailbox* Box;
+        u_int32_t Gen;
+    };
+    std::unordered_map<std::string, u_int32_t> Ids;
+    std::vector<Entry> Entries;
+    std::string Key;
+    u_int32_t Generation;
+public:
+    BoxCache() : Generation(1) {}
+
+    /* 返回邮箱名的编号，第一次出现时登记 */
+    u_int32_t Intern(const std::string& Name, char Delimiter) {
+        Key.resize(Name.size() + 1);
+        Key[0] = Delimiter;
+        for (size_t i = 0; i < Name.size(); i++) {
+            char c = Name[i];
+            Key[i+1] = (c <= 'Z' && c >= 'A') ? c-'A'+'a' : c;
+        }
+        std::unordered_map<std::string, u_int32_t>::iterator it = Ids.find(Key);
+        if (it != Ids.end()) return it->second;
+        Entry e;
+        e.Name.assign(Key, 1, std::string::npos);
+        e.Delimiter = Delimiter;    e.Box = NULL;   e.Gen = 0;
+        Entries.push_back(e);
+        Ids.emplace(Key, Entries.size() - 1);
+        return Entries.size() - 1;
+    }
+    const std::string& NameOf(u_int32_t id) const {return Entries[id].Name;}
+    char DelimiterOf(u_int32_t id) const {return Entries[id].Delimiter;}
+    /* 缓存失效时返回NULL */
+    Mailbox* Get(u_int32_t id) const {
+        return Entries[id].Gen == Generation ? Entries[id].Box : NULL;
+    }
+    void Set(u_int32_t id, Mailbox* box) {
+        Entries[id].Box = box;  Entries[id].Gen = Generation;
+    }
+    void Invalidate() {Generation++;}
+    size_t size() const {return Entries.size();}
+};
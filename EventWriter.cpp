@@ -0,0 +1,188 @@
+#include <cstring>
+#include <unistd.h>
+#include "EventWriter.h"
+
+/* 与Message中Flags的位对应的标志名 */
+static const char* FlagNames[] = {"\\\\Seen", "\\\\Draft", "\\\\Deleted", "\\\\Flagged", "\\\\Answered"};
+
+u_int64_t Fnv1a(const std::string& data) {
+    u_int64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < data.size(); i++) {
+        h ^= (unsigned char)data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void AppendAddr(std::string& out, u_int32_t ip, u_int16_t port) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u:%u", ip >> 24, (ip >> 16) & 0xff, (ip >> 8) & 0xff, ip & 0xff, port);
+    out += buf;
+}
+
+EventWriter::EventWriter(FILE* out, const char* Dir) : Out(out), Ring(EVENT_RING_SIZE), Closed(false), BodyBytes(0) {
+    if (Dir) {
+        BodyDir = Dir;
+        mkdir(Dir, 00773);
+    }
+    Worker = std::thread(&EventWriter::Run, this);
+}
+
+EventWriter::~EventWriter() {
+    Close();
+}
+
+void EventWriter::Close() {
+    if (Closed) return ;
+    Closed = true;
+    Ring.Close();
+    Worker.join();
+}
+
+void EventWriter::Run() {
+    std::string buf(EVENT_CHUNK_SIZE, '\0');
+    size_t n;
+    /* 每取到一批就写出并刷新，事件产生后很快对下游可见；
+    * 邮件内容在body事件写入缓冲区之前入队，所以先保存内容再写事件 */
+    while ((n = Ring.ReadSome(&buf[0], buf.size())) > 0) {
+        SaveBodies();
+        fwrite(buf.data(), 1, n, Out);
+        fflush(Out);
+    }
+    SaveBodies();
+}
+
+void EventWriter::SaveBodies() {
+    std::vector<std::pair<std::string, std::string> > todo;
+    {
+        std::lock_guard<std::mutex> guard(BodyLock);
+        todo.swap(Bodies);
+        BodyBytes = 0;
+    }
+    BodyRoom.notify_all();
+    for (size_t i = 0; i < todo.size(); i++) {
+        const std::string& path = todo[i].first;
+        if (access(path.c_str(), F_OK) == 0) continue;
+        FILE* f = fopen(path.c_str(), "wb");
+        if (f) {
+            fwrite(todo[i].second.data(), 1, todo[i].second.size(), f);
+            fclose(f);
+        }
+    }
+}
+
+void EventWriter::Begin(const char* Event, const FlowInfo& Flow) {
+    char buf[96];
+    snprintf(buf, sizeof(buf), "{\"ev\":\"%s\",\"t\":%lld,\"flow\":%llu,\"client\":\"", Event,
+             (long long)Flow.Time, (unsigned long long)Flow.Id);
+    Line.assign(buf);
+    AppendAddr(Line, Flow.ClientIP, Flow.ClientPort);
+    Line += "\",\"server\":\"";
+    AppendAddr(Line, Flow.ServerIP, Flow.ServerPort);
+    Line += '"';
+}
+
+void EventWriter::Field(const char* Name, const std::string& Value) {
+    Line += ",\"";
+    Line += Name;
+    Line += "\":\"";
+    /* JSON字符串转义，控制字符使用\u形式 */
+    for (size_t i = 0; i < Value.size(); i++) {
+        unsigned char c = Value[i];
+        if (c == '"' || c == '\\') {
+            Line += '\\';
+            Line += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            Line += buf;
+        } else Line += c;
+    }
+    Line += '"';
+}
+
+void EventWriter::Field(const char* Name, long long Value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), ",\"%s\":%lld", Name, Value);
+    Line += buf;
+}
+
+void EventWriter::End() {
+    Line += "}\n";
+    if (Closed == false) Ring.Write(Line.data(), Line.size());
+}
+
+void EventWriter::OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password) {
+    std::lock_guard<std::mutex> guard(Lock);
+    Begin("login", Flow);
+    Field("user", User);
+    Field("password", Password);
+    End();
+}
+
+void EventWriter::OnMailbox(const FlowInfo& Flow, const std::string& Name, int Event, Mailbox& Box) {
+    std::lock_guard<std::mutex> guard(Lock);
+    Begin(Event == BOX_SELECTED ? "select" : "create", Flow);
+    Field("box", Name);
+    if (Event == BOX_SELECTED) {
+        if (Box.GetTotalMails() >= 0) Field("exists", Box.GetTotalMails());
+        if (Box.GetRecentMails() >= 0) Field("recent", Box.GetRecentMails());
+        if (Box.GetUnseenMails() >= 0) Field("unseen", Box.GetUnseenMails());
+        if (Box.GetUidValidity()) Field("uidvalidity", Box.GetUidValidity());
+        if (Box.GetUidNext()) Field("uidnext", Box.GetUidNext());
+    }
+    End();
+}
+
+void EventWriter::OnMessage(const FlowInfo& Flow, const std::string& Box, int SeqId, Message& Mail) {
+    std::lock_guard<std::mutex> guard(Lock);
+    Begin("fetch", Flow);
+    Field("box", Box);
+    Field("seq", SeqId);
+    if (Mail.GetUid()) Field("uid", Mail.GetUid());
+    Line += ",\"flags\":[";
+    u_int8_t flags = Mail.GetFlags();
+    bool first = true;
+    for (int i = SEEN; i <= ANSWERED; i++) {
+        if ((flags & (1 << i)) == 0) continue;
+        if (first == false) Line += ',';
+        Line += '"';
+        Line += FlagNames[i];
+        Line += '"';
+        first = false;
+    }
+    Line += ']';
+    if (Mail.size() > 0) Field("size", Mail.size());
+    if (Mail.GetDate()) Field("date", Mail.GetDate());
+    End();
+}
+
+void EventWriter::OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part) {
+    std::string text = Mail.GetText();
+    char hash[24];
+    snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)Fnv1a(text));
+    size_t bytes = text.size();
+    if (BodyDir.size() && Closed == false) {
+        /* 文件交给写线程写入，不在抓包线程中做文件操作；队列满时等待写线程取走 */
+        std::unique_lock<std::mutex> lk(BodyLock);
+        BodyRoom.wait(lk, [&]{ return BodyBytes < EVENT_BODY_QUEUE || Closed; });
+        BodyBytes += bytes;
+        Bodies.push_back(std::make_pair(BodyDir + "/" + hash + ".eml", std::string()));
+        Bodies.back().second.swap(text);
+    }
+    std::lock_guard<std::mutex> guard(Lock);
+    Begin("body", Flow);
+    Field("box", Box);
+    if (Mail.GetUid()) Field("uid", Mail.GetUid());
+    if (Part == BODY_TEXT) Field("part", std::string("text"));
+    Field("bytes", (long long)bytes);
+    Field("hash", std::string(hash));
+    End();
+}
+
+void EventWriter::OnClose(const FlowInfo& Flow, const std::string& User) {
+    std::lock_guard<std::mutex> guard(Lock);
+    Begin("close", Flow);
+    Field("user", User);
+    End();
+}
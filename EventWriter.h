@@ -0,0 +1,70 @@
+/*---------------------
+* target: 以NDJSON流的形式实时输出会话事件
+* -------------------*/
+#pragma once
+#include <cstdio>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+#include "ImapResolve.h"
+#include "InputStream.h"
+
+/* 事件与写线程之间缓冲区的大小，以及写线程每次取出的最大字节数 */
+#define EVENT_RING_SIZE     (4 << 20)
+#define EVENT_CHUNK_SIZE    (256 << 10)
+/* 等待写线程保存的邮件内容上限，超过时抓包线程等待 */
+#define EVENT_BODY_QUEUE    (64 << 20)
+
+/* 内容的64位FNV-1a，body事件和保存的文件名使用 */
+u_int64_t Fnv1a(const std::string& data);
+
+/*------------------------------------------------------------------------------
+* class EventWriter
+* 会话的事件回调，每个事件格式化为一行JSON，写入环形缓冲区后立即返回，
+* 由单独的写线程取出写入文件并刷新，下游可以与解析同时处理；缓冲区满时解析线程等待；
+*   login    {"ev":"login","t":微秒,"flow":编号,"client":"ip:port","server":"ip:port","user":..,"password":..}
+*   mailbox  {"ev":"create"或"select",...,"box":..}，select另有exists、recent、unseen、uidvalidity、uidnext
+*   fetch    {"ev":"fetch",...,"box":..,"seq":..,"uid":..,"flags":[..],"size":..,"date":..}
+*   body     {"ev":"body",...,"box":..,"uid":..,"part":"text","bytes":..,"hash":..}，只取了正文
+*            （BODY[TEXT]）时才有part字段；hash为内容的64位FNV-1a，
+*            指定BodyDir时内容保存为BodyDir/hash.eml，相同内容只写一次；文件也由写线程写入，
+*            在对应的body事件写出之前完成
+*   close    {"ev":"close",...,"user":..}
+* 未知的数值（如没有UID）不输出该字段；回调可以来自多个抓包线程，格式化和写入缓冲区时加锁
+* ----------------------------------------------------------------------------*/
+class EventWriter : public SessionListener {
+    FILE* Out;
+    std::string BodyDir;
+    RingBuffer Ring;
+    std::thread Worker;
+    bool Closed;
+    std::mutex Lock;
+    /* 当前正在格式化的一行，重复使用避免分配 */
+    std::string Line;
+    /* 待写线程保存的邮件内容（文件名，内容），以及其中内容的总字节数 */
+    std::vector<std::pair<std::string, std::string> > Bodies;
+    size_t BodyBytes;
+    std::mutex BodyLock;
+    std::condition_variable BodyRoom;
+
+    void Run();
+    void SaveBodies();
+    void Begin(const char* Event, const FlowInfo& Flow);
+    void Field(const char* Name, const std::string& Value);
+    void Field(const char* Name, long long Value);
+    void End();
+public:
+    /* Out由调用者打开和关闭，BodyDir为NULL表示不保存内容 */
+    EventWriter(FILE* out, const char* BodyDir = NULL);
+    ~EventWriter();
+    /* 写完所有事件后结束写线程，之后的事件被丢弃 */
+    void Close();
+
+    void OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password);
+    void OnMailbox(const FlowInfo& Flow, const std::string& Name, int Event, Mailbox& Box);
+    void OnMessage(const FlowInfo& Flow, const std::string& Box, int SeqId, Message& Mail);
+    void OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part);
+    void OnClose(const FlowInfo& Flow, const std::string& User);
+};
@@ -1,9 +1,18 @@
+#include <cstring>
+#include <unistd.h>
+#include <unordered_set>
+#include <atomic>
+#include <iterator>
 #include "ImapResolve.h"
+#include "Keyword.h"
+#include "Scanner.h"
+#include "Profile.h"
+#include "UserStore.h"
+#include "Mime.h"
 
 inline u_int32_t GetNextSeq(u_int32_t _start, u_int32_t _size) {
-    u_int64_t st = _start, sz = _size;
-    u_int32_t ans = (u_int32_t)((st + sz) % (1<<32));
-    return ans;
+    /* 序列号按2^32回绕，无符号加法自然取模 */
+    return _start + _size;
 }
 
 inline bool check(char tar) {
@@ -16,14 +25,103 @@ std::string LowerCase(std::string tar) {
     return tar;
 }
 
-inline bool IsINBOX(std::string Name) {
-    return (Name[0] == 'I' || Name[0] == 'i') && (Name[1] == 'N' || Name[1] == 'n') && (Name[2] == 'B' || Name[2] == 'b') && (Name[3] == 'O' || Name[3] == 'o') && (Name[4] == 'X' || Name[4] == 'x');
+inline bool IsINBOX(const std::string& Name) {
+    return Name.size() == 5 && (Name[0] == 'I' || Name[0] == 'i') && (Name[1] == 'N' || Name[1] == 'n') && (Name[2] == 'B' || Name[2] == 'b') && (Name[3] == 'O' || Name[3] == 'o') && (Name[4] == 'X' || Name[4] == 'x');
 }
 
+static_assert(sizeof(Message) <= MESSAGE_BYTES, "Message metadata grew, keep it compact");
+
 Message::Message() {
-    Flags = 0;  Size = 0;
-    InternalDate.clear();   MessageId.clear();
-    Text.clear();
+    Flags = 0;  Size = 0;   Uid = 0;
+    Date = 0;   Zone = 0;   Body = NULL;
+}
+
+Message::Message(const Message& other) {
+    Flags = other.Flags;    Size = other.Size;  Uid = other.Uid;
+    Date = other.Date;  Zone = other.Zone;
+    Body = other.Body;
+    if (Body) Body->Refs++;
+}
+
+static const char Months[] = "janfebmaraprmayjunjulaugsepoctnovdec";
+
+/* 公历日期到1970-01-01的天数 */
+static int64_t DaysFromCivil(int64_t y, int m, int d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y-399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int64_t doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+void Message::SetInternalDate(const std::string& tm) {
+    /* 17-Jul-1996 02:44:25 -0700，日可能以空格开头 */
+    int day = 0, mon = 0, year = 0, hh = 0, mm = 0, ss = 0, zone = 0, sign = 1;
+    const char* p = tm.c_str();
+    while (*p == ' ') p++;
+    while (*p <= '9' && *p >= '0') day = day*10 + *p++ - '0';
+    if (*p == '-' && p[1] && p[2] && p[3]) {
+        for (int i = 0; i < 12; i++) {
+            if ((p[1]|0x20) == Months[i*3] && (p[2]|0x20) == Months[i*3+1] && (p[3]|0x20) == Months[i*3+2]) {
+                mon = i + 1;
+                break;
+            }
+        }
+        p += 4;
+    }
+    if (*p == '-') p++;
+    while (*p <= '9' && *p >= '0') year = year*10 + *p++ - '0';
+    int n = sscanf(p, " %d:%d:%d %d", &hh, &mm, &ss, &zone);
+    if (day < 1 || day > 31 || mon == 0 || year < 1970 || n != 4) {
+        /* 无法解析，按原样保存在内容中 */
+        Writable()->RawDate = tm;
+        Date = 0;
+        return ;
+    }
+    if (zone < 0) {
+        sign = -1;  zone = -zone;
+    }
+    Zone = sign * ((zone / 100) * 60 + zone % 100);
+    Date = DaysFromCivil(year, mon, day) * 86400 + hh * 3600 + mm * 60 + ss - Zone * 60;
+}
+
+std::string Message::date() {
+    if (Date == 0) return Body ? Body->RawDate : std::string();
+    /* 还原为原时区的时间 */
+    int64_t local = Date + Zone * 60, days = local / 86400, secs = local % 86400;
+    /* 天数到公历日期，DaysFromCivil的逆运算 */
+    days += 719468;
+    int64_t era = days / 146097, doe = days - era * 146097;
+    int64_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    int64_t doy = doe - (365*yoe + yoe/4 - yoe/100), mp = (5*doy + 2) / 153;
+    int d = doy - (153*mp + 2)/5 + 1, m = mp < 10 ? mp + 3 : mp - 9;
+    int y = yoe + era * 400 + (m <= 2);
+    int zone = Zone < 0 ? -Zone : Zone;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%02d-%c%c%c-%d %02d:%02d:%02d %c%02d%02d", d,
+             Months[(m-1)*3]-'a'+'A', Months[(m-1)*3+1], Months[(m-1)*3+2], y,
+             (int)(secs/3600), (int)(secs/60%60), (int)(secs%60), Zone < 0 ? '-' : '+', zone/60, zone%60);
+    return buf;
+}
+
+Message::~Message() {
+    if (Body && --Body->Refs == 0) delete Body;
+}
+
+MailBody* Message::Writable() {
+    if (Body == NULL) {
+        Body = new MailBody;
+    } else if (Body->Refs - Body->Pending > 1) {
+        MailBody* Own = new MailBody(*Body);
+        /* 检查点文件仍然是副本的内容 */
+        Own->Refs = 1;
+        Own->Pending = false;
+        if (Own->Flushed == false) Own->SavedAs.clear();
+        Body->Refs--;
+        Body = Own;
+    }
+    return Body;
 }
 
 int Message::SetFlags(u_int8_t flag) {
@@ -34,19 +132,23 @@ int Message::SetFlags(u_int8_t flag) {
 }
 
 int Message::SetMsgId(std::string msg_id) {
-    if(Flags & u_int8_t(1<<MSGID))  return NO;
+    /* 已经写入检查点的内容不再改变 */
+    if((Flags & u_int8_t(1<<MSGID)) || IsFlushed())  return NO;
 
-    MessageId.assign(msg_id);
+    MailBody* b = Writable();
+    b->MessageId.assign(msg_id);
     /* 判断是否已经完整，如果不完整，则应直接跳过这一步 */
     if(Flags & u_int8_t(1<<HEADER)) return OK;
     std::string tmp("Message-ID: ");
     msg_id += "\n";
-    Header.assign(tmp.append(msg_id.append(Header)));
+    b->Header.assign(tmp.append(msg_id.append(b->Header)));
     Flags |= u_int8_t(1<<MSGID);
     return OK;
 }
 
 std::string Message::GetText() {
+    if (Body == NULL)   return "";
+    std::map<int, std::string>& Text = Body->Text;
     /* 如果已经获得了完整的邮件体，则应直接返回 */
     if(Flags & u_int8_t(1<<TEXT))   return Text.begin()->second;
 
@@ -83,14 +185,15 @@ std::string Message::GetText() {
 }
 
 int Message::SetPartHeader(std::string field, std::string value) {
-    /* 先检查头部是否已经完整，如果完整则不可改变 */
-    if(Flags & u_int8_t(1 << HEADER)) return NO;
+    /* 先检查头部是否已经完整，如果完整则不可改变；写入检查点之后同样 */
+    if((Flags & u_int8_t(1 << HEADER)) || IsFlushed()) return NO;
 
+    MailBody* b = Writable();
     if(field == "boundary") {
-        bound = "\tboundary=\"" + value + "\"\n";
+        b->bound = "\tboundary=\"" + value + "\"\n";
     } else if(field == "Content-Type") {
-        cont = "Content-Type: " + value + ";\n";
-    } else Header.assign(field + ": " + value + "\n" + Header);
+        b->cont = "Content-Type: " + value + ";\n";
+    } else b->Header.assign(field + ": " + value + "\n" + b->Header);
     return OK;
 }
 
@@ -98,6 +201,7 @@ int Message::SetPartText(int StartPos, std::string text) {
     if(Flags & u_int8_t(1 << TEXT)) return NO;
     if(text.size() == 0)    return NO;
 
+    std::map<int, std::string>& Text = Writable()->Text;
     if(Text.find(StartPos) != Text.end()) {
         /* 如果已经存在应该对比两者信息长度，保留长者 */
         if (Text[StartPos].size() > text.size()) return NO;
@@ -109,9 +213,9 @@ int Message::SetPartText(int StartPos, std::string text) {
 }
 
 int Message::SetFullHeader(std::string header) {
-    if(Flags & u_int8_t(1 << HEADER)) return NO;
+    if((Flags & u_int8_t(1 << HEADER)) || IsFlushed()) return NO;
 
-    Header.assign(header);
+    Writable()->Header.assign(header);
     Flags |= u_int8_t(1 << HEADER);
     return OK;
 }
@@ -119,28 +223,139 @@ int Message::SetFullHeader(std::string header) {
 int Message::SetFullText(std::string text) {
     if(Flags & u_int8_t(1 << TEXT)) return NO;
 
-    Text.clear();
-    Text.emplace(0, text);
+    MailBody* b = Writable();
+    b->Text.clear();
+    b->Text.emplace(0, text);
     Flags |= u_int8_t(1 << TEXT);
     return OK;
 }
 
-int Message::save(std::string FileName) {
+/* 内容的完整程度：正文完整最重要，其次是首部，没有内容为0 */
+static int Completeness(u_int8_t Flags, const MailBody* Body) {
+    if (Body == NULL) return 0;
+    return 1 + ((Flags >> TEXT) & 1) * 4 + ((Flags >> HEADER) & 1) * 2 + ((Flags >> MSGID) & 1);
+}
+
+void Message::Merge(Message& Src, bool Newer) {
+    u_int8_t content = (1 << MSGID) | (1 << HEADER) | (1 << TEXT);
+    if (Newer) Flags = (Flags & content) | (Src.Flags & ~content);
+    if (Src.Size > 0 && (Newer || Size <= 0)) Size = Src.Size;
+    if (Src.Date && (Newer || Date == 0)) {
+        Date = Src.Date;
+        Zone = Src.Zone;
+    }
+    if (Uid == 0) Uid = Src.Uid;
+    if (Completeness(Src.Flags, Src.Body) > Completeness(Flags, Body)) {
+        std::swap(Body, Src.Body);
+        u_int8_t mine = Flags & content;
+        Flags = (Flags & ~content) | (Src.Flags & content);
+        Src.Flags = (Src.Flags & ~content) | mine;
+    }
+}
+
+int Message::Write(const std::string& FileName) {
+    /* 目标文件可能是其他邮件的硬链接，先删除再新建，不能截断后原地写入 */
+    unlink(FileName.c_str());
     std::ofstream TarFile(FileName, std::ios::out);
     /* 打开文件失败，返回错误 */
     if(!TarFile.is_open())  return NO;
 
-    if (Header.size())  TarFile << Header;
-    if (cont.size())    TarFile << cont;
-    if (bound.size())    TarFile << bound;
+    if (Body) {
+        if (Body->Header.size())  TarFile << Body->Header;
+        if (Body->cont.size())    TarFile << Body->cont;
+        if (Body->bound.size())   TarFile << Body->bound;
+    }
     TarFile << GetText() << std::endl;
     TarFile.close();
-    return OK;
+    return TarFile.fail() ? NO : OK;
+}
+
+/* 复制检查点文件，用于不能建立硬链接时；目标可能是其他文件的硬链接，先删除再新建 */
+static int CopyFile(const std::string& From, const std::string& To) {
+    unlink(To.c_str());
+    std::ifstream in(From, std::ios::in | std::ios::binary);
+    std::ofstream out(To, std::ios::out | std::ios::binary);
+    if (!in.is_open() || !out.is_open()) return NO;
+    out << in.rdbuf();
+    out.close();
+    return out.fail() ? NO : OK;
+}
+
+int Message::save(std::string FileName, bool Decode) {
+    /* 内容已经写入检查点或共享的内容已经保存过，直接建立硬链接；
+    * 失败（如跨文件系统）时检查点文件直接复制，其他正常写入 */
+    bool Shared = Body && Body->Refs - Body->Pending > 1;
+    /* 再次运行时目标可能已存在（并且可能是硬链接），先删除，link才不会因EEXIST失败 */
+    unlink(FileName.c_str());
+    if ((Shared || IsFlushed()) && Body->SavedAs.size() && link(Body->SavedAs.c_str(), FileName.c_str()) == 0)
+        return Decode ? SaveParts(FileName) : OK;
+    if (IsFlushed() && Body->SavedAs.size()) {
+        if (CopyFile(Body->SavedAs, FileName) != OK) return NO;
+        return Decode ? SaveParts(FileName) : OK;
+    }
+
+    if (Write(FileName) != OK) return NO;
+    if (Shared) Body->SavedAs = FileName;
+    return Decode ? SaveParts(FileName) : OK;
+}
+
+int Message::SaveParts(const std::string& FileName) {
+    /* 正文不完整时无法拆分，只保存.eml */
+    if ((Flags & u_int8_t(1<<TEXT)) == 0) return OK;
+    /* bound的格式为\tboundary="..."\n，首部中没有boundary时使用 */
+    std::string boundary;
+    size_t q = Body->bound.find('"');
+    if (q != std::string::npos) boundary = Body->bound.substr(q + 1, Body->bound.rfind('"') - q - 1);
+    /* 部分文件名去掉.eml，如3.eml的部分为3.1.txt、3.2-report.pdf */
+    std::string base = FileName;
+    if (base.size() > 4 && base.compare(base.size() - 4, 4, ".eml") == 0) base.resize(base.size() - 4);
+    std::string text;
+    if (IsFlushed()) {
+        /* 内容已经释放，从刚保存的文件读回 */
+        std::ifstream in(FileName, std::ios::in | std::ios::binary);
+        text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    } else text = GetHeader() + GetText();
+    return SaveMimeParts(text, boundary, base) < 0 ? NO : OK;
+}
+
+size_t Message::Flush(const std::string& Dir) {
+    if (Body == NULL || Body->Flushed || (Flags & u_int8_t(1<<TEXT)) == 0) return 0;
+    if (Dir.size()) {
+        /* 检查点文件按写入顺序编号，多个抓包线程共用一个目录 */
+        static std::atomic<u_int64_t> NextFile(1);
+        std::string name = Dir + "/" + std::to_string(NextFile++) + ".eml";
+        if (Write(name) != OK) return 0;
+        Body->SavedAs = name;
+    }
+    size_t bytes = Body->Header.capacity() + Body->cont.capacity();
+    for (std::map<int, std::string>::iterator it = Body->Text.begin(); it != Body->Text.end(); it++)
+        bytes += it->second.capacity();
+    std::string().swap(Body->Header);
+    std::string().swap(Body->cont);
+    /* bound保留，解码MIME部分时使用；正文完整时Text只有位置0一项，保留空的一项，GetText仍然有效 */
+    Body->Text.clear();
+    Body->Text.emplace(0, std::string());
+    Body->Flushed = true;
+    GStats.MessagesFlushed++;
+    GStats.BytesFlushed += bytes;
+    return bytes;
+}
+
+Message* Message::Hold() {
+    if (Body == NULL || Body->Flushed || Body->Pending || (Flags & u_int8_t(1<<TEXT)) == 0) return NULL;
+    Body->Pending = true;
+    return new Message(*this);
+}
+
+size_t Message::Release(const std::string& Dir, bool Save) {
+    Body->Pending = false;
+    /* 只剩这个副本时邮件已经被删除，内容随副本释放 */
+    return Save && Body->Refs > 1 ? Flush(Dir) : 0;
 }
 
 Mailbox::Mailbox() {
     BeSelected = BeSubed = true;
-    SubMailbox.clear(); Mails.clear();
+    SubMailbox.clear();
     TotalMails = RecentMails = UnseenMails = 0;
     UidNext = UidValidity = 0;
 }
@@ -150,42 +365,45 @@ Mailbox::~Mailbox() {
         /* 对每一个下属邮箱都先释放空间 */
         delete it->second;
     }
-    for (std::map<int, Message*>::iterator it = Mails.begin(); it != Mails.end(); it++) {
+    /* 有UID的邮件由UID存储负责释放，其余的由序列号索引负责 */
+    std::vector<std::pair<int, Message*> > mails;
+    Mails.All(mails);
+    for (size_t i = 0; i < mails.size(); i++)
+        if (mails[i].second->GetUid() == 0) delete mails[i].second;
+    for (std::map<u_int32_t, Message*>::iterator it = UidMails.begin(); it != UidMails.end(); it++)
         delete it->second;
-    }
 }
 
-Mailbox* Mailbox::AppendBox(std::string TarName, char Delimiter) {
-    int TempPos = 0;
-    bool IsSuper = false, IsInfer = true;   /* 置false，默认没有上层，进行新建 */
-    for (; TempPos < int(TarName.size()); TempPos++) {
-        if(TarName[TempPos] == Delimiter)  break ;
-    }
-    /* TempPos之前为上层目录的名字，后面为子目录名字 */
-    std::string ArchDir = TarName.substr(0, TempPos);
-    std::string InferDir;
-    
+/* 从Pos开始切分路径：Pos到分隔符之前为上层目录的名字（写入ArchDir），
+* 返回子目录名字的起始位置，若没有子目录则返回npos；整个查找过程不再复制剩余路径 */
+static size_t SplitName(const std::string& TarName, size_t Pos, char Delimiter, std::string& ArchDir) {
+    size_t TempPos = TarName.find(Delimiter, Pos);
+    if (TempPos == std::string::npos) TempPos = TarName.size();
+    ArchDir.assign(TarName, Pos, TempPos-Pos);
+    if (TempPos+1 >= TarName.size()) return std::string::npos;
+    return TempPos+1;
+}
+
+Mailbox* Mailbox::AppendBox(const std::string& TarName, size_t Pos, char Delimiter) {
+    bool IsSuper = false;   /* 置false，默认没有上层，进行新建 */
+    std::string ArchDir;
     /* 检查是否存在子目录，如果不存在说明这是最后一次创建；
-    * 如果存在，则构造子目录名，并可以继续进行创建 */
-    if(TempPos == (int)TarName.size() || TempPos+1 == (int)TarName.size()) {
-        IsInfer = false;
-    } else {
-        InferDir = TarName.substr(TempPos+1);
-    }
+    * 如果存在，则可以继续在子目录进行创建 */
+    size_t InferPos = SplitName(TarName, Pos, Delimiter, ArchDir);
+    bool IsInfer = (InferPos != std::string::npos);
 
     /* 先查找有无上层目录 */
-    if(SubMailbox.find(ArchDir) != SubMailbox.end()) {  /* 可能有上层目录 */
-        std::multimap<std::string, Mailbox*>::iterator begin, end;
-        begin = SubMailbox.lower_bound(ArchDir);
-        end = SubMailbox.upper_bound(ArchDir);
-
+    std::multimap<std::string, Mailbox*>::iterator begin, end;
+    begin = SubMailbox.lower_bound(ArchDir);
+    end = SubMailbox.upper_bound(ArchDir);
+    if(begin != end) {  /* 可能有上层目录 */
         /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
         for (; begin != end; begin++) {
             if(begin->second->BeSelected == true) {
                 IsSuper = true; break;
             } else {
                 /* 如果有下层的目标邮箱名，则可以在本邮箱下新建 */
-                if (IsInfer)   return begin->second->AppendBox(InferDir, Delimiter);
+                if (IsInfer)   return begin->second->AppendBox(TarName, InferPos, Delimiter);
                 /* 如果本邮箱就是目标邮箱，则应返回错误 */
                 if (IsInfer == false)   return NULL;
             }
@@ -193,7 +411,7 @@ Mailbox* Mailbox::AppendBox(std::string TarName, char Delimiter) {
         /* 有上层目录，直接使用上层目录进行创建 */
         /* 如果没有子目录名，说明已经到了边界，并且目标已创建 */
         if(IsSuper && IsInfer) {
-            return begin->second->AppendBox(InferDir, Delimiter);
+            return begin->second->AppendBox(TarName, InferPos, Delimiter);
         }
         /* 同名邮箱已存在，不能创建 */
         if(IsInfer == false && IsSuper) return NULL;
@@ -203,107 +421,78 @@ Mailbox* Mailbox::AppendBox(std::string TarName, char Delimiter) {
         Mailbox* NewOne = new Mailbox;
         std::multimap<std::string, Mailbox*>::iterator NewIt = SubMailbox.emplace(ArchDir, NewOne);
         if(IsInfer)
-            return NewIt->second->AppendBox(InferDir, Delimiter);
+            return NewIt->second->AppendBox(TarName, InferPos, Delimiter);
         else return NewOne;
     }
     return NULL;
 }
 
-int Mailbox::DeleteBox(std::string TarName, char Delimiter) {
-    int TempPos = 0;
-    bool IsInfer = true;
-    for (; TempPos < (int)TarName.size(); TempPos++) {
-        if(TarName[TempPos] == Delimiter)  break ;
-    }
-    /* TempPos之前为上层目录的名字，后面为子目录名字 */
-    std::string ArchDir = TarName.substr(0, TempPos);
-    std::string InferDir;
-    
-    if (TempPos == (int)TarName.size() || TempPos+1 == (int)TarName.size()) {
-        IsInfer = false;
-    } else {
-        InferDir = TarName.substr(TempPos+1);
-    }
+int Mailbox::DeleteBox(const std::string& TarName, size_t Pos, char Delimiter) {
+    std::string ArchDir;
+    size_t InferPos = SplitName(TarName, Pos, Delimiter, ArchDir);
+    bool IsInfer = (InferPos != std::string::npos);
 
     /* 确保INBOX不被删除 */
     if (IsINBOX(ArchDir) && IsInfer == false)   return NO;
 
     /* 先查找有无上层目录 */
-    if(SubMailbox.find(ArchDir) != SubMailbox.end()) {  /* 可能有上层目录 */
-        std::multimap<std::string, Mailbox*>::iterator begin, end;
-        begin = SubMailbox.lower_bound(ArchDir);
-        end = SubMailbox.upper_bound(ArchDir);
-
-        /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
-        for (; begin != end; begin++) {
-            if(begin->second->BeSelected == true) {
-                /* 没有NoSelect标签，自身可删除 */
-                if(IsInfer == false) {
-                    /* 如果该邮箱即为目标邮箱，查看是否有下属邮箱；
-                    * 如果有，则只添加NoSelect标签 */
-                    if(begin->second->GetBoxNumebr())   begin->second->SetSel(false);
-                    else {
-                        /* 没有下属邮箱，则应直接删除 */
-                        delete begin->second;
-                        SubMailbox.erase(begin);
-                    }
-                    return OK;
-                } else {
-                    /* 当前邮箱并不是目标邮箱 */
-                    if (begin->second->DeleteBox(InferDir, Delimiter) == OK)   return OK;
+    std::multimap<std::string, Mailbox*>::iterator begin, end;
+    begin = SubMailbox.lower_bound(ArchDir);
+    end = SubMailbox.upper_bound(ArchDir);
+    /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
+    for (; begin != end; begin++) {
+        if(begin->second->BeSelected == true) {
+            /* 没有NoSelect标签，自身可删除 */
+            if(IsInfer == false) {
+                /* 如果该邮箱即为目标邮箱，查看是否有下属邮箱；
+                * 如果有，则只添加NoSelect标签 */
+                if(begin->second->GetBoxNumebr())   begin->second->SetSel(false);
+                else {
+                    /* 没有下属邮箱，则应直接删除 */
+                    delete begin->second;
+                    SubMailbox.erase(begin);
                 }
+                return OK;
             } else {
-                /* 标记有NoSelect标签，当没有子邮箱后，应该删除 */
-                if(IsInfer == false)    continue;
-                if(begin->second->DeleteBox(InferDir, Delimiter) == OK) {
-                    /* 如果标有NoSelect标签并且被删除子目录；
-                    * 应该查看是否还存在下属邮箱，如果不存在，则应被删除 */
-                    if(begin->second->GetBoxNumebr() == 0) {
-                        delete begin->second;
-                        SubMailbox.erase(begin);
-                    }
-                    return OK;
+                /* 当前邮箱并不是目标邮箱 */
+                if (begin->second->DeleteBox(TarName, InferPos, Delimiter) == OK)   return OK;
+            }
+        } else {
+            /* 标记有NoSelect标签，当没有子邮箱后，应该删除 */
+            if(IsInfer == false)    continue;
+            if(begin->second->DeleteBox(TarName, InferPos, Delimiter) == OK) {
+                /* 如果标有NoSelect标签并且被删除子目录；
+                * 应该查看是否还存在下属邮箱，如果不存在，则应被删除 */
+                if(begin->second->GetBoxNumebr() == 0) {
+                    delete begin->second;
+                    SubMailbox.erase(begin);
                 }
+                return OK;
             }
         }
     }
     return NO;
 }
 
-Mailbox* Mailbox::FindBoxByName(std::string TarName, char Delimiter) {
-    int TempPos = 0;
-    /* bool值用于查看路径中是否存在上下层，并保存响应路径 */
-    bool IsInfer = true;
-    std::string ArchDir = TarName.substr(0, TempPos);
-    std::string InferDir;
-
+Mailbox* Mailbox::FindBoxByName(const std::string& TarName, size_t Pos, char Delimiter) {
     /* 先取得分隔符所在位置，后判断所给路径中是否有下层目录 */
-    for (; TempPos < (int)TarName.size() && TarName[TempPos] != Delimiter; TempPos++) {
-        ArchDir.push_back(TarName[TempPos]);
-    }
-    if(TempPos == (int)TarName.size() || TempPos+1 == (int)TarName.size()) {
-        IsInfer = false;
-    } else {
-        InferDir = TarName.substr(TempPos+1);
-    }
-
-    if(SubMailbox.find(ArchDir) != SubMailbox.end()) {
-        /* 有可能存在上层目录,遍历查看是否真实存在，若不存在返回NULL */
-        std::multimap<std::string, Mailbox*>::iterator begin, end;
-        begin = SubMailbox.lower_bound(ArchDir);
-        end = SubMailbox.upper_bound(ArchDir);
-
-        /* 在此函数中，上层目录是否为最终目标目录对结果是有影响的；
-        * 若上层目录被删除，且目标路径也有下层目录则应继续查询，否则，
-        * 目标路径已经到达最终路径，则应返回NULL */
-        for (; begin != end; begin++) {
-            if(IsInfer) {
-                Mailbox* temp = begin->second->FindBoxByName(InferDir);
-                if(temp)    return temp;
-                return NULL;
-            } else {
-                if(begin->second->BeSelected)   return begin->second;
-            }
+    std::string ArchDir;
+    size_t InferPos = SplitName(TarName, Pos, Delimiter, ArchDir);
+    bool IsInfer = (InferPos != std::string::npos);
+
+    /* 有可能存在上层目录,遍历查看是否真实存在，若不存在返回NULL */
+    std::multimap<std::string, Mailbox*>::iterator begin, end;
+    begin = SubMailbox.lower_bound(ArchDir);
+    end = SubMailbox.upper_bound(ArchDir);
+
+    /* 在此函数中，上层目录是否为最终目标目录对结果是有影响的；
+    * 若上层目录被删除，且目标路径也有下层目录则应继续查询，否则，
+    * 目标路径已经到达最终路径，则应返回NULL */
+    for (; begin != end; begin++) {
+        if(IsInfer) {
+            return begin->second->FindBoxByName(TarName, InferPos, Delimiter);
+        } else {
+            if(begin->second->BeSelected)   return begin->second;
         }
     }
     return NULL;
@@ -312,186 +501,472 @@ Mailbox* Mailbox::FindBoxByName(std::string TarName, char Delimiter) {
 int Mailbox::AppendMail(int SeqId, Message* NewMail) {
     if (NewMail == NULL)    return NO;
 
-    Mails.emplace(SeqId, NewMail);
-    return OK;
+    return Mails.Insert(SeqId, NewMail) ? OK : NO;
 }
 
 /* 邮件的删除暂时只实现部分功能，等邮件类实现后再进行进一步实现
 * 注意删除邮件时，邮件个数和邮件详细信息的关系；
 * 即：Mails和各类数目保持一致。 */
 int Mailbox::DeleteMail(int SeqId) {
-    std::map<int, Message*>::iterator it;
-    if((it = Mails.find(SeqId)) != Mails.end()) {
-        u_int8_t flags = it->second->GetFlags();
+    Message* mail = Mails.Erase(SeqId);
+    if(mail != NULL) {
+        if (mail->GetUid()) UidMails.erase(mail->GetUid());
+        u_int8_t flags = mail->GetFlags();
         if((flags & (1 << SEEN)) == 0) UnseenMails--;
-        delete it->second;
-        Mails.erase(it);
+        delete mail;
     }
     TotalMails--;
     return OK;
 }
 
 int Mailbox::DeleteMail(int Begin, int End) {
+    if (End <= Begin)   return NO;
     int offset = End-Begin;
-    std::map<int, Message*>::iterator it = Mails.begin();
-    while (it != Mails.end()) {
-        if(it->first >= Begin && it->first < End) {
-            /* 序列号在此区间内的都应该被删除 */
-            /* 在删除之前应先查看邮件的标志，以维持数量尽力一致 */
-            u_int8_t flags = it->second->GetFlags();
-            if((flags & (1 << SEEN)) == 0) UnseenMails--;
-            delete it->second;
-            it = Mails.erase(it);
-        } else if(it->first >= End) break;
-        else it++;
-    }
-    /* 注意序列号一定是顺序的，所以删除后，后面的邮件都应该前移 */
-    while (it != Mails.end()) {
-        /* 因为map不能直接修改key，所以应该先删除，再添加 */
-        /* 由于有新添加的元素，一定要确保符合条件；
-        * 新添加的元素key一定是第一个≤End的 */
-        Mails.emplace(it->first - offset, it->second);
-        it = Mails.erase(it);
+    /* 序列号在此区间内的都应该被删除；注意序列号一定是顺序的，
+    * 所以删除后，后面的邮件都应该前移，由MailIndex一次完成 */
+    std::vector<Message*> removed;
+    Mails.EraseRange(Begin, End, removed);
+    for (size_t i = 0; i < removed.size(); i++) {
+        /* 在删除之前应先查看邮件的标志，以维持数量尽力一致 */
+        u_int8_t flags = removed[i]->GetFlags();
+        if((flags & (1 << SEEN)) == 0) UnseenMails--;
+        if (removed[i]->GetUid()) UidMails.erase(removed[i]->GetUid());
+        delete removed[i];
     }
     /* 一定要保持数量上的一致 */
     TotalMails -= offset;
     return OK;
 }
 
-Mailbox* Mailbox::PopBox(std::string TarName, char Delimiter) {
-    int TempPos = 0;
-    bool IsInfer = true;
-    for (; TempPos < (int)TarName.size(); TempPos++) {
-        if(TarName[TempPos] == Delimiter)  break ;
+Message* Mailbox::GetMail(int SeqId, u_int32_t Uid) {
+    Message* BySeq = Mails.Find(SeqId);
+    if (Uid == 0) {
+        if (BySeq == NULL) {
+            BySeq = new Message;
+            Mails.Insert(SeqId, BySeq);
+        }
+        return BySeq;
     }
-    /* TempPos之前为上层目录的名字，后面为子目录名字 */
-    std::string ArchDir = TarName.substr(0, TempPos);
-    std::string InferDir;
-    
-    if (TempPos == (int)TarName.size() || TempPos+1 == (int)TarName.size()) {
-        IsInfer = false;
-    } else {
-        InferDir = TarName.substr(TempPos+1);
+    std::map<u_int32_t, Message*>::iterator it = UidMails.find(Uid);
+    if (it == UidMails.end()) {
+        /* 第一次见到该UID；如果序列号上已有的邮件属于另一个UID，
+        * 说明序列号已经变化，原邮件保留在UID存储中，序列号改为指向新邮件 */
+        if (BySeq != NULL && BySeq->GetUid() != 0) {
+            Mails.Erase(SeqId);
+            BySeq = NULL;
+        }
+        if (BySeq == NULL) {
+            BySeq = new Message;
+            Mails.Insert(SeqId, BySeq);
+        }
+        BySeq->SetUid(Uid);
+        UidMails.emplace(Uid, BySeq);
+        return BySeq;
     }
+    Message* ByUid = it->second;
+    if (ByUid == BySeq) return ByUid;
+    /* UID已知但序列号对应不上，以UID为准，将该邮件移到这个序列号；
+    * 序列号上原有的邮件若没有UID，则与该邮件是同一封，按序列号抓到的内容并入后丢弃 */
+    if (BySeq != NULL) {
+        Mails.Erase(SeqId);
+        if (BySeq->GetUid() == 0) {
+            ByUid->Merge(*BySeq, false);
+            delete BySeq;
+        }
+    }
+    Mails.EraseMail(ByUid);
+    Mails.Insert(SeqId, ByUid);
+    return ByUid;
+}
+
+Message* Mailbox::FindByUid(u_int32_t Uid) {
+    std::map<u_int32_t, Message*>::iterator it = UidMails.find(Uid);
+    return it == UidMails.end() ? NULL : it->second;
+}
+
+void Mailbox::UidRange(u_int32_t Begin, u_int32_t End, std::vector<Message*>& out) {
+    std::map<u_int32_t, Message*>::iterator it = UidMails.lower_bound(Begin);
+    for (; it != UidMails.end() && it->first <= End; it++) out.push_back(it->second);
+}
+
+void Mailbox::SetUidValidity(u_int32_t UValid) {
+    /* UidValidity改变说明之前的UID全部作废 */
+    if (UidValidity != 0 && UValid != UidValidity) ForgetUids();
+    UidValidity = UValid;
+}
+
+void Mailbox::ForgetUids() {
+    std::vector<std::pair<int, Message*> > mails;
+    std::unordered_set<Message*> indexed;
+    Mails.All(mails);
+    for (size_t i = 0; i < mails.size(); i++) indexed.insert(mails[i].second);
+    for (std::map<u_int32_t, Message*>::iterator it = UidMails.begin(); it != UidMails.end(); it++) {
+        if (indexed.count(it->second)) it->second->SetUid(0);
+        else delete it->second;
+    }
+    UidMails.clear();
+}
+
+void Mailbox::Merge(Mailbox& Src, bool Newer) {
+    /* UIDVALIDITY不同时两边的UID不能对应，以较新的一方为准 */
+    if (Src.UidValidity && UidValidity && Src.UidValidity != UidValidity) {
+        if (Newer) SetUidValidity(Src.UidValidity);
+        else Src.ForgetUids();
+    }
+    if (UidValidity == 0) UidValidity = Src.UidValidity;
+    if (Src.UidNext && (Newer || UidNext == 0)) UidNext = Src.UidNext;
+    if (Src.TotalMails > 0 && (Newer || TotalMails <= 0)) {
+        TotalMails = Src.TotalMails;
+        RecentMails = Src.RecentMails;
+        UnseenMails = Src.UnseenMails;
+    }
+
+    std::vector<std::pair<int, Message*> > mails, old;
+    std::unordered_set<Message*> indexed;
+    /* 较新的一方的序列号对应关系整体替换原有的，原有的没有UID的邮件只能按序列号对应 */
+    std::map<int, Message*> orphans;
+    Src.Mails.All(mails);
+    if (Newer && mails.size()) {
+        Mails.All(old);
+        Mails.clear();
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i].second->GetUid() == 0) orphans.emplace(old[i].first, old[i].second);
+    }
+    for (size_t i = 0; i < mails.size(); i++) {
+        int seq = mails[i].first;
+        Message* mail = mails[i].second, * same = NULL;
+        indexed.insert(mail);
+        if (mail->GetUid()) {
+            same = FindByUid(mail->GetUid());
+        } else if (Newer) {
+            std::map<int, Message*>::iterator it = orphans.find(seq);
+            if (it != orphans.end()) {
+                same = it->second;
+                orphans.erase(it);
+            }
+        } else same = Mails.Find(seq);
+        if (same) {
+            same->Merge(*mail, Newer);
+            delete mail;
+            mail = same;
+        } else if (mail->GetUid()) UidMails.emplace(mail->GetUid(), mail);
+        if (Newer && mail->GetUid()) {
+            /* 原来在这个序列号上的没有UID的邮件就是这一封 */
+            std::map<int, Message*>::iterator it = orphans.find(seq);
+            if (it != orphans.end()) {
+                mail->Merge(*it->second, false);
+                delete it->second;
+                orphans.erase(it);
+            }
+        }
+        if (same && Newer == false) continue;
+        if (Mails.Insert(seq, mail) == false && mail->GetUid() == 0) delete mail;
+    }
+    /* 没有重新对应上的旧邮件放回原来的序列号，已被占用的只能丢弃 */
+    for (std::map<int, Message*>::iterator it = orphans.begin(); it != orphans.end(); it++)
+        if (Mails.Insert(it->first, it->second) == false) delete it->second;
+    for (std::map<u_int32_t, Message*>::iterator it = Src.UidMails.begin(); it != Src.UidMails.end(); it++) {
+        if (indexed.count(it->second)) continue;
+        Message* same = FindByUid(it->first);
+        if (same) {
+            same->Merge(*it->second, Newer);
+            delete it->second;
+        } else UidMails.emplace(it->first, it->second);
+    }
+    Src.Mails.clear();
+    Src.UidMails.clear();
+
+    for (std::multimap<std::string, Mailbox*>::iterator it = Src.SubMailbox.begin(); it != Src.SubMailbox.end(); it++) {
+        std::multimap<std::string, Mailbox*>::iterator same = SubMailbox.find(it->first);
+        if (same == SubMailbox.end()) {
+            SubMailbox.emplace(it->first, it->second);
+        } else {
+            same->second->Merge(*it->second, Newer);
+            delete it->second;
+        }
+    }
+    Src.SubMailbox.clear();
+}
+
+/* std::map/std::set节点的额外开销：三个指针和颜色 */
+#define RB_NODE_BYTES   32
+
+void MemReport::AddMessage(Message* mail) {
+    Messages++;
+    MessageBytes += sizeof(Message);
+    const MailBody* b = mail->GetBody();
+    if (b == NULL) {
+        MetaOnly++;
+        return ;
+    }
+    if (Seen.insert(b).second == false) return ;
+    Bodies++;
+    if (b->Refs - b->Pending > 1) SharedBodies++;
+    BodyBytes += sizeof(MailBody) + b->MessageId.capacity() + b->Header.capacity() + b->cont.capacity()
+               + b->bound.capacity() + b->SavedAs.capacity() + b->RawDate.capacity();
+    for (std::map<int, std::string>::const_iterator it = b->Text.begin(); it != b->Text.end(); it++)
+        BodyBytes += RB_NODE_BYTES + sizeof(*it) + it->second.capacity();
+}
+
+void MemReport::Print(FILE* out) const {
+    fprintf(out, "Memory: %zu sessions, %zu mailboxes, %zu bytes in total\n", Sessions, Mailboxes, Total());
+    fprintf(out, "  messages: %zu (%zu metadata only), %zu bytes, %zu bytes each\n",
+            Messages, MetaOnly, MessageBytes, sizeof(Message));
+    fprintf(out, "  bodies:   %zu (%zu shared), %zu bytes\n", Bodies, SharedBodies, BodyBytes);
+    fprintf(out, "  index:    %zu bytes by sequence, %zu bytes by UID\n", IndexBytes, UidBytes);
+    fprintf(out, "  pending:  %zu bytes waiting for reassembly\n", ReassemblyBytes);
+}
+
+void Mailbox::Measure(MemReport& report) {
+    report.Mailboxes++;
+    std::vector<std::pair<int, Message*> > mails;
+    std::unordered_set<Message*> indexed;
+    Mails.All(mails);
+    for (size_t i = 0; i < mails.size(); i++) {
+        report.AddMessage(mails[i].second);
+        indexed.insert(mails[i].second);
+    }
+    for (std::map<u_int32_t, Message*>::iterator it = UidMails.begin(); it != UidMails.end(); it++)
+        if (indexed.count(it->second) == 0) report.AddMessage(it->second);
+    report.IndexBytes += Mails.size() * MailIndex::NodeBytes();
+    report.UidBytes += UidMails.size() * (RB_NODE_BYTES + sizeof(std::pair<u_int32_t, Message*>));
+    for (std::multimap<std::string, Mailbox*>::iterator it = SubMailbox.begin(); it != SubMailbox.end(); it++)
+        it->second->Measure(report);
+}
+
+Mailbox* Mailbox::PopBox(const std::string& TarName, size_t Pos, char Delimiter) {
+    std::string ArchDir;
+    size_t InferPos = SplitName(TarName, Pos, Delimiter, ArchDir);
+    bool IsInfer = (InferPos != std::string::npos);
 
     /* 确保INBOX不被弹出 */
     if (IsINBOX(ArchDir) && IsInfer == false)   return NULL;
 
     /* 先查找有无上层目录 */
-    if(SubMailbox.find(ArchDir) != SubMailbox.end()) {  /* 可能有上层目录 */
-        std::multimap<std::string, Mailbox*>::iterator begin, end;
-        begin = SubMailbox.lower_bound(ArchDir);
-        end = SubMailbox.upper_bound(ArchDir);
-
-        /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
-        for (; begin != end; begin++) {
-            if(begin->second->BeSelected == true) {
-                /* 没有NoSelect标签，自身可弹出 */
-                if(IsInfer == false) {
-                    /* 保存该邮箱并将元素弹出 */
-                    Mailbox* tmp = begin->second;
-                    SubMailbox.erase(begin);
-                    return tmp;
-                } else {
-                    /* 当前邮箱并不是目标邮箱 */
-                    return begin->second->PopBox(InferDir, Delimiter);
-                }
+    std::multimap<std::string, Mailbox*>::iterator begin, end;
+    begin = SubMailbox.lower_bound(ArchDir);
+    end = SubMailbox.upper_bound(ArchDir);
+    /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
+    for (; begin != end; begin++) {
+        if(begin->second->BeSelected == true) {
+            /* 没有NoSelect标签，自身可弹出 */
+            if(IsInfer == false) {
+                /* 保存该邮箱并将元素弹出 */
+                Mailbox* tmp = begin->second;
+                SubMailbox.erase(begin);
+                return tmp;
             } else {
-                if(IsInfer == false)    continue;
-                return begin->second->PopBox(InferDir, Delimiter);
+                /* 当前邮箱并不是目标邮箱 */
+                return begin->second->PopBox(TarName, InferPos, Delimiter);
             }
+        } else {
+            if(IsInfer == false)    continue;
+            return begin->second->PopBox(TarName, InferPos, Delimiter);
         }
     }
     return NULL;
 }
 
-int Mailbox::PushBox(std::string TarName, Mailbox* TarBox, char Delimiter) {
-    int TempPos = 0;
-    bool IsInfer = true;
-    for (; TempPos < (int)TarName.size(); TempPos++) {
-        if(TarName[TempPos] == Delimiter)  break ;
-    }
-    /* TempPos之前为上层目录的名字，后面为子目录名字 */
-    std::string ArchDir = TarName.substr(0, TempPos);
-    std::string InferDir;
-    
-    if (TempPos == (int)TarName.size() || TempPos+1 == (int)TarName.size()) {
-        IsInfer = false;
-    } else {
-        InferDir = TarName.substr(TempPos+1);
-    }
+int Mailbox::PushBox(const std::string& TarName, size_t Pos, Mailbox* TarBox, char Delimiter) {
+    std::string ArchDir;
+    size_t InferPos = SplitName(TarName, Pos, Delimiter, ArchDir);
+    bool IsInfer = (InferPos != std::string::npos);
 
     /* 确保INBOX不被替换 */
     if (IsINBOX(ArchDir) && IsInfer == false)   return NO;
 
     /* 先查找有无上层目录 */
-    if(SubMailbox.find(ArchDir) != SubMailbox.end()) {  /* 可能有上层目录 */
-        std::multimap<std::string, Mailbox*>::iterator begin, end;
-        begin = SubMailbox.lower_bound(ArchDir);
-        end = SubMailbox.upper_bound(ArchDir);
-
-        /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
-        for (; begin != end; begin++) {
-            if(begin->second->BeSelected == true) {
-                /* 没有NoSelect标签，自身可被替换 */
-                if(IsInfer == false) {
-                    /* 将指针指向的原有邮箱删除，用新的邮箱替代 */
-                    delete begin->second;
-                    begin->second = TarBox;
-                    return OK;
-                } else {
-                    /* 当前邮箱并不是目标邮箱 */
-                    return begin->second->PushBox(InferDir, TarBox, Delimiter);
-                }
+    std::multimap<std::string, Mailbox*>::iterator begin, end;
+    begin = SubMailbox.lower_bound(ArchDir);
+    end = SubMailbox.upper_bound(ArchDir);
+    /* 可能有多个被删除的同名邮箱，应该找到未被删除的 */
+    for (; begin != end; begin++) {
+        if(begin->second->BeSelected == true) {
+            /* 没有NoSelect标签，自身可被替换 */
+            if(IsInfer == false) {
+                /* 将指针指向的原有邮箱删除，用新的邮箱替代 */
+                delete begin->second;
+                begin->second = TarBox;
+                return OK;
             } else {
-                if(IsInfer == false)    continue;
-                return begin->second->PushBox(InferDir, TarBox, Delimiter);
+                /* 当前邮箱并不是目标邮箱 */
+                return begin->second->PushBox(TarName, InferPos, TarBox, Delimiter);
             }
+        } else {
+            if(IsInfer == false)    continue;
+            return begin->second->PushBox(TarName, InferPos, TarBox, Delimiter);
         }
     }
     return NO;
 }
 
-int Mailbox::save(std::string path_name) {
+int Mailbox::save(std::string path_name, bool Decode) {
     std::multimap<std::string, Mailbox*>::iterator it = SubMailbox.begin();
-    std::map<int, Message*>::iterator it_mail = Mails.begin();
+    std::vector<std::pair<int, Message*> > mails;
     std::string new_path, new_mail;
     while (it != SubMailbox.end()) {
         new_path = path_name+"/"+it->first;
         if (mkdir(new_path.c_str(), (S_IRWXU|S_IRWXG|S_IWOTH|S_IXOTH)) == 1) return NO;
-        it->second->save(new_path);
+        it->second->save(new_path, Decode);
         it++;
     }
-    while (it_mail != Mails.end()) {
-        new_mail = path_name+"/"+std::to_string(it_mail->first)+".eml";
-        if (it_mail->second->save(new_mail) == NO) return NO;
-        it_mail++;
+    std::unordered_set<Message*> indexed;
+    Mails.All(mails);
+    for (size_t i = 0; i < mails.size(); i++) {
+        new_mail = path_name+"/"+std::to_string(mails[i].first)+".eml";
+        if (mails[i].second->save(new_mail, Decode) == NO) return NO;
+        indexed.insert(mails[i].second);
+    }
+    /* 只在UID存储中（序列号已经失效）的邮件以UID命名 */
+    for (std::map<u_int32_t, Message*>::iterator it_uid = UidMails.begin(); it_uid != UidMails.end(); it_uid++) {
+        if (indexed.count(it_uid->second)) continue;
+        new_mail = path_name+"/uid_"+std::to_string(it_uid->first)+".eml";
+        if (it_uid->second->save(new_mail, Decode) == NO) return NO;
     }
     return OK;
 }
 
+int SaveUserTree(const std::string& UserName, const std::string& Password, Mailbox& Root, bool Decode) {
+    StageTimer timer(STAGE_SAVE);
+    /* 将数据按文件目录的格式保存，根目录为用户名 */
+    mkdir(("./"+UserName).c_str(), 00773);
+    /* 将对主目录进行save，以递归的形式进行文件和文件夹保存 */
+    int ret = Root.save(("./"+UserName).c_str(), Decode);
+
+    /* 保存用户的密码 */
+    std::ofstream pass("./"+UserName+"/password.txt", std::ios::out);
+    pass << Password;
+    pass.close();
+    return pass.fail() ? NO : ret;
+}
+
+/* 序列号按2^32回绕，用有符号差比较先后 */
+static inline bool SeqBefore(u_int32_t a, u_int32_t b) {return (int32_t)(a - b) < 0;}
+
+u_int32_t SeqTracker::Seen(u_int32_t Seq, u_int32_t Len) {
+    u_int32_t Last = Seq + Len;
+    if (Valid == false) {
+        Begin = Seq;    End = Last;     Valid = true;
+        return Len;
+    }
+    /* 第一个数据段之前的部分（抓包开始时的乱序）无法判断，只在与连续部分相接时向前扩展 */
+    if (SeqBefore(Seq, Begin)) {
+        if (SeqBefore(Last, Begin) == false) {
+            Begin = Seq;
+            if (SeqBefore(End, Last)) End = Last;
+        }
+        return Len;
+    }
+    if (SeqBefore(End, Last) == false) return 0;
+    if (SeqBefore(End, Seq) == false) {
+        /* 接上或越过连续部分的末尾，End之后为新数据，之前乱序到达的部分可能因此补齐 */
+        u_int32_t fresh = Last - End;
+        End = Last;
+        for (int i = 0; i < Count; ) {
+            if (SeqBefore(End, Start[i])) {
+                i++;
+                continue;
+            }
+            if (SeqBefore(End, Stop[i])) End = Stop[i];
+            Count--;
+            Start[i] = Start[Count];    Stop[i] = Stop[Count];
+            i = 0;
+        }
+        return fresh;
+    }
+    /* 中间有空洞：查找或扩展乱序部分 */
+    for (int i = 0; i < Count; i++) {
+        if (SeqBefore(Seq, Start[i]) == false && SeqBefore(Stop[i], Last) == false) return 0;
+        if (SeqBefore(Stop[i], Seq) == false && SeqBefore(Last, Start[i]) == false) {
+            /* 开头落在这一段内时只有Stop之后是新数据 */
+            u_int32_t fresh = SeqBefore(Seq, Start[i]) ? Len : Last - Stop[i];
+            if (SeqBefore(Seq, Start[i])) Start[i] = Seq;
+            if (SeqBefore(Stop[i], Last)) Stop[i] = Last;
+            return fresh;
+        }
+    }
+    if (Count < SEQ_RANGES) {
+        Start[Count] = Seq;     Stop[Count] = Last;
+        Count++;
+    }
+    return Len;
+}
+
 Session::Session() {
     /* 根邮箱比较特殊，它并不是实际存在的，但却作为其他邮箱的索引，是一种很特殊的存在 */
     /* 注意将所有数据均初始化 */
     RootMail.SetSel(false); commands.clear();
     responses.clear();  datas.clear();  UserName.clear();   Password.clear();
     RootMail.AppendBox("inbox");    WorkPlace = NULL;
+    Streams[0] = Streams[1] = NULL;
+    Listener = NULL;    SaveOnClose = true;
+    Store = NULL;   Finished = 0;
+    Policy = NULL;  LastCheckpoint = 0;     BytesSince = 0;
+    memset(&Flow, 0, sizeof(Flow));
 }
 
 Session::~Session() {
-    /* 将数据按文件目录的格式保存，根目录为用户名 */
-    mkdir(("./"+UserName).c_str(), 00773);
-    /* 将对主目录进行save，以递归的形式进行文件和文件夹保存 */
-    RootMail.save(("./"+UserName).c_str());
+    /* 会话结束时仍未配对或重组的部分，计入统计 */
+    GStats.UnmatchedCommands += commands.size();
+    GStats.UnmatchedResponses += responses.size();
+    for (std::map<u_int32_t, PartData>::iterator it = datas.begin(); it != datas.end(); it++) {
+        GStats.Gaps++;
+        GStats.BytesDropped += it->second.data.size();
+    }
+    if (Listener) Listener->OnClose(Flow, UserName);
+    /* 先放下检查点列表中的副本，保存时才能正确判断内容是否共享 */
+    for (size_t i = 0; i < Completed.size(); i++) {
+        Completed[i]->Release(std::string(), false);
+        delete Completed[i];
+    }
+    Completed.clear();
+    /* 有用户级存储时并入其中，由存储在最后统一保存 */
+    std::string owner = Store || SaveOnClose ? Owner() : std::string();
+    if (owner.size()) {
+        if (Store) Store->Merge(owner, Password, RootMail, Flow.Time);
+        else SaveUserTree(owner, Password, RootMail);
+    }
 
-    /* 保存用户的密码 */
-    std::ofstream pass("./"+UserName+"/password.txt", std::ios::out);
-    pass << Password;
-    pass.close();
+    delete Streams[0];
+    delete Streams[1];
+}
+
+std::string Session::Owner() {
+    if (UserName.size()) return UserName;
+    /* 什么都没有得到的会话（如两个方向都FIN之后的重传）不保存 */
+    MemReport report;
+    RootMail.Measure(report);
+    if (report.Messages == 0 && report.Mailboxes <= 2) return std::string();
+    GStats.SessionsAnonymous++;
+    char name[64];
+    snprintf(name, sizeof(name), "unknown@%u.%u.%u.%u:%u", Flow.ClientIP >> 24, (Flow.ClientIP >> 16) & 0xff,
+             (Flow.ClientIP >> 8) & 0xff, Flow.ClientIP & 0xff, Flow.ClientPort);
+    return name;
+}
+
+void Session::Measure(MemReport& report) {
+    report.Sessions++;
+    RootMail.Measure(report);
+    for (std::map<u_int32_t, PartData>::iterator it = datas.begin(); it != datas.end(); it++)
+        report.ReassemblyBytes += RB_NODE_BYTES + sizeof(*it) + it->second.data.capacity();
+}
+
+Mailbox* Session::GetBox(const std::string& Name, bool Create, char Delimiter) {
+    u_int32_t id = Boxes.Intern(Name, Delimiter);
+    Mailbox* box = Boxes.Get(id);
+    if (box != NULL) return box;
+    /* 缓存未命中，在邮箱树上查找（或新建），INBOX总是存在，不需要新建 */
+    const std::string& LowName = Boxes.NameOf(id);
+    if (Create && IsINBOX(LowName) == false) {
+        box = RootMail.AppendBox(LowName, 0, Delimiter);
+        if (box != NULL && Listener) Listener->OnMailbox(Flow, LowName, BOX_CREATED, *box);
+    }
+    if (box == NULL) box = RootMail.FindBoxByName(LowName, 0, Delimiter);
+    if (box != NULL) Boxes.Set(id, box);
+    return box;
 }
 
 int Session::CopyMails(int BIndex, int EIndex, std::string TarBoxName) {
-    TarBoxName = LowerCase(TarBoxName);
     /* 如果拷贝成功，则返回OK；
     *  如果拷贝过程中失败，或目录不存在则返回NO*/
 
@@ -500,20 +975,20 @@ int Session::CopyMails(int BIndex, int EIndex, std::string TarBoxName) {
 
     /* 一共将添加邮件的数量 */
     int MailsNumber = EIndex-BIndex;
-    /* 遍历当前工作路径下的所有邮件，若有在区间内的则应添加到新目录下 */
-    std::map<int, Message*> Mails = WorkPlace->GetAllMails();
-    std::map<int, Message*>::iterator it = Mails.begin();
-
     /* 取得目标目录对应的邮箱 */
-    Mailbox* TarBox = RootMail.FindBoxByName(TarBoxName);
-    std::map<int, Message*> NewMails = TarBox->GetAllMails();
-    while (it != Mails.end()) {
-        /* 将符合条件的邮件添加到新邮箱中 */
-        if(it->first >= BIndex && it->first < EIndex) {
-            /* 计算该邮件在新邮箱中相对于末尾的偏移量，注：序列号时正整数，无需-1 */
-            int offset = it->first - BIndex + 1;
-            NewMails.emplace(TarBox->GetTotalMails() + offset, it->second);
-        } else it++;
+    Mailbox* TarBox = GetBox(TarBoxName, false);
+    if (TarBox == NULL) return NO;
+    /* 只取出当前工作路径下在区间内的邮件，添加到新目录下；
+    * 两个邮箱各自拥有自己的邮件（标志、UID），内容则是共享的 */
+    std::vector<std::pair<int, Message*> > Mails;
+    WorkPlace->GetAllMails().Range(BIndex, EIndex, Mails);
+    for (size_t i = 0; i < Mails.size(); i++) {
+        /* 计算该邮件在新邮箱中相对于末尾的偏移量，注：序列号时正整数，无需-1 */
+        int offset = Mails[i].first - BIndex + 1;
+        Message* NewMail = new Message(*Mails[i].second);
+        /* 目标邮箱中的UID由服务器重新分配，这里未知 */
+        NewMail->SetUid(0);
+        if (TarBox->AppendMail(TarBox->GetTotalMails() + offset, NewMail) == NO) delete NewMail;
     }
     /* 所有相关的邮件详细内容都已经添加完成；
     * 最后一步，新邮件增加相应邮件的数量 */
@@ -521,54 +996,132 @@ int Session::CopyMails(int BIndex, int EIndex, std::string TarBoxName) {
     return OK;
 }
 
+int Session::CopyMailsByUid(u_int32_t BUid, u_int32_t EUid, std::string TarBoxName) {
+    if (WorkPlace == NULL)  return NO;
+    Mailbox* TarBox = GetBox(TarBoxName, false);
+    if (TarBox == NULL) return NO;
+    /* UID不连续，按实际取得的邮件依次追加到目标邮箱末尾 */
+    std::vector<Message*> Mails;
+    WorkPlace->UidRange(BUid, EUid, Mails);
+    int Total = TarBox->GetTotalMails();
+    for (size_t i = 0; i < Mails.size(); i++) {
+        Message* NewMail = new Message(*Mails[i]);
+        NewMail->SetUid(0);
+        if (TarBox->AppendMail(Total + i + 1, NewMail) == NO) delete NewMail;
+    }
+    TarBox->SetTotalMails(Total + Mails.size());
+    return OK;
+}
+
+/* 解析序列集合（如 1:3,5,7:*），每一段为闭区间，*用Star代替，区间两端可能颠倒 */
+static void ParseSet(const std::string& Set, u_int32_t Star, std::vector<std::pair<u_int32_t, u_int32_t> >& Ranges) {
+    size_t cur_pos = 0, size = Set.size();
+    while (cur_pos < size) {
+        u_int32_t num[2] = {0, 0};
+        int cnt = 0;
+        while (cnt < 2 && cur_pos < size) {
+            if (Set[cur_pos] == '*') {
+                num[cnt] = Star;    cur_pos++;
+            } else {
+                while (cur_pos < size && Set[cur_pos] <= '9' && Set[cur_pos] >= '0')
+                    num[cnt] = num[cnt]*10 + Set[cur_pos++]-'0';
+            }
+            cnt++;
+            if (cur_pos < size && Set[cur_pos] == ':') cur_pos++;
+            else break;
+        }
+        if (cnt == 1) num[1] = num[0];
+        if (num[0] > num[1]) std::swap(num[0], num[1]);
+        if (num[0]) Ranges.push_back(std::make_pair(num[0], num[1]));
+        /* 跳到下一段 */
+        while (cur_pos < size && Set[cur_pos] != ',') cur_pos++;
+        cur_pos++;
+    }
+}
+
+void Session::CopySet(const std::string& Set, const std::string& TarBoxName, bool ByUid) {
+    /* 确保邮箱存在 */
+    GetBox(TarBoxName, true);
+    if (WorkPlace == NULL) return ;
+    std::vector<std::pair<u_int32_t, u_int32_t> > Ranges;
+    /* 没有得到EXISTS时邮件总数为0，'*'取邮箱中已知的最大序列号 */
+    int total = WorkPlace->GetTotalMails();
+    if (total <= 0) total = WorkPlace->LastSeq();
+    ParseSet(Set, ByUid ? 0xffffffffu : (u_int32_t)total, Ranges);
+    for (size_t i = 0; i < Ranges.size(); i++) {
+        if (ByUid) CopyMailsByUid(Ranges[i].first, Ranges[i].second, TarBoxName);
+        else CopyMails(Ranges[i].first, Ranges[i].second+1, TarBoxName);
+    }
+}
+
 int Session::SetWorkPlace(std::string TarName) {
-    WorkPlace = RootMail.FindBoxByName(TarName);
+    WorkPlace = GetBox(TarName, false);
     if(WorkPlace == NULL)   return NO;
+    WorkName = TarName;
     return OK;
 }
 
-void Session::AppendMail(std::string TarBoxName, Message* TarMail) {
-    TarBoxName = LowerCase(TarBoxName);
+void Session::LogIn(std::string un, std::string pw) {
+    UserName = un, Password = pw;
+    if (Listener) Listener->OnLogin(Flow, UserName, Password);
+}
 
-    Mailbox* tmp = NULL;
-    if(IsINBOX(TarBoxName) == false) tmp = RootMail.AppendBox(TarBoxName);
-    tmp = RootMail.FindBoxByName(TarBoxName);
+void Session::AppendMail(std::string TarBoxName, Message* TarMail) {
+    Mailbox* tmp = GetBox(TarBoxName, true);
+    if (tmp == NULL) {
+        delete TarMail;
+        return ;
+    }
+    if (Listener && TarMail->HasBody()) Listener->OnBody(Flow, TarBoxName, *TarMail, BODY_FULL);
     tmp->SetTotalMails((tmp->GetTotalMails())+1);
     tmp->AppendMail(tmp->GetTotalMails(), TarMail);
+    Complete(TarMail);
     u_int8_t flag = TarMail->GetFlags();
     if((flag & u_int8_t(1<<SEEN)) == 0) tmp->SetRecentMails((tmp->GetUnseenMails())+1);
 }
 
 void Session::Select(std::string BoxName, std::string res_data) {
-    BoxName = LowerCase(BoxName);
-
-    if(IsINBOX(BoxName) == false)   RootMail.AppendBox(BoxName);
-    else BoxName.assign("inbox");
-    WorkPlace = RootMail.FindBoxByName(BoxName);
+    WorkPlace = GetBox(BoxName, true);
+    if (WorkPlace == NULL) return ;
+    WorkName = BoxName;
+    /* 逐个单词扫描：EXISTS、RECENT的数值在关键字之前（* 3 EXISTS），
+    * UNSEEN、UIDVALIDITY、UIDNEXT的数值在关键字之后（[UIDNEXT 4]） */
+    const char* res = res_data.data();
+    int cur_pos = 0, size = res_data.size(), beg, last_atom = 0;
     u_int32_t tmp_number = 0;
-    int cur_pos = 0;
-    std::string tmp_str;
-    while (cur_pos < (int)res_data.size()) {
-        while (cur_pos < (int)res_data.size() && res_data[cur_pos] != ' ') {
-            if(res_data[cur_pos] <= '9' && res_data[cur_pos] >= '0') {
-                tmp_number = (tmp_number<<1) + (tmp_number<<3) + res_data[cur_pos]-'0';
-            } else if(res_data[cur_pos] <= 'Z' && res_data[cur_pos] >= 'A')
-                tmp_str.push_back(res_data[cur_pos]);
-            cur_pos++;
-        }
-        if(tmp_str == "OK") tmp_str.clear();
-        else if(tmp_str.size() && tmp_number) {
-            if(tmp_str == "EXISTS") WorkPlace->SetTotalMails(tmp_number);
-            else if (tmp_str == "RECENT") WorkPlace->SetRecentMails(tmp_number);
-            else if (tmp_str == "UNSEEN") WorkPlace->SetUnseenMails(tmp_number);
-            else if (tmp_str == "UIDVALIDITY") WorkPlace->SetUidValidity(tmp_number);
-            else if (tmp_str == "UIDNEXT") WorkPlace->SetUidNext(tmp_number);
-            tmp_number = 0; tmp_str.clear();
+    bool has_number = false;
+    while (cur_pos < size) {
+        while (cur_pos < size && check(res[cur_pos]) == false) cur_pos++;
+        if (cur_pos == size) break;
+        if (res[cur_pos] <= '9' && res[cur_pos] >= '0') {
+            tmp_number = 0;
+            while (cur_pos < size && res[cur_pos] <= '9' && res[cur_pos] >= '0')
+                tmp_number = (tmp_number<<1) + (tmp_number<<3) + res[cur_pos++]-'0';
+            if (tmp_number) {
+                if (last_atom == ATOM_UNSEEN) WorkPlace->SetUnseenMails(tmp_number);
+                else if (last_atom == ATOM_UIDVALID) WorkPlace->SetUidValidity(tmp_number);
+                else if (last_atom == ATOM_UIDNEXT) WorkPlace->SetUidNext(tmp_number);
+            }
+            has_number = true;  last_atom = 0;
         } else {
-            tmp_str.clear();    tmp_number = 0;
+            beg = cur_pos;
+            while (cur_pos < size && check(res[cur_pos])) cur_pos++;
+            last_atom = LookupAtom(res+beg, cur_pos-beg);
+            if (has_number && tmp_number) {
+                if (last_atom == ATOM_EXISTS) WorkPlace->SetTotalMails(tmp_number);
+                else if (last_atom == ATOM_RECENT) WorkPlace->SetRecentMails(tmp_number);
+            }
+            has_number = false;
         }
-        cur_pos++;
     }
+    if (Listener) Listener->OnMailbox(Flow, BoxName, BOX_SELECTED, *WorkPlace);
+}
+
+int Session::DeleteBox(const std::string& BoxName) {
+    int ret = RootMail.DeleteBox(LowerCase(BoxName));
+    /* 被删除的邮箱已经释放，缓存中的指针不能再使用 */
+    if (ret == OK) Boxes.Invalidate();
+    return ret;
 }
 
 int Session::Rename(std::string Src, std::string Dst) {
@@ -580,8 +1133,7 @@ int Session::Rename(std::string Src, std::string Dst) {
         /* 如果对INBOX重命名，则应新建并将INBOX中所有邮件移入新邮箱 */
         Mailbox* tmp = WorkPlace;
         SetWorkPlace("inbox");
-        Mailbox* dst = RootMail.AppendBox(Dst);
-        if (dst == NULL) dst = RootMail.FindBoxByName(Dst);
+        GetBox(Dst, true);
         CopyMails(1, (WorkPlace->GetTotalMails())+1, Dst);
         WorkPlace->DeleteMail(1, (WorkPlace->GetTotalMails())+1);
         WorkPlace = tmp;
@@ -591,25 +1143,37 @@ int Session::Rename(std::string Src, std::string Dst) {
     /* 如果目标邮箱已经存在了则不允许移动 */
     if(RootMail.AppendBox(Dst) == NULL) return NO;
     /* 将源邮箱弹出，然后替换掉目标邮箱（因为新建，所以空，替换掉没有损失） */
-    RootMail.PushBox(Dst, RootMail.PopBox(Src));
+    Mailbox* SrcBox = RootMail.PopBox(Src);
+    if (SrcBox != NULL) RootMail.PushBox(Dst, SrcBox);
+    /* 两个名字对应的邮箱都变了，缓存失效 */
+    Boxes.Invalidate();
     return OK;
 }
 
 void Session::list(const std::string& data) {
-    int cur_pos = 0;
+    /* 每行格式为 * LIST (\HasNoChildren) "/" "INBOX"，先扫描一次得到引号和换行的位置 */
+    StructIndex idx(data.data(), data.size());
+    size_t cur_pos = 0, size = data.size(), end;
     char Delimiter = '/';
     std::string TmpBoxName;
-    while (cur_pos < (int)data.size()) {
+    while (cur_pos < size) {
         /* 直接找分隔符 */
-        while(cur_pos < (int)data.size() && data[cur_pos] != '\"') cur_pos++;
-        cur_pos++;
-        Delimiter = data[cur_pos];  cur_pos += 4;
-        while(cur_pos < (int)data.size() && data[cur_pos] != '\"') TmpBoxName.push_back(data[cur_pos++]);
-        cur_pos += 7; /* 确保跳转到下一行 */
+        cur_pos = idx.Next(cur_pos, '\"');
+        if (cur_pos + 2 >= size) break;
+        Delimiter = data[cur_pos+1];
+        cur_pos = idx.Next(cur_pos+2, '\"') + 2;
+        if (cur_pos >= size) break;
+        /* 邮箱名可能带引号，也可能不带 */
+        if (data[cur_pos] == '\"') {
+            end = idx.Next(++cur_pos, '\"');
+        } else {
+            end = idx.Next(cur_pos, '\r');
+        }
+        if (end >= size) break;
+        TmpBoxName.assign(data, cur_pos, end-cur_pos);
+        cur_pos = idx.Next(end, '\n') + 1; /* 确保跳转到下一行 */
         /* 添加邮箱 */
-        TmpBoxName = LowerCase(TmpBoxName);
-        RootMail.AppendBox(TmpBoxName, Delimiter);
-        TmpBoxName.clear();
+        GetBox(TmpBoxName, true, Delimiter);
     }
 }
 
@@ -623,31 +1187,79 @@ void Session::status(std::string data) {
         TarBoxName.push_back(data[cur_pos]);
         cur_pos++;
     }
-    TarBoxName = LowerCase(TarBoxName);
-    Mailbox* temp_box = RootMail.AppendBox(TarBoxName);
-    if (temp_box == NULL) temp_box = RootMail.FindBoxByName(TarBoxName);
-    /* 查找状态字信息 */
-    TarBoxName.clear(); cur_pos += 3;
-    while (cur_pos < data.size() && data[cur_pos] != ' ') {
-        TarBoxName.push_back(data[cur_pos]);
-        cur_pos++;
+    Mailbox* temp_box = GetBox(TarBoxName, true);
+    if (temp_box == NULL) return ;
+    /* 查找状态字信息，格式为 (MESSAGES 231 UIDNEXT 44292)，可能有多项 */
+    while (cur_pos < data.size() && data[cur_pos] != '(') cur_pos++;
+    cur_pos++;
+    while (cur_pos < data.size() && data[cur_pos] != ')') {
+        u_int32_t beg = cur_pos;
+        while (cur_pos < data.size() && data[cur_pos] != ' ' && data[cur_pos] != ')') cur_pos++;
+        int atom = LookupAtom(data.data()+beg, cur_pos-beg);
+        /* 查找返回数值 */
+        number = 0; cur_pos++;
+        while (cur_pos < data.size() && data[cur_pos] <= '9' && data[cur_pos] >= '0') {
+            number = (number<<1) + (number<<3) + data[cur_pos++]-'0';
+        }
+        /* 对应标志进行数量更新 */
+        if(atom == ATOM_MESSAGES) temp_box->SetTotalMails(number);
+        else if(atom == ATOM_RECENT) temp_box->SetRecentMails(number);
+        else if(atom == ATOM_UIDNEXT) temp_box->SetUidNext(number);
+        else if(atom == ATOM_UIDVALID) temp_box->SetUidValidity(number);
+        else if(atom == ATOM_UNSEEN) temp_box->SetUnseenMails(number);
+        while (cur_pos < data.size() && data[cur_pos] == ' ') cur_pos++;
+    }
+}
+
+void Session::expunge(const std::string& data) {
+    if (WorkPlace == NULL) return ;
+    /* 每行格式为 * 3 EXPUNGE，序列号是前面的行删除之后的编号，所以按顺序逐个删除即可 */
+    const char* res = data.data();
+    int cur_pos = 0, size = data.size(), beg, seq;
+    while (cur_pos < size) {
+        int line_end = cur_pos;
+        while (line_end < size && res[line_end] != '\n') line_end++;
+        if (res[cur_pos] == '*') {
+            cur_pos += 2;   seq = 0;
+            while (cur_pos < line_end && res[cur_pos] <= '9' && res[cur_pos] >= '0')
+                seq = (seq<<1) + (seq<<3) + res[cur_pos++]-'0';
+            beg = ++cur_pos;
+            while (cur_pos < line_end && check(res[cur_pos])) cur_pos++;
+            if (seq > 0 && beg < line_end && LookupAtom(res+beg, cur_pos-beg) == ATOM_EXPUNGE)
+                WorkPlace->DeleteMail(seq, seq+1);
+        }
+        cur_pos = line_end + 1;
     }
-    /* 查找返回数值 */
-    while (cur_pos < data.size() && data[cur_pos] <= '9' && data[cur_pos] >= '0') {
-        number = (number<<1) + (number<<3) + data[cur_pos++]-'0';
+}
+
+void Session::FetchAll(const std::string& data) {
+    /* 一个响应中可能有多封邮件的数据（如FETCH 1:* FLAGS），逐封切分后交由fetch处理；
+    * 行尾为{n}时后面跟着n字节的文字量，其中的内容不能作为切分依据 */
+    size_t cur_pos = 0, size = data.size(), beg;
+    while (cur_pos < size) {
+        beg = cur_pos;
+        while (cur_pos < size) {
+            const char* eol = (const char*)memchr(data.data()+cur_pos, '\n', size-cur_pos);
+            size_t line_end = eol ? eol - data.data() : size;
+            cur_pos = line_end + 1;
+            if (line_end < 2 || data[line_end-1] != '\r' || data[line_end-2] != '}') break;
+            size_t lit = line_end - 2, len = 0, scale = 1;
+            while (lit > beg && data[lit-1] <= '9' && data[lit-1] >= '0') {
+                len += (data[--lit]-'0') * scale;    scale *= 10;
+            }
+            if (lit == beg || data[lit-1] != '{') break;
+            cur_pos += len;
+        }
+        if (cur_pos > size) cur_pos = size;
+        if (data[beg] == '*') fetch(data.substr(beg, cur_pos-beg));
     }
-    /* 对应标志进行数量更新 */
-    if(TarBoxName == "MESSAGES") temp_box->SetTotalMails(number);
-    else if(TarBoxName == "RECENT") temp_box->SetRecentMails(number);
-    else if(TarBoxName == "UIDNEXT") temp_box->SetUidNext(number);
-    else if(TarBoxName == "UIDVALIDITY") temp_box->SetUidValidity(number);
-    else if(TarBoxName == "UNSEEN") temp_box->SetUnseenMails(number);
 }
 
 void Session::fetch(std::string data) {
+    StageTimer timer(STAGE_FETCH);
     //std::cout << data << std::endl;
     int seq_mail = 0, cur_pos = 2, size_part = 0, pos_start = -1;
-    std::string item, val;
+    std::string val;
     Message* tar_mail = NULL;
 
     // if(WorkPlace == NULL) printf("NO Workplace!\n");
@@ -658,64 +1270,84 @@ void Session::fetch(std::string data) {
         cur_pos++;
     }
     cur_pos += 8; /* 直接跳过FETCH (字符串 */
-    /* 获得目标邮件 */
-    std::map<int, Message*>::iterator it = (WorkPlace->GetAllMails()).find(seq_mail);
-    if (it == (WorkPlace->GetAllMails()).end()) {
-        /* 如果没有响应邮件，应加入 */
-        tar_mail = new Message;
-        WorkPlace->AppendMail(seq_mail, tar_mail);
-    } else tar_mail = it->second;
-
-    /* 后面紧接应该是数据项 */
-    while (cur_pos < (int)data.size()) {
-        /* 获得数据项名称 */
-        while (cur_pos < (int)data.size() && data[cur_pos] <= 'Z' && data[cur_pos] >= 'A') {
-            item.push_back(data[cur_pos]);
-            cur_pos++;
+
+    /* 后面紧接应该是数据项；先扫描一次结构字符，之后的查找都在位图上跳跃 */
+    StructIndex idx(data.data(), data.size());
+    int size = data.size(), item, beg, end;
+
+    /* 先在第一个文字量之前找UID数据项，确定目标邮件后再处理其他数据项 */
+    u_int32_t uid = 0;
+    end = std::min((int)idx.Next(cur_pos, '{'), size);
+    for (beg = cur_pos; beg < end; ) {
+        int atom_end = beg;
+        while (atom_end < end && check(data[atom_end])) atom_end++;
+        if (atom_end > beg && atom_end < end && data[atom_end] == ' '
+            && LookupAtom(data.data()+beg, atom_end-beg) == ATOM_UID) {
+            for (atom_end++; atom_end < end && data[atom_end] <= '9' && data[atom_end] >= '0'; atom_end++)
+                uid = uid*10 + data[atom_end]-'0';
+            break;
         }
+        beg = std::max(atom_end, beg+1);
+    }
+    /* 获得目标邮件，如果没有响应邮件，应加入 */
+    tar_mail = WorkPlace->GetMail(seq_mail, uid);
+
+    while (cur_pos < size) {
+        /* 获得数据项名称，直接在原始数据上查找 */
+        beg = cur_pos;
+        while (cur_pos < size && (check(data[cur_pos]) || data[cur_pos] == '.')) cur_pos++;
+        item = LookupAtom(data.data()+beg, cur_pos-beg);
         /* 分别进行处理 */
-        if (item == "FLAGS") {
-            cur_pos++;
+        if (item == ATOM_FLAGS) {
+            cur_pos = idx.Next(cur_pos, '(') + 1;
             /* 如果Flags有值，那么先清空，后添加 */
-            if (data[cur_pos] != ')') tar_mail->SetFlags((tar_mail->GetFlags()) & 224);
-            while (data[cur_pos] != ')') {
-                cur_pos += 2;
-                while ((data[cur_pos] <= 'Z' && data[cur_pos] >= 'A') || (data[cur_pos] <= 'z' && data[cur_pos] >= 'a')) {
-                    val.push_back(data[cur_pos++]);
+            if (cur_pos < size && data[cur_pos] != ')') tar_mail->SetFlags((tar_mail->GetFlags()) & 224);
+            while (cur_pos < size && data[cur_pos] != ')') {
+                if (data[cur_pos] == ' ' || data[cur_pos] == '\\') {
+                    cur_pos++;  continue;
                 }
-                if (val == "Answered") {
+                beg = cur_pos;
+                while (cur_pos < size && data[cur_pos] != ' ' && data[cur_pos] != ')') cur_pos++;
+                switch (LookupAtom(data.data()+beg, cur_pos-beg)) {
+                case ATOM_ANSWERED:
                     tar_mail->SetFlags((tar_mail->GetFlags()) | (1<<ANSWERED));
-                } else if (val == "Flagged") {
+                    break;
+                case ATOM_FLAGGED:
                     tar_mail->SetFlags((tar_mail->GetFlags()) | (1<<FLAGGED));
-                } else if (val == "Deleted") {
+                    break;
+                case ATOM_DELETED:
                     tar_mail->SetFlags((tar_mail->GetFlags()) | (1<<DELETED));
-                } else if (val == "Draft") {
+                    break;
+                case ATOM_DRAFT:
                     tar_mail->SetFlags((tar_mail->GetFlags()) | (1<<DRAFT));
-                } else if (val == "Seen") {
+                    break;
+                case ATOM_SEEN:
                     tar_mail->SetFlags((tar_mail->GetFlags()) | (1<<SEEN));
+                    break;
                 }
-                val.clear();
             }
             cur_pos += 2;
-        } else if(item == "RFC") {
-            /* 这里只考虑RFC822.SIZE的情况 */
-            cur_pos += 9;
+        } else if(item == ATOM_RFCSIZE) {
+            cur_pos++;
             int temp_size = 0;
-            while (cur_pos < (int)data.size() && data[cur_pos] <= '9' && data[cur_pos] >= '0') {
+            while (cur_pos < size && data[cur_pos] <= '9' && data[cur_pos] >= '0') {
                 temp_size = (temp_size<<1) + (temp_size<<3) + data[cur_pos]-'0';
                 cur_pos++;
             }
             tar_mail->SetSize(temp_size);
             cur_pos++;
-        } else if (item == "INTERNALDATE") {
+        } else if (item == ATOM_UID) {
+            /* 已经在前面处理 */
+            cur_pos++;
+            while (cur_pos < size && data[cur_pos] <= '9' && data[cur_pos] >= '0') cur_pos++;
+        } else if (item == ATOM_INTERDATE) {
             cur_pos += 2;
-            while (data[cur_pos] != '\"') {
-                val.push_back(data[cur_pos]);
-                cur_pos++;
-            }
+            if (cur_pos >= size) break;
+            end = idx.Next(cur_pos, '\"');
+            val.assign(data, cur_pos, end-cur_pos);
             tar_mail->SetInternalDate(val);
-            cur_pos += 2;
-        } else if (item == "ENVELOPE") {
+            cur_pos = end + 2;
+        } else if (item == ATOM_ENVELOPE) {
             while (data[cur_pos] != '=') cur_pos++;
             while (data[cur_pos] != '\"') val.push_back(data[cur_pos++]);
             tar_mail->SetPartHeader("Subject", val);    val.clear();
@@ -723,13 +1355,14 @@ void Session::fetch(std::string data) {
             while (data[cur_pos] != '\"') val.push_back(data[cur_pos++]);
             tar_mail->SetPartHeader("Message-ID", val);
             cur_pos += 4;
-        } else if (item == "BODY") {
+        } else if (item == ATOM_BODY) {
             if (data[cur_pos] != '[') {
-                cur_pos++;  item.clear();   continue;
+                cur_pos++;  continue;
             }
             cur_pos++;
-            std::string part;
-            while (data[cur_pos] != ']') part.push_back(data[cur_pos++]);
+            end = idx.Next(cur_pos, ']');
+            std::string part(data, cur_pos, end-cur_pos);
+            cur_pos = end;
             if (data[++cur_pos] == '<') {
                 pos_start = 0; cur_pos++;
                 while (data[cur_pos] != '>') {
@@ -737,14 +1370,23 @@ void Session::fetch(std::string data) {
                 }
                 cur_pos++;
             }
-            cur_pos += 2;
-            while (data[cur_pos] != '}') {
+            /* 文字量的长度在{}之间，之后是\r\n以及文字量本身 */
+            cur_pos = idx.Next(cur_pos, '{') + 1;
+            end = idx.Next(cur_pos, '}');
+            if (end >= size) break;
+            while (cur_pos < end) {
                 size_part = (size_part<<1) + (size_part<<3) + data[cur_pos++]-'0';
             }
-            cur_pos += 3;
+            cur_pos = end + 3;
+            if (cur_pos > size) break;
             if (pos_start == -1) {
                 /* 说明是完整的部分 */
-                if (part == "" || part == "TEXT") tar_mail->SetFullText(data.substr(cur_pos, size_part));
+                if (part == "" || part == "TEXT") {
+                    if (tar_mail->SetFullText(data.substr(cur_pos, size_part)) == OK) Complete(tar_mail);
+                    /* 已经写入检查点的邮件再次被取时内容不在内存中，不再通知 */
+                    if (Listener && tar_mail->IsFlushed() == false)
+                        Listener->OnBody(Flow, WorkName, *tar_mail, part == "" ? BODY_FULL : BODY_TEXT);
+                }
                 else if(part == "HEADER") tar_mail->SetFullHeader(data.substr(cur_pos, size_part));
             } else {
                 if (part == "TEXT") tar_mail->SetPartText(pos_start, data.substr(cur_pos, size_part));
@@ -753,27 +1395,74 @@ void Session::fetch(std::string data) {
             cur_pos += size_part+1;
         } else cur_pos++;
 
-        item.clear();   val.clear();
+        val.clear();
         size_part = 0; pos_start = -1;
     }
+    if (Listener) Listener->OnMessage(Flow, WorkName, seq_mail, *tar_mail);
+}
+
+void Session::StartCompress() {
+    /* 收到COMPRESS的成功响应后，两个方向之后的数据均为deflate流 */
+    if (Streams[0] == NULL) Streams[0] = new Inflater;
+    if (Streams[1] == NULL) Streams[1] = new Inflater;
+}
+
+void Session::Checkpoint() {
+    StageTimer timer(STAGE_SAVE);
+    LastCheckpoint = Flow.Time;     BytesSince = 0;
+    GStats.Checkpoints++;
+    /* 只处理上一次检查点之后完整的邮件，不再遍历所有邮箱 */
+    for (size_t i = 0; i < Completed.size(); i++) {
+        Completed[i]->Release(Policy->Dir, true);
+        delete Completed[i];
+    }
+    Completed.clear();
+}
+
+void Session::Complete(Message* Mail) {
+    if (Policy == NULL) return ;
+    Message* held = Mail->Hold();
+    if (held) Completed.push_back(held);
 }
 
 int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
+    if (Policy) {
+        /* 在处理新数据之前，把之前已经完整的邮件写入检查点 */
+        if (LastCheckpoint == 0) LastCheckpoint = Flow.Time;
+        BytesSince += new_data.size();
+        if ((Policy->Interval > 0 && Flow.Time - LastCheckpoint >= Policy->Interval)
+            || (Policy->Bytes > 0 && BytesSince >= Policy->Bytes))
+            Checkpoint();
+    }
+    StageTimer timer(STAGE_RECEIVE);
+    Inflater* stream = Streams[data_src == CLIENT ? 0 : 1];
+    if (stream == NULL) return HandleData(new_data, seq_no, data_src);
+
+    /* 已开启压缩，先解压，再使用解压后的虚拟序列号进行处理 */
+    std::string plain;
+    u_int32_t plain_seq = stream->GetPlainSeq();
+    if (stream->Inflate(new_data, seq_no, plain) != OK) return NO;
+    return HandleData(plain, plain_seq, data_src);
+}
+
+int Session::HandleData(std::string new_data, u_int32_t seq_no, int data_src) {
     if (data_src == CLIENT) {
         /* 对从客户端发来的命令进行处理 */
-        std::string command, tag;
+        u_int64_t tag;
         int beg = 0, end = 0;
         while (end < (int)new_data.size() && check(new_data[end])) end++;
         if(new_data[end] != ' ') {
             /* 这里不为空格，说明这应该是在添加邮件，应该去查找有无Append命令 */
-            for (std::map<std::string, Command>::iterator it = commands.begin(); it != commands.end(); it++) {
-                if ((it->second).Kind == APPEND && responses.find(it->first) != responses.end()) {
+            for (size_t i = 0; i < commands.Capacity(); i++) {
+                if (commands.KeyAt(i) == TAG_NONE) continue;
+                Command& it = commands.ValAt(i);
+                if (it.Kind == APPEND && responses.Find(commands.KeyAt(i)) != NULL) {
                     /* 如果能找到Append命令，并且已经有成功响应，则应该直接添加 */
                     Message* tmp = new Message;
                     tmp->SetFullText(new_data);
-                    AppendMail((it->second).args[0], tmp);
+                    AppendMail(it.args[0], tmp);
                     /* 将已有的响应消息删除 */
-                    responses.erase(responses.find(it->first));
+                    responses.Erase(commands.KeyAt(i));
                     return OK;
                 }
             }
@@ -783,146 +1472,128 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
             datas.emplace(seq_no, tmp_data);
             return OK;
         }
-        tag.assign(new_data.substr(beg, end-beg));
+        tag = Tags.Parse(new_data.data()+beg, end-beg);
         beg = ++end;
-        for (; end < (int)new_data.size() && new_data[end] != ' '; end++) {
-            command.push_back(new_data[end]);
-        }
-        command = LowerCase(command);
+        while (end < (int)new_data.size() && new_data[end] != ' ' && new_data[end] != '\r' && new_data[end] != '\n') end++;
+        /* 直接在原始数据上查找命令类型，不是关心的命令时为0 */
         Command new_com;
+        new_com.Kind = LookupCommand(new_data.data() + beg, end - beg);
         beg = ++end;
         while (end < (int)new_data.size() && new_data[end] != '\n' && new_data[end] != '\r') {
             for (; end < (int)new_data.size() && new_data[end] != ' ' && new_data[end] != '\n' && new_data[end] != '\r'; end++);
             new_com.args.push_back(new_data.substr(beg, end-beg));
             beg = ++end;
         }
-        #ifdef DEBU
-            std::cout << command << std::endl;
-            std::vector<std::string>::iterator it_str = new_com.args.begin();
-            while (it_str != new_com.args.end()) {
-                std::cout << *it_str << std::endl;
-                it_str++;
-            }
-        #endif
+        if (new_com.Kind == UIDCOM) {
+            /* UID COPY等，按第二个单词确定命令，参数去掉该单词 */
+            int sub = new_com.args.empty() ? 0 : LookupCommand(new_com.args[0].data(), new_com.args[0].size());
+            new_com.Kind = (sub == COPY) ? UIDCOPY : 0;
+            if (new_com.args.size()) new_com.args.erase(new_com.args.begin());
+        }
         /* 在最后分析命令的时候，应该查看是否有响应已经提前收到了 */
-        std::map<std::string, Response>::iterator it = responses.find(tag);
-        if(command == "login") {
-            new_com.Kind = LOGIN;
-            if(it != responses.end()) {
-                if ((it->second).result == OK)  LogIn(new_com.args[0], new_com.args[1]);
-                responses.erase(it);
+        GStats.Commands[new_com.Kind]++;
+        Response* it = responses.Find(tag);
+        if (it != NULL) GStats.Responses[new_com.Kind]++;
+        if(new_com.Kind == LOGIN) {
+            if(it != NULL) {
+                if (it->result == OK)  LogIn(new_com.args[0], new_com.args[1]);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "select" || command == "examine") {
+        } else if(new_com.Kind == SELECT) {
             /* 因为二者返回的重要信息一样，所以占用一个 */
-            new_com.Kind = SELECT;
-            if (it != responses.end()) {
-                if ((it->second).result == OK) Select(new_com.args[0], (it->second).data);
-                responses.erase(it);
+            if (it != NULL) {
+                if (it->result == OK) Select(new_com.args[0], it->data);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "create") {
-            new_com.Kind = CREATE;
-            if(it != responses.end()) {
-                new_com.args[0] = LowerCase(new_com.args[0]);
-                if ((it->second).result == OK) RootMail.AppendBox(new_com.args[0]);
-                responses.erase(it);
+        } else if(new_com.Kind == CREATE) {
+            if(it != NULL) {
+                if (it->result == OK) GetBox(new_com.args[0], true);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "delete") {
-            new_com.Kind = DELETE;
-            if(it != responses.end()) {
-                new_com.args[0] = LowerCase(new_com.args[0]);
-                if ((it->second).result == OK) RootMail.DeleteBox(new_com.args[0]);
-                responses.erase(it);
+        } else if(new_com.Kind == DELETE) {
+            if(it != NULL) {
+                if (it->result == OK) DeleteBox(new_com.args[0]);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "rename") {
-            new_com.Kind = RENAME;
-            if(it != responses.end()) {
-                if ((it->second).result == OK) Rename(new_com.args[0], new_com.args[1]);
-                responses.erase(it);
+        } else if(new_com.Kind == RENAME) {
+            if(it != NULL) {
+                if (it->result == OK) Rename(new_com.args[0], new_com.args[1]);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "subscribe") {
-            new_com.Kind = SUBSCR;
-            if(it != responses.end()) {
-                if ((it->second).result == OK) {
-                    new_com.args[0] = LowerCase(new_com.args[0]);
-                    Mailbox* tmp = RootMail.AppendBox(new_com.args[0]);
-                    if (tmp == NULL) tmp = RootMail.FindBoxByName(new_com.args[0]);
-                    tmp->SetSub(true);
+        } else if(new_com.Kind == SUBSCR) {
+            if(it != NULL) {
+                if (it->result == OK) {
+                    Mailbox* tmp = GetBox(new_com.args[0], true);
+                    if (tmp != NULL) tmp->SetSub(true);
                 }
-                responses.erase(it);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "unsubscribe") {
-            new_com.Kind = UNSUBS;
-            if(it != responses.end()) {
-                if ((it->second).result == OK) {
-                    new_com.args[0] = LowerCase(new_com.args[0]);
-                    Mailbox* tmp = RootMail.AppendBox(new_com.args[0]);
-                    if (tmp == NULL) tmp = RootMail.FindBoxByName(new_com.args[0]);
-                    tmp->SetSub(false);
+        } else if(new_com.Kind == UNSUBS) {
+            if(it != NULL) {
+                if (it->result == OK) {
+                    Mailbox* tmp = GetBox(new_com.args[0], true);
+                    if (tmp != NULL) tmp->SetSub(false);
                 }
-                responses.erase(it);
+                responses.Erase(tag);
                 return OK;
             }
-        } else if(command == "append") {
-            new_com.Kind = APPEND;
-            if (it != responses.end()) {
+        } else if(new_com.Kind == APPEND) {
+            if (it != NULL) {
                 /* append添加命令成功，查看是否有序列号为-1的数据 */
                 std::map<u_int32_t, PartData>::iterator it_data;
                 for (it_data = datas.begin(); it_data != datas.end(); it_data++) {
                     if((it_data->second).size == -1) break ;
                 }
-                if ((it->second).result == OK && it_data != datas.end()) {
+                if (it->result == OK && it_data != datas.end()) {
                     /* 如果有数据，将数据写入，并将响应删除 */
                     Message* tmp_mail = new Message;
                     tmp_mail->SetFullText((it_data->second).data);
                     AppendMail(new_com.args[0], tmp_mail);
-                    responses.erase(it);    datas.erase(it_data);
+                    responses.Erase(tag);    datas.erase(it_data);
                     return OK;
                 }
-                if ((it->second).result == NO) {
-                    datas.erase(it_data);
+                if (it->result == NO) {
+                    if (it_data != datas.end()) datas.erase(it_data);
+                    responses.Erase(tag);
                     return NO;
                 }
                 /* 如果没有响应，应直接跳过，将命令加入到命令集合中 */
             }
-        } else if(command == "copy") {
-            new_com.Kind = COPY;
-            if(it != responses.end()) {
-                if ((it->second).result == OK) {
-                    /* 确保邮箱存在 */
-                    RootMail.AppendBox(new_com.args[1]);
-                    /* 计算区间 */
-                    int beg = 0, end = 0, cur_pos = 0;
-                    while (new_com.args[0][cur_pos] != ':') {
-                        beg = (beg<<1) + (beg<<3) + new_com.args[0][cur_pos]-'0';
-                        cur_pos++;
-                    }
-                    cur_pos++;
-                    while (cur_pos < (int)new_com.args[0].size()) {
-                        end = (end<<1) + (end<<3) + new_com.args[0][cur_pos]-'0';
-                        cur_pos++;
-                    }
-                    if(end == 0) end = beg;
-                    CopyMails(beg, end+1, new_com.args[1]);
-                }
-                responses.erase(it);
+        } else if(new_com.Kind == COPY) {
+            if(it != NULL) {
+                if (it->result == OK) CopySet(new_com.args[0], new_com.args[1], false);
+                responses.Erase(tag);
+                return OK;
+            }
+        } else if(new_com.Kind == UIDCOPY) {
+            if(it != NULL) {
+                if (it->result == OK) CopySet(new_com.args[0], new_com.args[1], true);
+                responses.Erase(tag);
+                return OK;
+            }
+        } else if(new_com.Kind == COMPRE) {
+            if(it != NULL) {
+                if (it->result == OK) StartCompress();
+                responses.Erase(tag);
                 return OK;
             }
         }
-        commands.emplace(tag, new_com);
+        commands.Insert(tag, new_com);
         return OK;
     } else {
         /* 服务器发来的响应数据 */
         /* 如果第一个时+，则直接丢弃 */
         if (new_data == "+ Ready for literal data" || new_data[0] == '+') return NO;
         /* 查看是否是一个完整的响应 */
-        std::pair<std::string, Response> temp_pair = GetResFromData(new_data);
-        if (temp_pair.first.size() == 0) {
+        std::pair<u_int64_t, Response> temp_pair = GetResFromData(new_data);
+        if (temp_pair.first != TAG_NONE && temp_pair.second.result == NO) GStats.ResponsesNo++;
+        if (temp_pair.first == TAG_NONE) {
             /* 如果并不是一个完整的响应，应该查看数据首字符是否为*，
             * 若是，则说明是fetch的第一个数据包 */
             if (new_data[0] == '*') {
@@ -935,9 +1606,9 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
                 data_head.data = new_data;
 
                 /* 读取数据部分应有的总长度 */
-                while (cur_pos < (int)new_data.size() && new_data[cur_pos] != '{') cur_pos++;
-                cur_pos++;
-                while (cur_pos < (int)new_data.size() && new_data[cur_pos] <= '9' && new_data[cur_pos] <= '0')
+                const void* brace = memchr(new_data.data(), '{', new_data.size());
+                cur_pos = brace ? (const char*)brace - new_data.data() + 1 : new_data.size();
+                while (cur_pos < (int)new_data.size() && new_data[cur_pos] <= '9' && new_data[cur_pos] >= '0')
                     data_size = (data_size<<1) + (data_size<<3) + new_data[cur_pos++]-'0';
                 data_head.IsEnd = false;    data_head.size = data_size;
                 data_head.StartSeq = seq_no;
@@ -947,7 +1618,7 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
                         /* 找到数据的后半部分 */
                         if((it_head->second).IsEnd) {
                             /* 两个数据拼接即可得到完整数据 */
-                            fetch(new_data+(it_head->second).data);
+                            FetchAll(new_data+(it_head->second).data);
                             datas.erase(it_head);
                             return OK;
                         } else {
@@ -983,7 +1654,7 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
                         /* 找到数据的后半部分 */
                         if((it_body->second).IsEnd) {
                             /* 两个数据拼接即可得到完整数据 */
-                            fetch(new_data+(it_body->second).data);
+                            FetchAll(new_data+(it_body->second).data);
                             datas.erase(it_body);
                             return OK;
                         } else {
@@ -998,7 +1669,8 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
             return OK;
         } else {
             /* 读取到响应 */
-            if (temp_pair.first == "LIST" || temp_pair.first == "LSUB") {
+            if (temp_pair.second.Kind == ATOM_LIST || temp_pair.second.Kind == ATOM_LSUB) {
+                GStats.Lists++;
                 /* 两者返回有效信息相同，一起处理 */
                 if (temp_pair.second.result == OK) {
                     list(new_data);
@@ -1006,20 +1678,30 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
                 }
                 return NO;
             }
-            if (temp_pair.first == "STATUS") {
+            if (temp_pair.second.Kind == ATOM_STATUS) {
+                GStats.Statuses++;
                 if (temp_pair.second.result == OK) {
                     status(new_data);
                     return OK;
                 }
                 return NO;
             }
-            if (temp_pair.first == "FETCH") {
+            if (temp_pair.second.Kind == ATOM_EXPUNGE) {
+                GStats.Expunges++;
+                if (temp_pair.second.result == OK) {
+                    expunge(new_data);
+                    return OK;
+                }
+                return NO;
+            }
+            if (temp_pair.second.Kind == ATOM_FETCH) {
+                GStats.Fetches++;
                 if(temp_pair.second.result == OK) {
                     /* 先查看是否为空 */
                     if (new_data.size() == 0) return OK;
                     if (new_data[0] == '*') {
                         /* 本数据是一个完整的fetch数据，直接交由fetch处理 */
-                        fetch(new_data);    return OK;
+                        FetchAll(new_data);    return OK;
                     }
                     /* 数据不完整，应去datas查找是否有数据的前半部分 */
                     std::map<u_int32_t, PartData>::iterator it_data;
@@ -1035,7 +1717,7 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
                             datas.emplace(GetNextSeq(TarData.StartSeq, TarData.data.size()), TarData);
                         } else {
                             /* 两份数据可以完美拼接 */
-                            fetch((it_data->second).data + new_data);
+                            FetchAll((it_data->second).data + new_data);
                         }
                         datas.erase(it_data);
                         return OK;
@@ -1052,26 +1734,26 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
             // std::cout << "Tag of this Response is " << temp_pair.first << std::endl;
             /* 其他命令 */
             /* 先检查对应命令是否存在，如果不存在，那么先保存响应 */
-            std::map<std::string, Command>::iterator it_com = commands.find(temp_pair.first);
-            if(it_com == commands.end()) {
+            Command* it_com = commands.Find(temp_pair.first);
+            if(it_com == NULL) {
                 /* 没有这条命令.则应该先将响应保存 */
-                responses.insert(temp_pair);
+                responses.Insert(temp_pair.first, temp_pair.second);
                 return OK;
             }
             /* 有命令 */
+            GStats.Responses[it_com->Kind]++;
             if (temp_pair.second.result == NO) {
                 /* 此次命令执行失败，则应该直接将命令从集合中删除 */
-                if ((it_com->second).Kind == APPEND) {
+                if (it_com->Kind == APPEND) {
                     /* Append命令执行失败，应该将数据从集合中移除 */
-                    std::map<u_int32_t, PartData>::iterator it_data = datas.begin();
-                    while (it_data != datas.end()) {
+                    for (std::map<u_int32_t, PartData>::iterator it_data = datas.begin(); it_data != datas.end(); it_data++) {
                         if ((it_data->second).size == -1) {
                             datas.erase(it_data);
-                            return NO;
+                            break;
                         }
                     }
                 }
-                commands.erase(it_com);
+                commands.Erase(temp_pair.first);
                 return NO;
             }
             // printf("Get Response and NOT fetch/list/lsub/status!\n");
@@ -1080,36 +1762,30 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
             Mailbox* tmp = NULL;
             Message* tmp_mail = NULL;
             std::map<u_int32_t, PartData>::iterator it_data;
-            switch ((it_com->second).Kind)
+            switch (it_com->Kind)
             {
             case LOGIN:
-                LogIn((it_com->second).args[0], (it_com->second).args[1]);
+                LogIn(it_com->args[0], it_com->args[1]);
                 break;
             case SELECT:
-                Select((it_com->second).args[0], new_data);
+                Select(it_com->args[0], new_data);
                 break;
             case CREATE:
-                (it_com->second).args[0] = LowerCase((it_com->second).args[0]);
-                RootMail.AppendBox((it_com->second).args[0]);
+                GetBox(it_com->args[0], true);
                 break;
             case DELETE:
-                (it_com->second).args[0] = LowerCase((it_com->second).args[0]);
-                RootMail.DeleteBox((it_com->second).args[0]);
+                DeleteBox(it_com->args[0]);
                 break;
             case RENAME:
-                Rename((it_com->second).args[0], (it_com->second).args[0]);
+                Rename(it_com->args[0], it_com->args[1]);
                 break;
             case SUBSCR:
-                (it_com->second).args[0] = LowerCase((it_com->second).args[0]);
-                tmp = RootMail.AppendBox((it_com->second).args[0]);
-                if (tmp == NULL) tmp = RootMail.FindBoxByName((it_com->second).args[0]);
-                tmp->SetSub(true);
+                tmp = GetBox(it_com->args[0], true);
+                if (tmp != NULL) tmp->SetSub(true);
                 break;
             case UNSUBS:
-                (it_com->second).args[0] = LowerCase((it_com->second).args[0]);
-                RootMail.AppendBox((it_com->second).args[0]);
-                if (tmp == NULL) tmp = RootMail.FindBoxByName((it_com->second).args[0]);
-                tmp->SetSub(false);
+                tmp = GetBox(it_com->args[0], true);
+                if (tmp != NULL) tmp->SetSub(false);
                 break;
             case APPEND:
                 /* append添加命令成功，查看是否有序列号为-1的数据 */
@@ -1120,70 +1796,69 @@ int Session::ReceiveData(std::string new_data, u_int32_t seq_no, int data_src) {
                 if (it_data != datas.end()) {
                     tmp_mail = new Message;
                     tmp_mail->SetFullText((it_data->second).data);
-                    AppendMail((it_com->second).args[0], tmp_mail);
+                    AppendMail(it_com->args[0], tmp_mail);
                     datas.erase(it_data);
                 } else return OK;
                 break;
+            case COMPRE:
+                StartCompress();
+                break;
             case COPY:
-                /* 确保邮箱存在 */
-                RootMail.AppendBox((it_com->second).args[1]);
-                /* 计算区间 */
-                int beg = 0, end = 0, cur_pos = 0;
-                while ((it_com->second).args[0][cur_pos] != ':') {
-                    beg = (beg<<1) + (beg<<3) + (it_com->second).args[0][cur_pos]-'0';
-                    cur_pos++;
-                }
-                cur_pos++;
-                while (cur_pos < (int)(it_com->second).args[0].size()) {
-                    end = (end<<1) + (end<<3) + (it_com->second).args[0][cur_pos]-'0';
-                    cur_pos++;
-                }
-                if(end == 0) end = beg;
-                CopyMails(beg, end+1, (it_com->second).args[1]);
+                CopySet(it_com->args[0], it_com->args[1], false);
+                break;
+            case UIDCOPY:
+                CopySet(it_com->args[0], it_com->args[1], true);
                 break;
             }
-            commands.erase(it_com);
+            commands.Erase(temp_pair.first);
             return OK;
         }
     }
 }
 
-std::pair<std::string, Response> Session::GetResFromData(std::string& data) {
+std::pair<u_int64_t, Response> Session::GetResFromData(std::string& data) {
     int cur_pos = data.size()-1;
     Response new_res;
+    new_res.result = NO;    new_res.Kind = 0;
 
     /* 如果最后两个为\r\n说明是有响应，否则就是数据，直接返回 */
-    if (data[cur_pos] == '\n') cur_pos -= 2;
-    else return std::make_pair("", new_res);
-
-    /* 分析响应 */
-    std::string res;
-    while (cur_pos >= 0 && data[cur_pos] != '\n' && data[cur_pos] != '\r') cur_pos--;
-    cur_pos++;
-    if (cur_pos < 0) cur_pos = 0;
-    res.assign(data.substr(cur_pos));
-
-    /* tag, command, result */
-    std::string tag, command, result;
-    int beg = 0, end = 0;
-    while (end < (int)res.size() && res[end] != ' ') end++;
-    tag.assign(res.substr(beg, end-beg));   beg = ++end;
-    while (end < (int)res.size() && res[end] != ' ') end++;
-    result.assign(res.substr(beg, end-beg));   beg = ++end;
-    while (end < (int)res.size() && res[end] != ' ') end++;
-    command.assign(res.substr(beg, end-beg));
-
-    if (tag[0] == '*')   return std::make_pair("", new_res);
+    if (cur_pos >= 0 && data[cur_pos] == '\n') cur_pos -= 2;
+    else return std::make_pair((u_int64_t)TAG_NONE, new_res);
+
+    /* 分析响应，从后向前找到最后一行的开头（memrchr按块比较） */
+    const void* line = cur_pos >= 0 ? memrchr(data.data(), '\n', cur_pos+1) : NULL;
+    cur_pos = line ? (const char*)line - data.data() + 1 : 0;
+
+    /* tag, result, command；直接在原始数据上切分并查找关键字，不再构造子串 */
+    const char* res = data.data();
+    int size = data.size(), beg = cur_pos, end = cur_pos, tag_end;
+    while (end < size && res[end] != ' ') end++;
+    tag_end = end;
+    if (res[cur_pos] == '*')   return std::make_pair((u_int64_t)TAG_NONE, new_res);
+
+    beg = end = std::min(end+1, size);
+    while (end < size && res[end] != ' ' && res[end] != '\r') end++;
+    int result = LookupAtom(res+beg, end-beg);
+    beg = end = std::min(end+1, size);
+    while (end < size && res[end] != ' ' && res[end] != '\r') end++;
+    int command = LookupAtom(res+beg, end-beg);
+    if (command == ATOM_UID) {
+        /* UID FETCH等，以第二个单词为准 */
+        beg = end = std::min(end+1, size);
+        while (end < size && res[end] != ' ' && res[end] != '\r') end++;
+        command = LookupAtom(res+beg, end-beg);
+    }
 
     /* 构造响应 */
-    if(result == "OK")  new_res.result = OK;
-    else if(result == "NO" || result == "BAD")  new_res.result = NO;
-    else return std::make_pair("", new_res);
+    if(result == ATOM_OK)  new_res.result = OK;
+    else if(result == ATOM_NO || result == ATOM_BAD)  new_res.result = NO;
+    else return std::make_pair((u_int64_t)TAG_NONE, new_res);
+    if (command == ATOM_FETCH || command == ATOM_LIST || command == ATOM_LSUB || command == ATOM_STATUS || command == ATOM_EXPUNGE)
+        new_res.Kind = command;
 
+    u_int64_t tag = Tags.Parse(res+cur_pos, tag_end-cur_pos);
     if (cur_pos) data.assign(data.substr(0, cur_pos));
     else data.assign("");
     new_res.data.assign(data);
-    if (command == "FETCH" || command == "LIST" || command == "LSUB" || command == "STATUS")
-        return std::make_pair(command, new_res);
     return std::make_pair(tag, new_res);
-}
\ No newline at end of file
+}
@@ -7,11 +7,17 @@
 #include <map>
 #include <string>
 #include <vector>
+#include <unordered_set>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sys/stat.h>
+#include "Inflater.h"
+#include "TagTable.h"
+#include "BoxCache.h"
+#include "MailIndex.h"
+#include "Stats.h"
 
 #define DEBUG
 
@@ -41,6 +47,10 @@
 #define UNSUBS  7
 #define APPEND  8
 #define COPY    9
+#define COMPRE  10
+/* UID前缀命令；客户端解析时再按第二个单词细分，目前只关心UID COPY */
+#define UIDCOM  11
+#define UIDCOPY 12
 
 /*------------------------------------------------------------------------------
 * class Message
@@ -60,14 +70,15 @@
 *   5） 设置部分邮件正文，如有部分与之前重叠，选择覆盖策略，保证信息最新；
 *   6） 设置完整首部，读取到完整首部的响应，将首部全部删除并使用新首部进行替代，更改标志位；
 *   7） 设置完整文本，读取到完整文本的响应，将文本全部删除并使用新文本进行替代，更改标志位
+* FETCH 1:* (FLAGS)之类的命令会产生大量只有标志和大小的邮件，所以邮件本身只保存定长的元数据
+* （内部时间解析为整数），内容放在按需分配的MailBody中，只有元数据的邮件为MESSAGE_BYTES字节
 * ----------------------------------------------------------------------------*/
 
-class Message {
-    /* 在邮件类中添加三个额外标志位分别代表msg-id，首部完整，文本完整，Flags占位如下：
-    * Msg-Id，HeadCom, TextCom, \Answered \Flagged \Deleted \Draft \Seen */
-    u_int8_t Flags;
-    int Size;
-    std::string InternalDate, MessageId;
+/* 邮件的内容部分（Msg-Id、首部、正文），COPY到其他邮箱的邮件共享同一份内容，
+* 使用引用计数；修改共享的内容前先复制一份（写时复制） */
+struct MailBody {
+    int Refs;
+    std::string MessageId;
     /* 由于boundary和Content-Type的组合时固定的而其他首部并不要求顺序，
     * 所以额外存储这两项 */
     /* 对于部分头部提取，暂时只取得重要部分或完整信息，其他后续可改 */
@@ -76,20 +87,63 @@ class Message {
     * 以索取部分文本的第一字节位置作为key，以文本内容作为值，若出现完整文本信息，
     * 则应先将映射关系清空，只保留完整信息，并且更新标志位 */
     std::map<int, std::string> Text;
+    /* 共享的内容第一次保存的文件名，之后的副本直接建立硬链接 */
+    std::string SavedAs;
+    /* 无法解析的内部时间按原样保存 */
+    std::string RawDate;
+    /* 内容已经写入检查点文件SavedAs并释放（见Message::Flush），之后不再改变 */
+    bool Flushed;
+    /* 会话的检查点列表持有一个引用（见Message::Hold），这个引用不算共享 */
+    bool Pending;
+    MailBody() : Refs(1), Flushed(false), Pending(false) {}
+};
+
+/* 只有元数据的邮件大小的上限，由static_assert保证 */
+#define MESSAGE_BYTES   32
+
+class Message {
+    /* 在邮件类中添加三个额外标志位分别代表msg-id，首部完整，文本完整，Flags占位如下：
+    * Msg-Id，HeadCom, TextCom, \Answered \Flagged \Deleted \Draft \Seen */
+    /* 只有在取得内容时才分配 */
+    MailBody* Body;
+    /* 内部时间（UTC的秒数）及其时区（分钟），Date为0表示未知 */
+    int64_t Date;
+    /* 邮件在所属邮箱中的UID，0表示未知 */
+    u_int32_t Uid;
+    int32_t Size;
+    int16_t Zone;
+    u_int8_t Flags;
+
+    /* 取得可以修改的内容，没有则分配，共享则先复制 */
+    MailBody* Writable();
+    /* 完整的邮件按MIME结构解码保存在FileName旁边 */
+    int SaveParts(const std::string& FileName);
+    /* 把首部和正文写入FileName */
+    int Write(const std::string& FileName);
+    Message& operator=(const Message&);
 public:
     Message();
-    ~Message() {};
+    /* 复制得到的邮件与原邮件共享内容，代价与邮件大小无关 */
+    Message(const Message& other);
+    ~Message();
     int SetFlags(u_int8_t flag);
     u_int8_t GetFlags() {return Flags;}
+    u_int32_t GetUid() {return Uid;}
+    void SetUid(u_int32_t uid) {Uid = uid;}
     int size()  {return Size;}
     int SetSize(int sz) {Size = (sz>0?sz:Size); return sz>0?OK:NO;}
-    void SetInternalDate(std::string tm) {InternalDate.assign(tm);}
-    std::string date() {return InternalDate;}
+    /* 格式为IMAP的date-time："17-Jul-1996 02:44:25 -0700" */
+    void SetInternalDate(const std::string& tm);
+    std::string date();
+    int64_t GetDate() {return Date;}
+    bool HasBody() {return Body != NULL;}
+    bool IsFlushed() {return Body && Body->Flushed;}
+    const MailBody* GetBody() {return Body;}
     /* Message只允许设置一次，因为Msg-id唯一确定一封邮件，不可更改 */
-    std::string GetMsgId() {return MessageId;};
+    std::string GetMsgId() {return Body ? Body->MessageId : std::string();};
     int SetMsgId(std::string msg_id);
     /* 查看首部和文本信息 */
-    std::string GetHeader() {return Header + cont + bound;}
+    std::string GetHeader() {return Body ? Body->Header + Body->cont + Body->bound : std::string();}
     std::string GetText();
     /* 添加部分首部和文本信息 */
     int SetPartHeader(std::string field, std::string value);
@@ -97,8 +151,39 @@ public:
     /* 添加完整首部和文本信息 */
     int SetFullHeader(std::string header);
     int SetFullText(std::string text);
+    /* 合并同一封邮件在另一个会话中得到的信息：Newer为true时Src的标志、大小、时间覆盖本邮件，
+    * 否则只填补未知的部分；内容取更完整的一方（与Src交换） */
+    void Merge(Message& Src, bool Newer);
+
+    /* 正文完整的邮件把内容写入检查点目录Dir中的新文件并释放，只保留元数据和Msg-Id；
+    * Dir为空时只释放不写入；返回释放的字节数，不完整、已经释放或写入失败时为0 */
+    size_t Flush(const std::string& Dir);
+    /* 正文完整、还没有写入检查点的邮件返回共享内容的副本，放入会话的检查点列表，否则返回NULL；
+    * 每份内容只有一个副本在列表中 */
+    Message* Hold();
+    /* 对列表中取出的副本调用，之后删除副本：Save为true并且还有其他邮件使用内容时写入检查点并释放，
+    * 返回释放的字节数（见Flush） */
+    size_t Release(const std::string& Dir, bool Save);
 
-    int save(std::string FileName);
+    /* Decode为true时另外把MIME部分解码保存在旁边（见Mime.h中的SaveMimeParts）；
+    * 已经写入检查点的邮件直接链接到检查点文件 */
+    int save(std::string FileName, bool Decode = false);
+};
+
+/*--------------------------------------------------------------------------
+* struct MemReport
+* 内存使用的统计，按邮箱树递归累加；共享的内容只计算一次；
+* 字符串和std::map按实际容量加上固定的节点开销估算
+* ------------------------------------------------------------------------*/
+struct MemReport {
+    size_t Sessions, Mailboxes, Messages, MetaOnly, Bodies, SharedBodies;
+    size_t MessageBytes, BodyBytes, IndexBytes, UidBytes, ReassemblyBytes;
+    std::unordered_set<const MailBody*> Seen;
+    MemReport() : Sessions(0), Mailboxes(0), Messages(0), MetaOnly(0), Bodies(0), SharedBodies(0),
+                  MessageBytes(0), BodyBytes(0), IndexBytes(0), UidBytes(0), ReassemblyBytes(0) {}
+    void AddMessage(Message* mail);
+    size_t Total() const {return MessageBytes + BodyBytes + IndexBytes + UidBytes + ReassemblyBytes;}
+    void Print(FILE* out) const;
 };
 
 /*--------------------------------------------------------------------------
@@ -107,9 +192,11 @@ public:
 * 成员首先包括是否可选，邮箱的标签（\NoSelect \HasNoChildren）,是否被订阅或活跃；
 * 邮件数，最近邮件数，下一唯一标识符，唯一标识有效值，未查看数（int值，若为负数则没有相关信息）；
 * 下属邮箱：使用Map进行存储，存储邮箱名到邮箱类的映射；
-* 所属邮件：map存储，使用序列号进行查找，为查找方便，应加设map作为从邮件名到序列号的映射；
-* 选取map存储邮件原因：map查找速度为logn，速度上可以接受；用户查看邮件具有局部性，且依靠一组
-* 数据包只可能抓到一部分邮件，但如果邮件数量过多，但查看获得的有效信息少，vector则会浪费很大空间；
+* 所属邮件：已知UID的邮件以UID为主键存储，UID在UidValidity不变时不会改变，邮件的位置是稳定的；
+* 另外用MailIndex（见MailIndex.h）保存序列号到邮件的对应关系，未知UID的邮件只在其中；
+* 不用vector的原因：用户查看邮件具有局部性，且依靠一组数据包只可能抓到一部分邮件，
+* 但如果邮件数量过多，但查看获得的有效信息少，vector则会浪费很大空间；
+* 不用map的原因：删除邮件后后面的序列号都要前移，map只能逐个删除再插入；
 * 实现功能：
 *   1） 改变订阅（或活跃）状态；
 *   2） 改变邮箱的标签；改变邮箱的可选状态；（如果邮箱不可选，则应自动添加该标签，没有子节点同）
@@ -130,7 +217,11 @@ class Mailbox {
     u_int32_t UidNext, UidValidity;
     /* 由于存在删除邮箱（含下属邮箱）后建立同名邮箱的情况，所以使用multimap */
     std::multimap<std::string, Mailbox*> SubMailbox;
-    std::map<int, Message*> Mails;
+    MailIndex Mails;
+    std::map<u_int32_t, Message*> UidMails;
+
+    /* 放弃所有UID（UidValidity改变时），只在UID存储中的邮件一并删除 */
+    void ForgetUids();
 public:
     Mailbox();
     ~Mailbox();
@@ -140,23 +231,29 @@ public:
     u_int32_t GetUidNext() {return UidNext;}
     u_int32_t GetUidValidity() {return UidValidity;}
     int GetTotalMails() {return TotalMails;}
+    /* 已知邮件中最大的序列号，没有时为0 */
+    int LastSeq() {int seq = 0; Mails.Nth(Mails.size() - 1, &seq); return seq;}
     int GetRecentMails() {return RecentMails;}
     int GetUnseenMails() {return UnseenMails;}
     void SetSel(bool val) {BeSelected = val;};
     void SetSub(bool val) {BeSubed = val;}
     void SetUidNext(u_int32_t UNext) {UidNext = UNext;}
-    void SetUidValidity(u_int32_t UValid) {UidValidity = UValid;}
+    void SetUidValidity(u_int32_t UValid);
     /* 此处将邮件数和邮件分开添加，因为一开始选择邮箱就已经知道相应数量，但不知道邮件内容；
     * 在之后才能获得详细的邮件信息，所以两者分开；但是一定要注意保证两者的对应关系正确 */
     /* 邮件数量的更改，包括最近、总、未查看的数量 */
     int SetTotalMails(int number)   {TotalMails = (number>=0?number:-1);    return (number>=0?OK:NO);}
     int SetRecentMails(int number)  {RecentMails = (number>=0?number:-1);   return (number>=0?OK:NO);}
     int SetUnseenMails(int number)  {UnseenMails = (number>=0?number:-1);   return (number>=0?OK:NO);}
-    /* 这里默认分割符都是/；在删除邮箱时注意还应将邮箱中的所有邮件一并删除 */
-    Mailbox* AppendBox(std::string TarName, char Delimiter = '/');
-    int DeleteBox(std::string TarName, char Delimiter = '/');
+    /* 这里默认分割符都是/；在删除邮箱时注意还应将邮箱中的所有邮件一并删除；
+    * 带Pos的版本从名字的Pos处开始解析，逐层递归时只移动偏移，不再复制剩余路径 */
+    Mailbox* AppendBox(const std::string& TarName, size_t Pos, char Delimiter);
+    Mailbox* AppendBox(const std::string& TarName, char Delimiter = '/') {return AppendBox(TarName, 0, Delimiter);}
+    int DeleteBox(const std::string& TarName, size_t Pos, char Delimiter);
+    int DeleteBox(const std::string& TarName, char Delimiter = '/') {return DeleteBox(TarName, 0, Delimiter);}
     /* 查找本邮箱下的某名称所属邮箱 */
-    Mailbox* FindBoxByName(std::string TarName, char Delimiter = '/');
+    Mailbox* FindBoxByName(const std::string& TarName, size_t Pos, char Delimiter);
+    Mailbox* FindBoxByName(const std::string& TarName, char Delimiter = '/') {return FindBoxByName(TarName, 0, Delimiter);}
     /* 添加和删除邮件的函数
     * 添加邮件参数：邮件序列号，新建邮件的指针 */
     int AppendMail(int SeqId, Message* NewMail);
@@ -165,19 +262,33 @@ public:
     /* 需要有邮件类的支持，暂时只提供函数接口 */
     int DeleteMail(int SeqId);
     int DeleteMail(int Begin, int End);
-    std::map<int, Message*>& GetAllMails() {return Mails;}
+    /* 取得序列号为SeqId的邮件，不存在则新建；Uid不为0时以UID为准，
+    * 序列号对应关系与UID不一致时（如没有抓到之前的EXPUNGE）进行修正 */
+    Message* GetMail(int SeqId, u_int32_t Uid);
+    Message* FindByUid(u_int32_t Uid);
+    /* 取出UID在闭区间[Begin, End]内的邮件，按UID从小到大 */
+    void UidRange(u_int32_t Begin, u_int32_t End, std::vector<Message*>& out);
+    MailIndex& GetAllMails() {return Mails;}
     int GetBoxNumebr() {return SubMailbox.size();}
-    Mailbox* PopBox(std::string TarName, char Delimiter = '/');
+    Mailbox* PopBox(const std::string& TarName, size_t Pos, char Delimiter);
+    Mailbox* PopBox(const std::string& TarName, char Delimiter = '/') {return PopBox(TarName, 0, Delimiter);}
     /* 此处的Push只是为了功能所写，实际功能为同名邮箱替换，使用指定的将原来的替换 */
-    int PushBox(std::string TarName, Mailbox* TarBox, char Delimiter = '/');
+    int PushBox(const std::string& TarName, size_t Pos, Mailbox* TarBox, char Delimiter);
+    int PushBox(const std::string& TarName, Mailbox* TarBox, char Delimiter = '/') {return PushBox(TarName, 0, TarBox, Delimiter);}
 
-    int save(std::string path_name);
+    int save(std::string path_name, bool Decode = false);
+    /* 把同一用户另一个会话的邮箱树Src并入本邮箱，之后Src为空：同名的下属邮箱递归合并，其余直接移入；
+    * 有UID的邮件按UID合并，没有UID的按序列号；Newer表示Src的信息较新，此时以Src的数值和
+    * 序列号对应关系为准，否则只填补未知的部分 */
+    void Merge(Mailbox& Src, bool Newer);
+    /* 统计本邮箱及下属邮箱的内存使用 */
+    void Measure(MemReport& report);
 };
 
 /*-------------------------------------------------------------------
 * class session
 * 最重要的部分分为三部分，命令序列，响应序列，以及不完全数据序列；
-* 命令序列和响应序列均应使用map映射，以字符串tag作为索引；
+* 命令序列和响应序列均以tag作为索引，tag编码为整数后存放在TagTable中（见TagTable.h）；
 * 命令部分应包含的数据：命令种类，用于识别是哪一种命令，int类型；
 * 命令参数，vector<string>存储，用于保存命令的参数；
 * 响应部分应包含的数据：响应结果，成功或失败；
@@ -192,6 +303,8 @@ struct Command {
 
 struct Response {
     int result;
+    /* 带tag的结果行中命令名的原子（FETCH、LIST、LSUB、STATUS、EXPUNGE），其他为0 */
+    int Kind;
     std::string data;
 };
 
@@ -204,35 +317,185 @@ struct PartData {
     std::string data;
 };
 
+/* 邮箱事件的种类 */
+#define BOX_CREATED     1
+#define BOX_SELECTED    2
+/* OnBody得到的内容：完整邮件（BODY[]或APPEND），或者只有正文（BODY[TEXT]，不含首部） */
+#define BODY_FULL       1
+#define BODY_TEXT       2
+
+/*-------------------------------------------------------------------
+* struct FlowInfo / class SessionListener
+* 嵌入使用时的事件回调（见PeelHeader.h中的ImapEngine）：会话在得知新信息时立即通知，
+* 默认实现均为空，使用者只需覆盖关心的事件；
+* 传入的邮箱和邮件只在回调期间有效，回调中不应修改会话
+* ----------------------------------------------------------------*/
+struct FlowInfo {
+    u_int64_t Id;                       /* 会话编号，进程内唯一（各引擎共用），按建立的顺序递增 */
+    u_int32_t ClientIP, ServerIP;       /* 主机字节序 */
+    u_int16_t ClientPort, ServerPort;
+    int64_t Time;                       /* 最近一个数据包的时间（微秒） */
+};
+
+class SessionListener {
+public:
+    virtual ~SessionListener() {}
+    /* LOGIN成功 */
+    virtual void OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password) {}
+    /* 新建邮箱，或SELECT成功（此时EXISTS等数值已更新） */
+    virtual void OnMailbox(const FlowInfo& Flow, const std::string& Name, int Event, Mailbox& Box) {}
+    /* 一条FETCH数据处理完毕，邮件的标志、大小、UID、时间已更新 */
+    virtual void OnMessage(const FlowInfo& Flow, const std::string& Box, int SeqId, Message& Mail) {}
+    /* 得到了完整的邮件内容，Part为BODY_FULL或BODY_TEXT */
+    virtual void OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part) {}
+    /* 会话结束，之后会话被释放 */
+    virtual void OnClose(const FlowInfo& Flow, const std::string& User) {}
+};
+
+/* 把事件按加入的顺序转发给多个回调（引擎只有一个回调） */
+class ListenerGroup : public SessionListener {
+    std::vector<SessionListener*> Members;
+public:
+    void Add(SessionListener* listener) {if (listener) Members.push_back(listener);}
+    bool empty() const {return Members.empty();}
+    void OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password) {
+        for (size_t i = 0; i < Members.size(); i++) Members[i]->OnLogin(Flow, User, Password);
+    }
+    void OnMailbox(const FlowInfo& Flow, const std::string& Name, int Event, Mailbox& Box) {
+        for (size_t i = 0; i < Members.size(); i++) Members[i]->OnMailbox(Flow, Name, Event, Box);
+    }
+    void OnMessage(const FlowInfo& Flow, const std::string& Box, int SeqId, Message& Mail) {
+        for (size_t i = 0; i < Members.size(); i++) Members[i]->OnMessage(Flow, Box, SeqId, Mail);
+    }
+    void OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part) {
+        for (size_t i = 0; i < Members.size(); i++) Members[i]->OnBody(Flow, Box, Mail, Part);
+    }
+    void OnClose(const FlowInfo& Flow, const std::string& User) {
+        for (size_t i = 0; i < Members.size(); i++) Members[i]->OnClose(Flow, User);
+    }
+};
+
+/*------------------------------------------------------------------------------
+* class SeqTracker
+* 会话一个方向上已经交给会话处理的序列号范围，用于在构造数据之前丢弃重复的数据段
+* （镜像端口上的重复包、TCP重传）：
+*   1） [Begin, End)为从第一个数据段开始连续交付的部分；
+*   2） End之后乱序到达的部分最多记录SEQ_RANGES段，补齐后并入连续部分，记满时不再记录；
+*   3） 完全落在已记录范围内的数据段是重复的；开头与已记录范围重叠的只交付之后的新部分，
+*       其余重叠（开头是新数据）或无法判断的整段交付，所以记录不全只会少去重，不会丢掉新数据
+* ----------------------------------------------------------------------------*/
+#define SEQ_RANGES  4
+
+class SeqTracker {
+    u_int32_t Begin, End;
+    u_int32_t Start[SEQ_RANGES], Stop[SEQ_RANGES];
+    int Count;
+    bool Valid;
+public:
+    SeqTracker() : Begin(0), End(0), Count(0), Valid(false) {}
+    /* 记录[Seq, Seq+Len)，返回其末尾还没有交付过的字节数，0表示已经全部交付过 */
+    u_int32_t Seen(u_int32_t Seq, u_int32_t Len);
+};
+
+/* 检查点的设置：会话收到的数据达到Bytes，或距上一次检查点的数据包时间达到Interval（微秒）时，
+* 把已经完整的邮件写入Dir并释放内容；两者为0时不生效 */
+struct CheckpointPolicy {
+    int64_t Interval;
+    size_t Bytes;
+    std::string Dir;
+    CheckpointPolicy() : Interval(0), Bytes(0) {}
+};
+
+class UserStore;
+
+/* 把一个用户的邮箱树保存为./UserName/目录，并写入password.txt，Decode同Message::save */
+int SaveUserTree(const std::string& UserName, const std::string& Password, Mailbox& Root, bool Decode = false);
+
 class Session {
     std::string UserName, Password;
     /* 建立指向邮箱目录根的指针 */
     /* WorkPlace指出当前的工作目录，若为NULL则没有选择邮箱 */
     Mailbox RootMail, * WorkPlace;
-    std::map<std::string, Command> commands;
-    std::map<std::string, Response> responses;
+    TagCodec Tags;
+    TagTable<Command> commands;
+    TagTable<Response> responses;
     /* 请求序列号到数据的映射 */
     std::map<u_int32_t, PartData> datas;
+    /* 邮箱名到邮箱的缓存，改变邮箱树结构后应使其失效 */
+    BoxCache Boxes;
+    /* 协商COMPRESS DEFLATE之后两个方向各自的解压器，下标0为客户端，1为服务器 */
+    Inflater* Streams[2];
+    /* 事件回调，NULL表示不通知；WorkName为当前选择的邮箱名，用于事件 */
+    SessionListener* Listener;
+    FlowInfo Flow;
+    std::string WorkName;
+    /* 结束时是否将邮件保存为目录结构 */
+    bool SaveOnClose;
+    /* 用户级存储，非NULL时结束时并入其中而不是直接保存 */
+    UserStore* Store;
+    /* 已经FIN的方向（CLIENT|SERVER） */
+    int Finished;
+    /* 两个方向已经交付的序列号范围，下标0为客户端，1为服务器 */
+    SeqTracker Delivered[2];
+    /* 检查点的设置（NULL为不使用），上一次检查点的时间和之后收到的字节数 */
+    const CheckpointPolicy* Policy;
+    int64_t LastCheckpoint;
+    size_t BytesSince;
+    /* 上一次检查点之后正文完整的邮件（共享内容的副本，见Message::Hold），只在使用检查点时记录 */
+    std::vector<Message*> Completed;
+
+    /* 开启两个方向的解压 */
+    void StartCompress();
+    /* 按名字（不区分大小写）取得邮箱，Create为true时不存在则新建，失败返回NULL */
+    Mailbox* GetBox(const std::string& Name, bool Create, char Delimiter = '/');
+    /* 处理（已解压的）一段明文数据 */
+    int HandleData(std::string new_data, u_int32_t seq_no, int data_src);
+    /* 把上一次检查点之后完整的邮件写入检查点并释放，序列号和UID的对应关系等元数据仍然保留 */
+    void Checkpoint();
+    /* 正文刚刚完整的邮件记入检查点列表 */
+    void Complete(Message* Mail);
+    /* 保存时使用的用户名：没有取得（抓包从会话中间开始、AUTHENTICATE登录等）时为
+    * "unknown@客户端地址:端口"，什么都没有得到的会话为空，不保存 */
+    std::string Owner();
 public:
     /* 在会话结束时，应该自动生成对应邮箱的目录结构以及邮件 */
     Session();
     ~Session();
 
     /* 实现各个命令的功能 */
-    void LogIn(std::string un, std::string pw) {UserName = un, Password = pw;}
+    void LogIn(std::string un, std::string pw);
     void Select(std::string BoxName, std::string res_data);
+    int DeleteBox(const std::string& BoxName);
     int Rename(std::string Src, std::string Dst);
     void list(const std::string& data);
     void fetch(std::string data);
+    void FetchAll(const std::string& data);
     void status(std::string data);
+    void expunge(const std::string& data);
 
     /* 将当前工作目录下的序列集合所表示的邮件移动到某邮箱，若当前工作路径不存在则返回NULL */
     /* 序列号的左闭右开区间，同一般STL处理方式 */
     int CopyMails(int BIndex, int EIndex, std::string TarBoxName);
+    /* 同上，但使用UID的闭区间 */
+    int CopyMailsByUid(u_int32_t BUid, u_int32_t EUid, std::string TarBoxName);
+    /* 按COPY/UID COPY命令的参数（序列集合）进行复制 */
+    void CopySet(const std::string& Set, const std::string& TarBoxName, bool ByUid);
     int SetWorkPlace(std::string TarName);
     void AppendMail(std::string TarBoxName, Message* TarMail);
     int ReceiveData(std::string new_data, u_int32_t seq_no, int data_src);
-    /* 如果是fetch，list，lsub命令，first存储指令，否则存储tag,
-    * 如果不是正常结果返回的first为空 */
-    std::pair<std::string, Response> GetResFromData(std::string& data);
+    /* first存储编码后的tag，如果不是正常结果返回的first为TAG_NONE；
+    * 如果是fetch，list，lsub，status，expunge命令，second.Kind为对应的原子 */
+    std::pair<u_int64_t, Response> GetResFromData(std::string& data);
+    void Measure(MemReport& report);
+
+    void SetListener(SessionListener* listener, const FlowInfo& flow) {Listener = listener; Flow = flow;}
+    void SetTime(int64_t Time) {Flow.Time = Time;}
+    void SetSaveOnClose(bool save) {SaveOnClose = save;}
+    void SetStore(UserStore* store) {Store = store;}
+    void SetCheckpoint(const CheckpointPolicy* policy) {Policy = policy;}
+    /* 记录一个方向的FIN，两个方向都结束时返回true */
+    bool EndDirection(int CS) {Finished |= CS; return Finished == (CLIENT | SERVER);}
+    /* 该方向的数据段末尾还没有交付过的字节数，0为重复包或重传，见SeqTracker */
+    size_t Unseen(u_int32_t seq_no, size_t Len, int CS) {return Delivered[CS == CLIENT ? 0 : 1].Seen(seq_no, Len);}
+    const std::string& GetUserName() {return UserName;}
 };
\ No newline at end of file
@@ -0,0 +1,101 @@
+#include <cstring>
+#include "ImapResolve.h"
+
+Inflater::Inflater() {
+    memset(&Strm, 0, sizeof(Strm));
+    /* 负的窗口位数表示原始deflate流 */
+    Broken = (inflateInit2(&Strm, -15) != Z_OK);
+    RawSeqValid = false;
+    RawSeq = PlainSeq = 0;
+    PendingBytes = 0;
+}
+
+Inflater::~Inflater() {
+    /* 会话结束时空洞仍未补齐 */
+    DropPending();
+    inflateEnd(&Strm);
+}
+
+void Inflater::DropPending() {
+    if (Pending.empty()) return ;
+    GStats.Gaps++;
+    GStats.BytesDropped += PendingBytes;
+    Pending.clear();
+    PendingBytes = 0;
+}
+
+int Inflater::Inflate(const std::string& In, u_int32_t seq_no, std::string& Out) {
+    Out.clear();
+    if (Broken) {
+        GStats.BytesDropped += In.size();
+        return NO;
+    }
+    if (RawSeqValid && (int32_t)(seq_no - RawSeq) > 0) {
+        /* 前面缺少数据，先缓存等待补齐；缓存过多说明数据已经丢失 */
+        if (PendingBytes + In.size() > INFLATE_PENDING) {
+            GStats.BytesDropped += In.size();
+            DropPending();
+            Broken = true;
+            return NO;
+        }
+        Pending.push_back(std::make_pair(seq_no, In));
+        PendingBytes += In.size();
+        return NO;
+    }
+    if (Decompress(In.data(), In.size(), seq_no, Out) != OK && Broken) return NO;
+    /* 依次解压缓存中已经接上的数据段 */
+    for (size_t i = 0; i < Pending.size() && Broken == false; ) {
+        if ((int32_t)(Pending[i].first - RawSeq) > 0) {
+            i++;
+            continue;
+        }
+        std::string seg;
+        seg.swap(Pending[i].second);
+        u_int32_t seq = Pending[i].first;
+        PendingBytes -= seg.size();
+        Pending.erase(Pending.begin() + i);
+        Decompress(seg.data(), seg.size(), seq, Out);
+        i = 0;
+    }
+    if (Broken) {
+        DropPending();
+        Out.clear();
+        return NO;
+    }
+    PlainSeq += Out.size();
+    return Out.size() ? OK : NO;
+}
+
+int Inflater::Decompress(const char* Data, size_t Len, u_int32_t seq_no, std::string& Out) {
+    /* 跳过已经解压过的前缀，部分重叠的重传只取其中的新数据 */
+    size_t skip = 0;
+    if (RawSeqValid && seq_no != RawSeq) {
+        skip = RawSeq - seq_no;
+        if (skip >= Len) {
+            GStats.Retransmits++;
+            return NO;
+        }
+    }
+    RawSeq = seq_no + Len;  RawSeqValid = true;
+
+    char buf[INFLATE_CHUNK];
+    Strm.next_in = (Bytef*)Data + skip;
+    Strm.avail_in = Len - skip;
+    do {
+        Strm.next_out = (Bytef*)buf;
+        Strm.avail_out = INFLATE_CHUNK;
+        int ret = inflate(&Strm, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+            Broken = true;
+            return NO;
+        }
+        Out.append(buf, INFLATE_CHUNK - Strm.avail_out);
+        if (Out.size() > INFLATE_LIMIT) {
+            /* 超过上限，放弃该方向的数据，避免无意义地占用内存 */
+            Broken = true;
+            return NO;
+        }
+        if (ret == Z_STREAM_END) break;
+    } while (Strm.avail_in || Strm.avail_out == 0);
+    return OK;
+}
@@ -0,0 +1,45 @@
+/*---------------------
+* target: IMAP COMPRESS=DEFLATE（RFC 4978）流解压
+* -------------------*/
+#pragma once
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include <sys/types.h>
+
+/* 每次解压输出的块大小，以及单个数据段解压后允许的最大长度 */
+#define INFLATE_CHUNK   (16 << 10)
+#define INFLATE_LIMIT   (16 << 20)
+/* 等待空洞补齐时最多缓存的乱序数据（压缩前的字节数） */
+#define INFLATE_PENDING (1 << 20)
+
+/*------------------------------------------------------------------------------
+* class Inflater
+* 会话某一方向的流式解压器；协商COMPRESS DEFLATE成功后，该方向之后的数据均为
+* 原始deflate流（无zlib/gzip首部），必须按序解压；
+*   1） 以原始TCP序列号检查数据段是否连续，重传的旧数据直接丢弃；出现空洞时先缓存之后的数据段，
+*       补齐后依次解压；缓存超过INFLATE_PENDING或会话结束时仍未补齐才认为数据丢失，无法继续；
+*   2） 解压后的数据拥有自己的虚拟序列号，供会话的数据重组使用；
+*   3） 数据损坏或解压结果超过上限后，标记为失效，此后该方向的数据全部丢弃
+* ----------------------------------------------------------------------------*/
+class Inflater {
+    z_stream Strm;
+    bool Broken, RawSeqValid;
+    /* 下一个期望的原始序列号，以及解压后数据流的虚拟序列号 */
+    u_int32_t RawSeq, PlainSeq;
+    /* 空洞之后乱序到达的数据段（原始序列号，数据） */
+    std::vector<std::pair<u_int32_t, std::string> > Pending;
+    size_t PendingBytes;
+
+    /* 解压一段起点不晚于RawSeq的数据，结果追加到Out；失败时标记失效并返回NO */
+    int Decompress(const char* Data, size_t Len, u_int32_t seq_no, std::string& Out);
+    /* 放弃缓存的数据段，计入丢弃的统计 */
+    void DropPending();
+public:
+    Inflater();
+    ~Inflater();
+    bool IsBroken() {return Broken;}
+    u_int32_t GetPlainSeq() {return PlainSeq;}
+    /* 解压一个数据段，结果写入Out；返回OK表示可以继续处理Out中的数据 */
+    int Inflate(const std::string& In, u_int32_t seq_no, std::string& Out);
+};
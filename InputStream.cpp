@@ -0,0 +1,235 @@
+#include "PeelHeader.h"
+#include <zlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+RingBuffer::RingBuffer(size_t Capacity) {
+    Buf = new char[Capacity];
+    Cap = Capacity;
+    Head = Tail = 0;
+    Closed = false;
+}
+
+RingBuffer::~RingBuffer() {
+    delete[] Buf;
+}
+
+bool RingBuffer::Write(const char* Data, size_t Len) {
+    while (Len) {
+        u_int64_t head = Head.load(std::memory_order_relaxed);
+        size_t used = (size_t)(head - Tail.load(std::memory_order_acquire));
+        if (used == Cap) {
+            /* 缓冲区已满，等待消费者读取 */
+            std::unique_lock<std::mutex> lk(Lock);
+            NotFull.wait(lk, [&]{ return Head.load() - Tail.load() < Cap || Closed.load(); });
+            if (Closed) return false;
+            continue;
+        }
+        if (Closed) return false;
+        /* 最多分两段拷贝，先拷贝到缓冲区末尾，再从头开始 */
+        size_t n = std::min(Len, Cap - used);
+        size_t at = (size_t)(head % Cap);
+        size_t first = std::min(n, Cap - at);
+        memcpy(Buf + at, Data, first);
+        if (n > first) memcpy(Buf, Data + first, n - first);
+        Head.store(head + n, std::memory_order_release);
+        Data += n;  Len -= n;
+        {
+            std::lock_guard<std::mutex> lk(Lock);
+        }
+        NotEmpty.notify_one();
+    }
+    return true;
+}
+
+size_t RingBuffer::Read(char* Data, size_t Len) {
+    size_t done = 0;
+    while (done < Len) {
+        u_int64_t tail = Tail.load(std::memory_order_relaxed);
+        size_t avail = (size_t)(Head.load(std::memory_order_acquire) - tail);
+        if (avail == 0) {
+            /* 缓冲区为空，若生产者已经结束，则说明数据已经读尽 */
+            std::unique_lock<std::mutex> lk(Lock);
+            NotEmpty.wait(lk, [&]{ return Head.load() != Tail.load() || Closed.load(); });
+            if (Head.load() == Tail.load()) break;
+            continue;
+        }
+        size_t n = std::min(Len - done, avail);
+        size_t at = (size_t)(tail % Cap);
+        size_t first = std::min(n, Cap - at);
+        memcpy(Data + done, Buf + at, first);
+        if (n > first) memcpy(Data + done + first, Buf, n - first);
+        /* 只有在消费了足够多的数据后才唤醒生产者，避免每次读取都加锁 */
+        u_int64_t before = tail - (tail % (Cap / 4));
+        Tail.store(tail + n);
+        done += n;
+        if (tail + n - before >= Cap / 4) {
+            std::lock_guard<std::mutex> lk(Lock);
+            NotFull.notify_one();
+        }
+    }
+    return done;
+}
+
+size_t RingBuffer::ReadSome(char* Data, size_t Len) {
+    if (Len == 0) return 0;
+    if (Head.load(std::memory_order_acquire) == Tail.load(std::memory_order_relaxed)) {
+        std::unique_lock<std::mutex> lk(Lock);
+        NotEmpty.wait(lk, [&]{ return Head.load() != Tail.load() || Closed.load(); });
+    }
+    size_t avail = (size_t)(Head.load(std::memory_order_acquire) - Tail.load(std::memory_order_relaxed));
+    return Read(Data, std::min(Len, avail));
+}
+
+void RingBuffer::Close() {
+    {
+        std::lock_guard<std::mutex> lk(Lock);
+        Closed = true;
+    }
+    NotEmpty.notify_all();
+    NotFull.notify_all();
+}
+
+InputStream::InputStream(const char* FileName) {
+    Ring = NULL;    Pos = 0;    Kind = INPUT_RAW;
+    if (strcmp(FileName, "-") == 0) File = stdin;
+    else if ((File = fopen(FileName, "rb")) == NULL) throw(FILE_OPEN_ERR);
+    /* 加大stdio的缓冲区，必须在第一次读取之前设置 */
+    setvbuf(File, NULL, _IOFBF, CHUNK_SIZE);
+    /* 通过文件开头的魔数判断压缩格式；读出的字节留在Magic中，不回退文件，管道也可以使用 */
+    MagicLen = fread(Magic, 1, 4, File);
+    MagicPos = 0;
+    if (MagicLen >= 2 && Magic[0] == 0x1f && Magic[1] == 0x8b) Kind = INPUT_GZIP;
+    else if (MagicLen == 4 && Magic[0] == 0x28 && Magic[1] == 0xb5 && Magic[2] == 0x2f && Magic[3] == 0xfd) Kind = INPUT_ZSTD;
+
+    if (Kind == INPUT_RAW) return ;
+#ifndef HAVE_ZSTD
+    if (Kind == INPUT_ZSTD) {
+        if (File != stdin) fclose(File);
+        throw(NO_CODEC);
+    }
+#endif
+    Ring = new RingBuffer(RING_SIZE);
+    if (Kind == INPUT_GZIP) Worker = std::thread(&InputStream::GzipWorker, this);
+    else Worker = std::thread(&InputStream::ZstdWorker, this);
+}
+
+InputStream::~InputStream() {
+    if (Ring) {
+        /* 提前结束读取时，应先关闭缓冲区，使解压线程能够退出 */
+        Ring->Close();
+        Worker.join();
+        delete Ring;
+        if (Error.size()) fprintf(stderr, "%s\n", Error.c_str());
+    }
+    if (File != stdin) fclose(File);
+}
+
+size_t InputStream::ReadFile(void* Data, size_t Len) {
+    size_t n = std::min(Len, MagicLen - MagicPos);
+    memcpy(Data, Magic + MagicPos, n);
+    MagicPos += n;
+    if (n < Len) n += fread((char*)Data + n, 1, Len - n, File);
+    return n;
+}
+
+void InputStream::GzipWorker() {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    /* 15+32 表示自动识别gzip或zlib首部 */
+    if (inflateInit2(&strm, 15 + 32) != Z_OK) {
+        Error = "gzip: inflateInit failed";
+        Ring->Close();
+        return ;
+    }
+    char* in = new char[CHUNK_SIZE];
+    char* out = new char[CHUNK_SIZE];
+    bool alive = true;
+    int ret = Z_OK;
+    while (alive) {
+        strm.avail_in = ReadFile(in, CHUNK_SIZE);
+        if (strm.avail_in == 0) break;
+        strm.next_in = (Bytef*)in;
+        /* 输出缓冲区被填满时，inflate内部可能还有待输出的数据，需要继续调用 */
+        do {
+            strm.next_out = (Bytef*)out;
+            strm.avail_out = CHUNK_SIZE;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                Error = std::string("gzip: ") + (strm.msg ? strm.msg : "corrupt data");
+                alive = false;
+                break;
+            }
+            if (CHUNK_SIZE - strm.avail_out && !Ring->Write(out, CHUNK_SIZE - strm.avail_out)) alive = false;
+            /* 多个gzip成员首尾相接时，继续解压下一个成员 */
+            if (ret == Z_STREAM_END) inflateReset(&strm);
+        } while (alive && (strm.avail_in || strm.avail_out == 0));
+    }
+    inflateEnd(&strm);
+    delete[] in;
+    delete[] out;
+    Ring->Close();
+}
+
+void InputStream::ZstdWorker() {
+#ifdef HAVE_ZSTD
+    ZSTD_DStream* ds = ZSTD_createDStream();
+    ZSTD_initDStream(ds);
+    size_t in_cap = ZSTD_DStreamInSize(), out_cap = ZSTD_DStreamOutSize();
+    char* in = new char[in_cap];
+    char* out = new char[out_cap];
+    bool alive = true;
+    while (alive) {
+        ZSTD_inBuffer input = {in, ReadFile(in, in_cap), 0};
+        if (input.size == 0) break;
+        while (alive && input.pos < input.size) {
+            ZSTD_outBuffer output = {out, out_cap, 0};
+            size_t ret = ZSTD_decompressStream(ds, &output, &input);
+            if (ZSTD_isError(ret)) {
+                Error = std::string("zstd: ") + ZSTD_getErrorName(ret);
+                alive = false;
+                break;
+            }
+            if (output.pos && !Ring->Write(out, output.pos)) alive = false;
+        }
+    }
+    ZSTD_freeDStream(ds);
+    delete[] in;
+    delete[] out;
+#endif
+    Ring->Close();
+}
+
+size_t InputStream::Read(void* Data, size_t Len) {
+    size_t got;
+    if (Ring) got = Ring->Read((char*)Data, Len);
+    else got = ReadFile(Data, Len);
+    Pos += got;
+    return got;
+}
+
+bool InputStream::Skip(size_t Len) {
+    /* 普通文件直接跳过，fseeko可以越过文件结尾，需要对照文件大小，与Read一样不足时返回false；
+     * Magic中还有剩余或输入不能定位（管道）时读出丢弃 */
+    struct stat st;
+    off_t at;
+    if (Ring == NULL && MagicPos == MagicLen && fstat(fileno(File), &st) == 0 && S_ISREG(st.st_mode)
+        && (at = ftello(File)) >= 0) {
+        bool whole = (u_int64_t)at + Len <= (u_int64_t)st.st_size;
+        off_t to = whole ? at + Len : std::max(at, st.st_size);
+        if (fseeko(File, to, SEEK_SET) == 0) {
+            Pos += to - at;
+            return whole;
+        }
+    }
+    char dump[4096];
+    while (Len) {
+        size_t n = std::min(Len, sizeof(dump));
+        if (Read(dump, n) != n) return false;
+        Len -= n;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+/*---------------------
+* target: pcap 输入流，透明支持 gzip/zstd 压缩文件
+* -------------------*/
+#pragma once
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <condition_variable>
+#include <sys/types.h>
+
+/* 输入文件的类型，通过文件开头的魔数判断，而不是扩展名 */
+#define INPUT_RAW   0
+#define INPUT_GZIP  1
+#define INPUT_ZSTD  2
+
+/* 解压线程与解析线程之间环形缓冲区的大小，以及每次从文件读取压缩数据的大小 */
+#define RING_SIZE   (8 << 20)
+#define CHUNK_SIZE  (256 << 10)
+
+/*------------------------------------------------------------------------------
+* class RingBuffer
+* 单生产者单消费者的环形缓冲区；解压线程作为生产者写入，解析线程作为消费者读取；
+* 读写位置使用原子变量维护，只有在缓冲区满或空时才会在条件变量上等待；
+* 生产者结束时调用Close，消费者读完剩余数据后即得到文件结束
+* ----------------------------------------------------------------------------*/
+class RingBuffer {
+    char* Buf;
+    size_t Cap;
+    /* Head为已写入的总字节数，Tail为已读取的总字节数，二者之差即为可读数据量 */
+    std::atomic<u_int64_t> Head, Tail;
+    std::atomic<bool> Closed;
+    std::mutex Lock;
+    std::condition_variable NotEmpty, NotFull;
+public:
+    RingBuffer(size_t Capacity);
+    ~RingBuffer();
+    /* 写入全部数据，若消费者已经放弃读取则返回false */
+    bool Write(const char* Data, size_t Len);
+    /* 读取至多Len字节，只有在生产者关闭并且数据读尽时才返回0 */
+    size_t Read(char* Data, size_t Len);
+    /* 有数据即返回，至多Len字节，同样只在关闭并读尽时返回0 */
+    size_t ReadSome(char* Data, size_t Len);
+    void Close();
+};
+
+/*------------------------------------------------------------------------------
+* class InputStream
+* 顺序读取的输入流；普通pcap文件直接使用stdio读取，压缩文件则启动单独的解压线程，
+* 解压结果经过环形缓冲区交给解析线程，使解压和解析并行进行；
+* Offset始终为解压后数据流中的偏移，对于普通文件即为文件偏移
+* ----------------------------------------------------------------------------*/
+class InputStream {
+    FILE* File;
+    int Kind;
+    u_int64_t Pos;
+    RingBuffer* Ring;
+    std::thread Worker;
+    /* 解压线程中出现的错误，只在线程结束后读取 */
+    std::string Error;
+    /* 判断类型时读出的文件开头，之后的读取先取这里（输入可能是管道，不能回退） */
+    unsigned char Magic[4];
+    size_t MagicLen, MagicPos;
+
+    /* 从文件读取，先返回Magic中剩余的字节 */
+    size_t ReadFile(void* Data, size_t Len);
+    void GzipWorker();
+    void ZstdWorker();
+public:
+    /* FileName为"-"时读取标准输入 */
+    InputStream(const char* FileName);
+    ~InputStream();
+
+    /* 读取至多Len字节，返回实际读取的字节数，小于Len说明已到结尾 */
+    size_t Read(void* Data, size_t Len);
+    /* 向后跳过Len字节，失败说明已到结尾 */
+    bool Skip(size_t Len);
+    int GetKind() {return Kind;}
+    bool IsCompressed() {return Kind != INPUT_RAW;}
+    u_int64_t Offset() {return Pos;}
+};
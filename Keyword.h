@@ -0,0 +1,143 @@
+/*---------------------
+* target: IMAP 关键字的完美哈希查找
+* -------------------*/
+#pragma once
+#include <sys/types.h>
+
+/*------------------------------------------------------------------------------
+* 命令名和响应中的原子（结果、数据项、状态字、邮件标记）都是有限集合，
+* 对每个集合选取一个种子，使集合内所有关键字的哈希槽位互不相同（完美哈希）；
+* 槽位表在编译期由关键字列表生成，并用static_assert检查没有冲突；
+* 运行时直接在原始字节上计算哈希（忽略大小写），再与槽位中唯一的候选比较一次，
+* 整个过程没有内存分配，也不需要先转换成小写字符串；
+* 增加关键字后若编译报冲突，应重新选取种子
+* ----------------------------------------------------------------------------*/
+
+/* 响应原子的编号，0表示不是关键字 */
+#define ATOM_OK         1
+#define ATOM_NO         2
+#define ATOM_BAD        3
+#define ATOM_FETCH      4
+#define ATOM_LIST       5
+#define ATOM_LSUB       6
+#define ATOM_STATUS     7
+#define ATOM_EXISTS     8
+#define ATOM_RECENT     9
+#define ATOM_UNSEEN     10
+#define ATOM_UIDVALID   11
+#define ATOM_UIDNEXT    12
+#define ATOM_MESSAGES   13
+#define ATOM_FLAGS      14
+#define ATOM_RFCSIZE    15
+#define ATOM_INTERDATE  16
+#define ATOM_ENVELOPE   17
+#define ATOM_BODY       18
+#define ATOM_UID        19
+#define ATOM_EXPUNGE    20
+#define ATOM_ANSWERED   21
+#define ATOM_FLAGGED    22
+#define ATOM_DELETED    23
+#define ATOM_DRAFT      24
+#define ATOM_SEEN       25
+
+struct KeyWord {
+    const char* Name;
+    int Len;
+    int Id;
+};
+#define KW(name, id) {name, sizeof(name) - 1, id}
+
+/* 槽位表，值为关键字在列表中的下标，-1为空槽 */
+struct SlotTable {
+    signed char Slot[64];
+};
+
+constexpr char KwLower(char c) {
+    return (c <= 'Z' && c >= 'A') ? c - 'A' + 'a' : c;
+}
+
+/* FNV-1a，种子作为初始值；取高位作为槽位，因为低位没有得到充分混合 */
+constexpr u_int32_t KwHash(const char* s, int n, u_int32_t h) {
+    return n == 0 ? h : KwHash(s + 1, n - 1, (h ^ (u_int8_t)KwLower(*s)) * 16777619u);
+}
+
+constexpr int KwSlot(const KeyWord& kw, u_int32_t seed, int shift) {
+    return (int)(KwHash(kw.Name, kw.Len, seed) >> shift);
+}
+
+/* 查找哈希到指定槽位的关键字下标 */
+constexpr int KwFind(const KeyWord* kw, int n, u_int32_t seed, int shift, int slot, int i) {
+    return i == n ? -1 : (KwSlot(kw[i], seed, shift) == slot ? i : KwFind(kw, n, seed, shift, slot, i + 1));
+}
+
+/* 统计与第i个关键字冲突的后续关键字数量，以及整个列表的冲突数量 */
+constexpr int KwClash(const KeyWord* kw, int n, u_int32_t seed, int shift, int i, int j) {
+    return j == n ? 0 : (KwSlot(kw[i], seed, shift) == KwSlot(kw[j], seed, shift)) + KwClash(kw, n, seed, shift, i, j + 1);
+}
+
+constexpr int KwCollisions(const KeyWord* kw, int n, u_int32_t seed, int shift, int i) {
+    return i == n ? 0 : KwClash(kw, n, seed, shift, i, i + 1) + KwCollisions(kw, n, seed, shift, i + 1);
+}
+
+/* 编译期的下标序列，用于展开生成整张槽位表 */
+template <int... I> struct KwSeq {};
+template <int N, int... I> struct KwMakeSeq : KwMakeSeq<N - 1, N - 1, I...> {};
+template <int... I> struct KwMakeSeq<0, I...> { typedef KwSeq<I...> type; };
+
+template <int... I>
+constexpr SlotTable KwBuild(const KeyWord* kw, int n, u_int32_t seed, int shift, KwSeq<I...>) {
+    return SlotTable{{ (signed char)(I < (1 << (32 - shift)) ? KwFind(kw, n, seed, shift, I, 0) : -1)... }};
+}
+
+/* 运行时查找，p和n为原始数据中的一段字节，不要求以'\0'结尾 */
+inline int KwLookup(const KeyWord* kw, const SlotTable& table, u_int32_t seed, int shift, const char* p, int n) {
+    u_int32_t h = seed;
+    for (int i = 0; i < n; i++) h = (h ^ (u_int8_t)KwLower(p[i])) * 16777619u;
+    int idx = table.Slot[h >> shift];
+    if (idx < 0 || kw[idx].Len != n) return 0;
+    for (int i = 0; i < n; i++)
+        if (KwLower(p[i]) != kw[idx].Name[i]) return 0;
+    return kw[idx].Id;
+}
+
+/* 命令名到命令类型（ImapResolve.h中定义，应在其后包含本文件），select和examine共用SELECT */
+constexpr KeyWord CommandWords[] = {
+    KW("login", LOGIN),         KW("select", SELECT),       KW("examine", SELECT),
+    KW("create", CREATE),       KW("delete", DELETE),       KW("rename", RENAME),
+    KW("subscribe", SUBSCR),    KW("unsubscribe", UNSUBS),
+    KW("append", APPEND),       KW("copy", COPY),           KW("compress", COMPRE),
+    KW("uid", UIDCOM),
+};
+#define COMMAND_WORDS   (int)(sizeof(CommandWords) / sizeof(KeyWord))
+#define COMMAND_SEED    0x10u
+#define COMMAND_SHIFT   27
+static_assert(KwCollisions(CommandWords, COMMAND_WORDS, COMMAND_SEED, COMMAND_SHIFT, 0) == 0,
+              "command keywords collide, choose another COMMAND_SEED");
+constexpr SlotTable CommandSlots = KwBuild(CommandWords, COMMAND_WORDS, COMMAND_SEED, COMMAND_SHIFT, KwMakeSeq<64>::type());
+
+/* 响应中的原子，邮件标记不含开头的反斜杠 */
+constexpr KeyWord AtomWords[] = {
+    KW("ok", ATOM_OK),              KW("no", ATOM_NO),              KW("bad", ATOM_BAD),
+    KW("fetch", ATOM_FETCH),        KW("list", ATOM_LIST),          KW("lsub", ATOM_LSUB),
+    KW("status", ATOM_STATUS),      KW("exists", ATOM_EXISTS),      KW("recent", ATOM_RECENT),
+    KW("unseen", ATOM_UNSEEN),      KW("uidvalidity", ATOM_UIDVALID), KW("uidnext", ATOM_UIDNEXT),
+    KW("messages", ATOM_MESSAGES),  KW("flags", ATOM_FLAGS),        KW("rfc822.size", ATOM_RFCSIZE),
+    KW("internaldate", ATOM_INTERDATE), KW("envelope", ATOM_ENVELOPE), KW("body", ATOM_BODY),
+    KW("uid", ATOM_UID),            KW("expunge", ATOM_EXPUNGE),    KW("answered", ATOM_ANSWERED),
+    KW("flagged", ATOM_FLAGGED),    KW("deleted", ATOM_DELETED),    KW("draft", ATOM_DRAFT),
+    KW("seen", ATOM_SEEN),
+};
+#define ATOM_WORDS      (int)(sizeof(AtomWords) / sizeof(KeyWord))
+#define ATOM_SEED       0xc2u
+#define ATOM_SHIFT      26
+static_assert(KwCollisions(AtomWords, ATOM_WORDS, ATOM_SEED, ATOM_SHIFT, 0) == 0,
+              "atom keywords collide, choose another ATOM_SEED");
+constexpr SlotTable AtomSlots = KwBuild(AtomWords, ATOM_WORDS, ATOM_SEED, ATOM_SHIFT, KwMakeSeq<64>::type());
+
+inline int LookupCommand(const char* p, int n) {
+    return KwLookup(CommandWords, CommandSlots, COMMAND_SEED, COMMAND_SHIFT, p, n);
+}
+
+inline int LookupAtom(const char* p, int n) {
+    return KwLookup(AtomWords, AtomSlots, ATOM_SEED, ATOM_SHIFT, p, n);
+}
@@ -0,0 +1,244 @@
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include "LiveCapture.h"
+#include "Profile.h"
+
+struct CaptureRing {
+    int Fd;
+    u_int8* Map;
+    size_t MapSize;
+    ImapEngine Engine;
+    std::thread Thread;
+    /* 抓包线程计数的副本，由Lock保护；线程结束时另外留下延迟直方图 */
+    Stats Counters;
+    StageCounts Stages;
+    std::mutex Lock;
+    CaptureRing() : Fd(-1), Map(NULL), MapSize(0) {memset(&Counters, 0, sizeof(Counters));}
+};
+
+/* "ip and tcp port 143"，偏移按以太网首部计算；IP分片（偏移不为0）不保留 */
+static struct sock_filter ImapFilter[] = {
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ETH_P_IP, 0, 10),
+    BPF_STMT(BPF_LD + BPF_B + BPF_ABS, 23),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_TCP, 0, 8),
+    BPF_STMT(BPF_LD + BPF_H + BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K, 0x1fff, 6, 0),
+    BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 14),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 14),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IMAP_PORT, 2, 0),
+    BPF_STMT(BPF_LD + BPF_H + BPF_IND, 16),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IMAP_PORT, 0, 1),
+    BPF_STMT(BPF_RET + BPF_K, 0x40000),
+    BPF_STMT(BPF_RET + BPF_K, 0),
+};
+#define FILTER_LEN  (int)(sizeof(ImapFilter) / sizeof(ImapFilter[0]))
+
+/* 环回接口上发出的包还会作为收到的包再出现一次，与libpcap相同，丢弃发出方向 */
+static struct sock_filter SkipOutgoing[] = {
+    BPF_STMT(BPF_LD + BPF_W + BPF_ABS, (u_int32)(SKF_AD_OFF + SKF_AD_PKTTYPE)),
+    BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, PACKET_OUTGOING, FILTER_LEN - 1, 0),
+};
+
+LiveCapture::LiveCapture(const char* Name, int Threads) : Interface(Name), Loopback(false), Reporter(NULL), Stopping(false) {
+    memset(&Captured, 0, sizeof(Captured));
+    if (Threads < 1 || Threads > LIVE_MAX_THREADS || Interface.size() >= IFNAMSIZ) throw(NO_INPUT);
+    /* 取得接口编号和链路类型 */
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, Name);
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) throw(NO_INPUT);
+    bool found = ioctl(fd, SIOCGIFINDEX, &ifr) == 0;
+    int IfIndex = ifr.ifr_ifindex;
+    found = found && ioctl(fd, SIOCGIFHWADDR, &ifr) == 0;
+    close(fd);
+    if (found == false) throw(NO_INPUT);
+    if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER && ifr.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK) throw(NO_PCAP);
+    Loopback = ifr.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK;
+
+    /* 同一进程的套接字使用同一个分流组 */
+    int FanoutId = Threads > 1 ? getpid() & 0xffff : -1;
+    for (int i = 0; i < Threads; i++) {
+        CaptureRing* ring = new CaptureRing;
+        Rings.push_back(ring);
+        try {
+            OpenRing(ring, IfIndex, FanoutId);
+        } catch (int) {
+            /* 保留错误原因，释放时的close可能改变errno */
+            int saved = errno;
+            Release();
+            errno = saved;
+            throw;
+        }
+    }
+}
+
+void LiveCapture::OpenRing(CaptureRing* ring, int IfIndex, int FanoutId) {
+    /* 协议为0时不接收任何包，设置好过滤器和缓冲区之后再绑定到接口 */
+    ring->Fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (ring->Fd < 0) throw(NO_INPUT);
+    std::vector<struct sock_filter> filter;
+    if (Loopback) filter.assign(SkipOutgoing, SkipOutgoing + 2);
+    filter.insert(filter.end(), ImapFilter, ImapFilter + FILTER_LEN);
+    struct sock_fprog prog;
+    prog.len = filter.size();
+    prog.filter = filter.data();
+    int version = TPACKET_V3;
+    if (setsockopt(ring->Fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0
+        || setsockopt(ring->Fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+        throw(NO_INPUT);
+
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = LIVE_BLOCK_SIZE;
+    req.tp_block_nr = LIVE_BLOCK_COUNT;
+    req.tp_frame_size = LIVE_FRAME_SIZE;
+    req.tp_frame_nr = LIVE_BLOCK_SIZE / LIVE_FRAME_SIZE * LIVE_BLOCK_COUNT;
+    req.tp_retire_blk_tov = LIVE_BLOCK_TIMEOUT;
+    if (setsockopt(ring->Fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) throw(NO_INPUT);
+    ring->MapSize = (size_t)LIVE_BLOCK_SIZE * LIVE_BLOCK_COUNT;
+    void* map = mmap(NULL, ring->MapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->Fd, 0);
+    if (map == MAP_FAILED) throw(NO_INPUT);
+    ring->Map = (u_int8*)map;
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = IfIndex;
+    if (bind(ring->Fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) throw(NO_INPUT);
+    if (FanoutId >= 0) {
+        int fanout = FanoutId | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(ring->Fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) throw(NO_INPUT);
+    }
+}
+
+LiveCapture::~LiveCapture() {
+    Release();
+}
+
+void LiveCapture::Release() {
+    for (size_t i = 0; i < Rings.size(); i++) {
+        CaptureRing* ring = Rings[i];
+        if (ring->Thread.joinable()) {
+            Stopping = true;
+            ring->Thread.join();
+        }
+        if (ring->Map) munmap(ring->Map, ring->MapSize);
+        if (ring->Fd >= 0) close(ring->Fd);
+        delete ring;
+    }
+    Rings.clear();
+}
+
+void LiveCapture::SetListener(SessionListener* listener) {
+    for (size_t i = 0; i < Rings.size(); i++) Rings[i]->Engine.SetListener(listener);
+}
+
+void LiveCapture::SetSaveOnClose(bool save) {
+    for (size_t i = 0; i < Rings.size(); i++) Rings[i]->Engine.SetSaveOnClose(save);
+}
+
+void LiveCapture::SetStore(UserStore* store) {
+    for (size_t i = 0; i < Rings.size(); i++) Rings[i]->Engine.SetStore(store);
+}
+
+void LiveCapture::SetCheckpoint(const CheckpointPolicy* policy) {
+    for (size_t i = 0; i < Rings.size(); i++) Rings[i]->Engine.SetCheckpoint(policy);
+}
+
+void LiveCapture::Measure(MemReport& report) {
+    for (size_t i = 0; i < Rings.size(); i++) Rings[i]->Engine.Measure(report);
+}
+
+void LiveCapture::CloseAll() {
+    for (size_t i = 0; i < Rings.size(); i++) Rings[i]->Engine.CloseAll();
+}
+
+void LiveCapture::CollectStats() {
+    for (size_t i = 0; i < Rings.size(); i++) {
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+        if (getsockopt(Rings[i]->Fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) != 0) continue;
+        /* tp_packets包括被丢弃的包 */
+        Captured.CapturePackets += st.tp_packets;
+        Captured.CaptureDrops += st.tp_drops;
+        Captured.CaptureFreezes += st.tp_freeze_q_cnt;
+    }
+}
+
+void LiveCapture::GatherStats() {
+    GStats.ClearCounters();
+    GStats.Add(Captured);
+    for (size_t i = 0; i < Rings.size(); i++) {
+        std::lock_guard<std::mutex> guard(Rings[i]->Lock);
+        GStats.Add(Rings[i]->Counters);
+    }
+}
+
+int LiveCapture::Run() {
+    Stopping = false;
+    for (size_t i = 0; i < Rings.size(); i++)
+        Rings[i]->Thread = std::thread(&LiveCapture::Worker, this, Rings[i]);
+    /* 主线程只负责周期报告，报告中不统计内存（会话属于各抓包线程） */
+    while (Stopping == false) {
+        usleep(LIVE_POLL_TIMEOUT * 1000);
+        if (Reporter && Reporter->TimeDue()) {
+            CollectStats();
+            GatherStats();
+            Reporter->Report(NULL, false);
+        }
+    }
+    for (size_t i = 0; i < Rings.size(); i++) {
+        Rings[i]->Thread.join();
+        GStages.Add(Rings[i]->Stages);
+    }
+    CollectStats();
+    GatherStats();
+    return OK;
+}
+
+void LiveCapture::Worker(CaptureRing* ring) {
+    struct pollfd pfd;
+    pfd.fd = ring->Fd;
+    pfd.events = POLLIN | POLLERR;
+    u_int32 cur = 0;
+    bool last = false;
+    while (true) {
+        struct tpacket_block_desc* block = (struct tpacket_block_desc*)(ring->Map + (size_t)cur * LIVE_BLOCK_SIZE);
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+            /* 停止后再等待一个超时周期，让内核交出未满的块，取完后结束 */
+            if (last) break;
+            if (Stopping) {
+                last = true;
+                usleep(LIVE_BLOCK_TIMEOUT * 2000);
+            } else poll(&pfd, 1, LIVE_POLL_TIMEOUT);
+            continue;
+        }
+        /* 一个块中的包依次交给引擎，处理完后整块归还内核 */
+        struct tpacket3_hdr* pkt = (struct tpacket3_hdr*)((u_int8*)block + block->hdr.bh1.offset_to_first_pkt);
+        for (u_int32 i = 0; i < block->hdr.bh1.num_pkts; i++) {
+            GStats.PacketsRead++;
+            GStats.BytesRead += pkt->tp_snaplen;
+            ring->Engine.PushFrame((u_int8*)pkt + pkt->tp_mac, pkt->tp_snaplen,
+                                   (int64_t)pkt->tp_sec * 1000000 + pkt->tp_nsec / 1000);
+            pkt = (struct tpacket3_hdr*)((u_int8*)pkt + pkt->tp_next_offset);
+        }
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        cur = (cur + 1) % LIVE_BLOCK_COUNT;
+        std::lock_guard<std::mutex> guard(ring->Lock);
+        ring->Counters = GStats;
+    }
+    std::lock_guard<std::mutex> guard(ring->Lock);
+    ring->Counters = GStats;
+    ring->Stages = GStages;
+}
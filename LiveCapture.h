@@ -0,0 +1,73 @@
+/*---------------------
+* target: 从网卡实时抓包（AF_PACKET TPACKET_V3环形缓冲区）
+* -------------------*/
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PeelHeader.h"
+
+/* 环形缓冲区的块大小和块数（每个抓包线程一份），内核填满或超时后整块交给用户 */
+#define LIVE_BLOCK_SIZE     (1 << 20)
+#define LIVE_BLOCK_COUNT    64
+/* tpacket_req3要求的帧大小，TPACKET_V3中只用于计算帧数 */
+#define LIVE_FRAME_SIZE     2048
+/* 没有填满的块交给用户的超时（毫秒），以及等待数据时poll的超时（毫秒） */
+#define LIVE_BLOCK_TIMEOUT  50
+#define LIVE_POLL_TIMEOUT   100
+#define LIVE_MAX_THREADS    64
+
+struct CaptureRing;
+
+/*------------------------------------------------------------------------------
+* class LiveCapture
+* 在网卡上实时抓包，数据帧按块批量取出后交给ImapEngine::PushFrame，与处理pcap文件的路径相同：
+*   1） 每个抓包线程一个套接字和一个mmap的环形缓冲区，内核中用BPF过滤只保留端口143的IPv4 TCP包；
+*   2） 多于一个线程时各套接字加入同一个PACKET_FANOUT组，按四元组哈希分流，
+*       同一连接两个方向的包总是交给同一个线程，每个线程使用各自的引擎；
+*   3） 只支持以太网和环回接口（链路层首部14字节），其他类型抛出NO_PCAP，打开失败抛出NO_INPUT；
+*       环回接口上只取收到的方向，每个包只处理一次；
+*   4） 内核的收包和丢包数由PACKET_STATISTICS取得，记入Capture*计数器；
+*   5） GStats和GStages每个线程一份，抓包线程每处理完一块把自己的计数复制一份（加锁），
+*       报告前在主线程中汇总到主线程的GStats；延迟直方图在抓包线程结束后合并；
+* Run阻塞直到Stop被调用（可以在信号处理函数中调用），之后取出已经交给用户的块再返回；
+* 多线程时回调在各抓包线程中调用
+* ----------------------------------------------------------------------------*/
+class LiveCapture {
+    std::string Interface;
+    bool Loopback;
+    std::vector<CaptureRing*> Rings;
+    StatsReporter* Reporter;
+    std::atomic<bool> Stopping;
+    /* 主线程取得的内核统计，只有Capture*计数器 */
+    Stats Captured;
+
+    void OpenRing(CaptureRing* ring, int IfIndex, int FanoutId);
+    /* 结束抓包线程，释放缓冲区和套接字 */
+    void Release();
+    void Worker(CaptureRing* ring);
+    /* 读取各套接字的统计（读取后内核清零）并累加 */
+    void CollectStats();
+    /* 把Captured和各抓包线程最近复制的计数汇总到主线程的GStats */
+    void GatherStats();
+    LiveCapture(const LiveCapture&);
+    LiveCapture& operator=(const LiveCapture&);
+public:
+    LiveCapture(const char* Interface, int Threads = 1);
+    ~LiveCapture();
+
+    void SetReporter(StatsReporter* reporter) {Reporter = reporter;}
+    /* 以下设置在Run之前调用 */
+    void SetListener(SessionListener* listener);
+    void SetSaveOnClose(bool save);
+    /* 各线程的引擎共用一个用户级存储 */
+    void SetStore(UserStore* store);
+    void SetCheckpoint(const CheckpointPolicy* policy);
+    int Run();
+    void Stop() {Stopping = true;}
+    /* 以下在Run返回后调用 */
+    void Measure(MemReport& report);
+    void CloseAll();
+};
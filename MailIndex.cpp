@@ -0,0 +1,134 @@
+#include "MailIndex.h"
+
+void MailIndex::Split(Node* t, int key, Node*& l, Node*& r) {
+    if (t == NULL) {
+        l = r = NULL;
+        return ;
+    }
+    Push(t);
+    if (t->Key < key) {
+        Split(t->R, key, t->R, r);
+        l = t;
+    } else {
+        Split(t->L, key, l, t->L);
+        r = t;
+    }
+    Update(t);
+}
+
+MailIndex::Node* MailIndex::Merge(Node* l, Node* r) {
+    if (l == NULL) return r;
+    if (r == NULL) return l;
+    if (l->Prio > r->Prio) {
+        Push(l);
+        l->R = Merge(l->R, r);
+        Update(l);
+        return l;
+    }
+    Push(r);
+    r->L = Merge(l, r->L);
+    Update(r);
+    return r;
+}
+
+void MailIndex::Collect(Node* t, std::vector<std::pair<int, Message*> >& out) {
+    if (t == NULL) return ;
+    Push(t);
+    Collect(t->L, out);
+    out.push_back(std::make_pair(t->Key, t->Mail));
+    Collect(t->R, out);
+}
+
+void MailIndex::Destroy(Node* t) {
+    if (t == NULL) return ;
+    Destroy(t->L);
+    Destroy(t->R);
+    Drop(t);
+}
+
+Message* MailIndex::Find(int SeqId) {
+    Node* t = Root;
+    while (t) {
+        Push(t);
+        if (t->Key == SeqId) return t->Mail;
+        t = SeqId < t->Key ? t->L : t->R;
+    }
+    return NULL;
+}
+
+bool MailIndex::Insert(int SeqId, Message* Mail) {
+    if (Find(SeqId)) return false;
+    Node* n = new Node;
+    n->Key = SeqId; n->Shift = 0;   n->Prio = Random();
+    n->Size = 1;    n->Mail = Mail; n->L = n->R = n->P = NULL;
+    Node* l, * r;
+    Split(Root, SeqId, l, r);
+    SetRoot(Merge(Merge(l, n), r));
+    Nodes[Mail] = n;
+    return true;
+}
+
+Message* MailIndex::Erase(int SeqId) {
+    Node* l, * m, * r;
+    Split(Root, SeqId, l, r);
+    Split(r, SeqId + 1, m, r);
+    Message* Mail = NULL;
+    if (m) {
+        Mail = m->Mail;
+        Drop(m);
+    }
+    SetRoot(Merge(l, r));
+    return Mail;
+}
+
+bool MailIndex::EraseMail(Message* Mail) {
+    std::unordered_map<Message*, Node*>::iterator it = Nodes.find(Mail);
+    if (it == Nodes.end()) return false;
+    /* 节点自身的键已含偏移，祖先上尚未下推的偏移还要加上 */
+    Node* t = it->second;
+    int key = t->Key;
+    for (Node* p = t->P; p; p = p->P) key += p->Shift;
+    Erase(key);
+    return true;
+}
+
+void MailIndex::EraseRange(int Begin, int End, std::vector<Message*>& Removed) {
+    if (End <= Begin) return ;
+    Node* l, * m, * r;
+    Split(Root, Begin, l, r);
+    Split(r, End, m, r);
+    std::vector<std::pair<int, Message*> > mails;
+    Collect(m, mails);
+    for (size_t i = 0; i < mails.size(); i++) Removed.push_back(mails[i].second);
+    Destroy(m);
+    /* 右边的序列号整体前移，只在子树根上打标记 */
+    AddShift(r, Begin - End);
+    SetRoot(Merge(l, r));
+}
+
+Message* MailIndex::Nth(int k, int* SeqId) {
+    Node* t = Root;
+    if (k < 0 || k >= SizeOf(t)) return NULL;
+    while (t) {
+        Push(t);
+        int ls = SizeOf(t->L);
+        if (k == ls) {
+            if (SeqId) *SeqId = t->Key;
+            return t->Mail;
+        }
+        if (k < ls) t = t->L;
+        else {
+            k -= ls + 1;
+            t = t->R;
+        }
+    }
+    return NULL;
+}
+
+void MailIndex::Range(int Begin, int End, std::vector<std::pair<int, Message*> >& out) {
+    Node* l, * m, * r;
+    Split(Root, Begin, l, r);
+    Split(r, End, m, r);
+    Collect(m, out);
+    SetRoot(Merge(Merge(l, m), r));
+}
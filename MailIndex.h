@@ -0,0 +1,104 @@
+/*---------------------
+* target: 邮箱内按序列号索引邮件的有序结构
+* -------------------*/
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <unordered_map>
+#include <sys/types.h>
+
+class Message;
+
+/*------------------------------------------------------------------------------
+* class MailIndex
+* 以序列号为键的treap（按键有序的二叉搜索树，同时按随机优先级满足堆性质），
+* 每个节点记录子树大小（顺序统计）以及尚未下推的键偏移量：
+*   1） 抓到的邮件通常只是一部分，序列号不连续，所以仍以序列号为键，而不是按位置隐式编号；
+*   2） EXPUNGE或区间删除后，后面所有邮件的序列号都要前移；这里将树按键分裂为三段，
+*       丢弃中间一段，再给右边整棵子树打上偏移标记后合并，代价为O(log n + 删除数量)，
+*       不必逐个取出重新插入；
+*   3） 偏移标记在访问子节点之前下推，查找、插入和按序遍历的结果都是偏移后的序列号；
+*   4） 节点记录父节点，另有邮件到节点的哈希表；按邮件删除时从节点向上累加祖先上
+*       未下推的偏移得到当前序列号，再按序列号删除，代价为O(log n)
+* ----------------------------------------------------------------------------*/
+class MailIndex {
+    struct Node {
+        int Key;
+        int Shift;          /* 子树中（不含本节点）尚未下推的键偏移 */
+        u_int32_t Prio;
+        int Size;
+        Message* Mail;
+        Node* L, * R, * P;
+    };
+    Node* Root;
+    u_int32_t Seed;
+    /* 邮件所在的节点，同一封邮件出现多次时只记录最后插入的 */
+    std::unordered_map<Message*, Node*> Nodes;
+
+    u_int32_t Random() {
+        /* xorshift，只用来生成优先级 */
+        Seed ^= Seed << 13; Seed ^= Seed >> 17; Seed ^= Seed << 5;
+        return Seed;
+    }
+    static int SizeOf(Node* t) {return t ? t->Size : 0;}
+    static void AddShift(Node* t, int delta) {
+        if (t) {t->Key += delta; t->Shift += delta;}
+    }
+    static void Push(Node* t) {
+        if (t->Shift) {
+            AddShift(t->L, t->Shift);   AddShift(t->R, t->Shift);
+            t->Shift = 0;
+        }
+    }
+    /* 重新计算子树大小，并让子节点指回t；所有改变子节点的操作之后都会调用 */
+    static void Update(Node* t) {
+        t->Size = 1 + SizeOf(t->L) + SizeOf(t->R);
+        if (t->L) t->L->P = t;
+        if (t->R) t->R->P = t;
+    }
+    /* 修改后的树根没有父节点 */
+    void SetRoot(Node* t) {
+        Root = t;
+        if (Root) Root->P = NULL;
+    }
+    /* 丢弃节点t，并删除指向它的邮件记录 */
+    void Drop(Node* t) {
+        std::unordered_map<Message*, Node*>::iterator it = Nodes.find(t->Mail);
+        if (it != Nodes.end() && it->second == t) Nodes.erase(it);
+        delete t;
+    }
+    /* 按键分裂：l中的键都小于key，r中的键都不小于key */
+    static void Split(Node* t, int key, Node*& l, Node*& r);
+    static Node* Merge(Node* l, Node* r);
+    static void Collect(Node* t, std::vector<std::pair<int, Message*> >& out);
+    void Destroy(Node* t);
+
+    MailIndex(const MailIndex&);
+    MailIndex& operator=(const MailIndex&);
+public:
+    MailIndex() : Root(NULL), Seed(2463534242u) {}
+    ~MailIndex() {clear();}
+
+    /* 查找序列号对应的邮件，不存在返回NULL */
+    Message* Find(int SeqId);
+    /* 插入邮件，序列号已存在时不覆盖并返回false（同map::emplace） */
+    bool Insert(int SeqId, Message* Mail);
+    /* 取出单封邮件，后面的序列号不变 */
+    Message* Erase(int SeqId);
+    /* 按邮件指针取出，只在序列号对应关系失效时使用 */
+    bool EraseMail(Message* Mail);
+    /* 取出[Begin, End)内的邮件放入Removed，并将不小于End的序列号全部减去End-Begin */
+    void EraseRange(int Begin, int End, std::vector<Message*>& Removed);
+    /* 第k封（从0开始）存在的邮件，k越界时返回NULL */
+    Message* Nth(int k, int* SeqId = NULL);
+    /* 按序列号从小到大导出[Begin, End)内的邮件 */
+    void Range(int Begin, int End, std::vector<std::pair<int, Message*> >& out);
+    void All(std::vector<std::pair<int, Message*> >& out) {Collect(Root, out);}
+    int size() const {return SizeOf(Root);}
+    /* 每封邮件在索引中占用的字节数 */
+    static size_t NodeBytes() {return sizeof(Node) + sizeof(std::pair<Message* const, Node*>) + 2 * sizeof(void*);}
+    bool empty() const {return Root == NULL;}
+    /* 只释放索引，不释放邮件 */
+    void clear() {Nodes.clear(); Destroy(Root); Root = NULL;}
+};
@@ -0,0 +1,429 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Mime.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MIME_X86
+#endif
+
+/* base64字符的6位值，'='为64，其他字符为0xff */
+#define B64_PAD     64
+#define B64_SKIP    0xff
+static u_int8_t Base64Value[256];
+
+static bool InitTable() {
+    const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    memset(Base64Value, B64_SKIP, sizeof(Base64Value));
+    for (int i = 0; i < 64; i++) Base64Value[(u_int8_t)alphabet[i]] = i;
+    Base64Value[(u_int8_t)'='] = B64_PAD;
+    return true;
+}
+static bool TableReady = InitTable();
+
+/* 从头解码连续的合法字符，每组输入len字节，遇到其他字符（换行、'='等）的一组时停止；
+* 返回处理的输入字节数（len的倍数），输出为其3/4，每组多写出若干字节，调用者保留余量 */
+typedef size_t (*Base64Kernel)(const u_int8_t* in, size_t n, u_int8_t* out);
+/* 连续解码等长的行：每行Width个合法字符（4的倍数，不少于一组），之后是Sep个字节的换行（"\r\n"或"\n"）；
+* 行内最后不足一组的部分与前面重叠再做一组（重解的字节结果相同）；遇到不符合的行时停在该行开头，
+* 返回处理的输入字节数，Produced为输出的字节数 */
+typedef size_t (*Base64LineKernel)(const u_int8_t* in, size_t n, size_t Width, size_t Sep, u_int8_t* out, size_t* Produced);
+
+/* 行尾是否为Sep个字节的换行 */
+static inline bool LineEnd(const u_int8_t* eol, size_t Sep) {
+    return eol[Sep - 1] == '\n' && (Sep == 1 || eol[0] == '\r');
+}
+
+static size_t Base64Scalar(const u_int8_t* in, size_t n, u_int8_t* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4, out += 3) {
+        u_int32_t a = Base64Value[in[i]], b = Base64Value[in[i + 1]];
+        u_int32_t c = Base64Value[in[i + 2]], d = Base64Value[in[i + 3]];
+        if ((a | b | c | d) >= B64_PAD) break;
+        u_int32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = v >> 16;   out[1] = v >> 8;    out[2] = v;
+    }
+    return i;
+}
+
+static size_t LinesScalar(const u_int8_t* in, size_t n, size_t Width, size_t Sep, u_int8_t* out, size_t* Produced) {
+    size_t i = 0, o = 0;
+    for (; i + Width + Sep <= n && LineEnd(in + i + Width, Sep); i += Width + Sep, o += Width / 4 * 3)
+        if (Base64Scalar(in + i, Width, out + o) != Width) break;
+    *Produced = o;
+    return i;
+}
+
+#ifdef MIME_X86
+/* 参考Muła和Lemire的方法：按高低半字节查表检查合法性，按高半字节（'/'单独处理）加上偏移得到6位值，
+* 再用乘加把每4个6位值合并为3个字节；一组不合法时不写出，返回false */
+__attribute__((target("ssse3"), always_inline))
+static inline bool BlockSSSE3(const u_int8_t* in, u_int8_t* out) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    __m128i v = _mm_loadu_si128((const __m128i*)in);
+    __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(v, 4), mask_2f);
+    __m128i lo_nibbles = _mm_and_si128(v, mask_2f);
+    __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0xffff) return false;
+    __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask_2f), hi_nibbles));
+    v = _mm_add_epi8(v, roll);
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(v, pack));
+    return true;
+}
+
+__attribute__((target("ssse3")))
+static size_t Base64SSSE3(const u_int8_t* in, size_t n, u_int8_t* out) {
+    size_t i = 0;
+    for (; i + 16 <= n && BlockSSSE3(in + i, out); i += 16, out += 12) ;
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t LinesSSSE3(const u_int8_t* in, size_t n, size_t Width, size_t Sep, u_int8_t* out, size_t* Produced) {
+    size_t i = 0, o = 0;
+    for (; i + Width + Sep <= n && LineEnd(in + i + Width, Sep); i += Width + Sep, o += Width / 4 * 3) {
+        size_t j = 0;
+        for (; j + 16 <= Width && BlockSSSE3(in + i + j, out + o + j / 4 * 3); j += 16) ;
+        if (j < Width && (j + 16 <= Width || BlockSSSE3(in + i + Width - 16, out + o + (Width - 16) / 4 * 3) == false)) break;
+    }
+    *Produced = o;
+    return i;
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline bool BlockAVX2(const u_int8_t* in, u_int8_t* out) {
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    /* 两个128位通道各得到12字节，移到一起 */
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+    __m256i v = _mm256_loadu_si256((const __m256i*)in);
+    __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask_2f);
+    __m256i lo_nibbles = _mm256_and_si256(v, mask_2f);
+    __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+    __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+    if (!_mm256_testz_si256(lo, hi)) return false;
+    __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, mask_2f), hi_nibbles));
+    v = _mm256_add_epi8(v, roll);
+    v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+    v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+    v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack), lanes);
+    _mm256_storeu_si256((__m256i*)out, v);
+    return true;
+}
+
+__attribute__((target("avx2")))
+static size_t Base64AVX2(const u_int8_t* in, size_t n, u_int8_t* out) {
+    size_t i = 0;
+    for (; i + 32 <= n && BlockAVX2(in + i, out); i += 32, out += 24) ;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t LinesAVX2(const u_int8_t* in, size_t n, size_t Width, size_t Sep, u_int8_t* out, size_t* Produced) {
+    size_t i = 0, o = 0;
+    for (; i + Width + Sep <= n && LineEnd(in + i + Width, Sep); i += Width + Sep, o += Width / 4 * 3) {
+        size_t j = 0;
+        for (; j + 32 <= Width && BlockAVX2(in + i + j, out + o + j / 4 * 3); j += 32) ;
+        if (j < Width && (j + 32 <= Width || BlockAVX2(in + i + Width - 32, out + o + (Width - 32) / 4 * 3) == false)) break;
+    }
+    *Produced = o;
+    return i;
+}
+#endif
+
+/* 运行时选择实现，只在第一次使用时判断一次 */
+struct Base64Impl {
+    const char* Name;
+    size_t Block;           /* 每组的输入字节数 */
+    Base64Kernel Run;
+    Base64LineKernel Lines;
+};
+
+static Base64Impl ChooseKernel() {
+#ifdef MIME_X86
+    /* 环境变量IMAP_BASE64可以限制使用较低的实现，供测试比较各实现 */
+    const char* limit = getenv("IMAP_BASE64");
+    int level = limit == NULL ? 2 : (strcmp(limit, "avx2") == 0 ? 2 : (strcmp(limit, "ssse3") == 0 ? 1 : 0));
+    __builtin_cpu_init();
+    if (level >= 2 && __builtin_cpu_supports("avx2")) return Base64Impl{"avx2", 32, Base64AVX2, LinesAVX2};
+    if (level >= 1 && __builtin_cpu_supports("ssse3")) return Base64Impl{"ssse3", 16, Base64SSSE3, LinesSSSE3};
+#endif
+    return Base64Impl{"scalar", 4, Base64Scalar, LinesScalar};
+}
+
+static const Base64Impl Kernel = ChooseKernel();
+
+const char* Base64KernelName() {
+    return Kernel.Name;
+}
+
+/* 解码一段编码，状态（未满一个字节的位）可以跨段保留；先用向量实现，停下的一组逐个字符处理：
+* 跳过非法字符（包括换行），遇到'='时返回true */
+static bool DecodeRun(const u_int8_t* in, size_t n, u_int8_t* out, size_t& o, u_int32_t& acc, int& bits) {
+    size_t i = 0;
+    while (i < n) {
+        if (bits == 0) {
+            size_t done = Kernel.Run(in + i, n - i, out + o);
+            i += done;
+            o += done / 4 * 3;
+            if (i >= n) break;
+        }
+        size_t stop = i + 32 < n ? i + 32 : n;
+        for (; i < n && (i < stop || bits); i++) {
+            u_int8_t v = Base64Value[in[i]];
+            if (v == B64_SKIP) continue;
+            if (v == B64_PAD) return true;
+            acc = (acc << 6) | v;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                out[o++] = acc >> bits;
+            }
+            if (bits == 0) acc = 0;
+        }
+    }
+    return false;
+}
+
+void DecodeBase64(const char* Data, size_t Len, std::string& Out) {
+    /* 不先复制去掉换行：按第一行的宽度把之后等长的各行交给向量实现连续解码（行内换行的跳过在
+    * 向量循环中完成）；不等长的行（一般只有最后一行）、含有'='或其他字符的行逐行交给DecodeRun */
+    size_t base = Out.size();
+    /* 向量实现每组多写出8个字节 */
+    Out.resize(base + Len / 4 * 3 + 32);
+    u_int8_t* out = (u_int8_t*)&Out[base];
+    size_t o = 0;
+    u_int32_t acc = 0;
+    int bits = 0;
+    const u_int8_t* p = (const u_int8_t*)Data, * end = p + Len;
+    while (p < end) {
+        const u_int8_t* eol = (const u_int8_t*)memchr(p, '\n', end - p);
+        const u_int8_t* stop = eol ? eol : end;
+        size_t n = stop - p;
+        if (n && stop[-1] == '\r') n--;
+        if (eol && bits == 0 && n % 4 == 0 && n >= Kernel.Block) {
+            size_t produced, done = Kernel.Lines(p, end - p, n, stop + 1 - p - n, out + o, &produced);
+            p += done;
+            o += produced;
+            if (done) continue;
+        }
+        if (DecodeRun(p, n, out, o, acc, bits)) break;
+        p = eol ? eol + 1 : end;
+    }
+    Out.resize(base + o);
+}
+
+static inline int HexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+void DecodeQP(const char* Data, size_t Len, std::string& Out) {
+    /* 解码结果不会比原文长，一次分配后直接写入 */
+    size_t base = Out.size();
+    Out.resize(base + Len);
+    char* out = &Out[base], * o = out;
+    const char* p = Data, * end = Data + Len;
+    while (p < end) {
+        const char* eq = (const char*)memchr(p, '=', end - p);
+        if (eq == NULL) eq = end;
+        memcpy(o, p, eq - p);
+        o += eq - p;
+        if (eq == end) break;
+        p = eq + 1;
+        int hi, lo;
+        /* 软换行：=\r\n或=\n */
+        if (p < end && *p == '\n') p++;
+        else if (p + 1 < end && p[0] == '\r' && p[1] == '\n') p += 2;
+        else if (p + 1 < end && (hi = HexValue(p[0])) >= 0 && (lo = HexValue(p[1])) >= 0) {
+            *o++ = (char)(hi << 4 | lo);
+            p += 2;
+        } else *o++ = '=';
+    }
+    Out.resize(o - out + base);
+}
+
+static std::string Lower(const char* p, size_t n) {
+    std::string s(p, n);
+    for (size_t i = 0; i < n; i++)
+        if (s[i] >= 'A' && s[i] <= 'Z') s[i] += 'a' - 'A';
+    return s;
+}
+
+/* 取出首部字段参数的值，如Content-Type中的boundary，去掉引号 */
+static std::string Param(const std::string& Value, const char* Name) {
+    std::string lower = Lower(Value.data(), Value.size());
+    size_t len = strlen(Name), pos = 0;
+    while ((pos = lower.find(Name, pos)) != std::string::npos) {
+        size_t b = pos + len;
+        bool start = pos == 0 || lower[pos - 1] == ';' || lower[pos - 1] == ' ' || lower[pos - 1] == '\t';
+        while (b < lower.size() && (lower[b] == ' ' || lower[b] == '\t')) b++;
+        pos += len;
+        if (start == false || b >= lower.size() || lower[b] != '=') continue;
+        b++;
+        while (b < Value.size() && (Value[b] == ' ' || Value[b] == '\t')) b++;
+        if (b < Value.size() && Value[b] == '"') {
+            size_t e = Value.find('"', b + 1);
+            return Value.substr(b + 1, e == std::string::npos ? std::string::npos : e - b - 1);
+        }
+        size_t e = b;
+        while (e < Value.size() && Value[e] != ';' && Value[e] != ' ' && Value[e] != '\t' && Value[e] != '\r') e++;
+        return Value.substr(b, e - b);
+    }
+    return std::string();
+}
+
+/* 找到首部和正文的分界（第一个空行），返回正文的起点 */
+static size_t BodyStart(const char* Data, size_t Len) {
+    /* 没有首部的部分以空行开头 */
+    if (Len > 0 && Data[0] == '\n') return 1;
+    if (Len > 1 && Data[0] == '\r' && Data[1] == '\n') return 2;
+    for (size_t i = 0; i < Len; i++) {
+        if (Data[i] != '\n') continue;
+        if (i + 1 < Len && Data[i + 1] == '\n') return i + 2;
+        if (i + 2 < Len && Data[i + 1] == '\r' && Data[i + 2] == '\n') return i + 3;
+    }
+    return Len;
+}
+
+/* 解析一个部分的首部，取出类型、编码、名字以及multipart的boundary */
+static void ParseHeader(const char* Data, size_t Len, MimePart& Part, std::string& Boundary) {
+    size_t pos = 0;
+    while (pos < Len) {
+        size_t eol = pos;
+        std::string line;
+        /* 折行展开 */
+        do {
+            const char* nl = (const char*)memchr(Data + eol, '\n', Len - eol);
+            size_t e = nl ? nl - Data : Len;
+            line.append(Data + eol, e - eol);
+            eol = e + 1;
+        } while (eol < Len && (Data[eol] == ' ' || Data[eol] == '\t'));
+        pos = eol;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        std::string name = Lower(line.data(), colon);
+        size_t b = colon + 1, e = line.size();
+        while (b < e && (line[b] == ' ' || line[b] == '\t')) b++;
+        while (e > b && (line[e - 1] == '\r' || line[e - 1] == ' ' || line[e - 1] == '\t')) e--;
+        std::string value = line.substr(b, e - b);
+        if (name == "content-type") {
+            size_t semi = value.find(';');
+            Part.Type = Lower(value.data(), semi == std::string::npos ? value.size() : semi);
+            while (Part.Type.size() && (Part.Type.back() == ' ' || Part.Type.back() == '\t')) Part.Type.pop_back();
+            Boundary = Param(value, "boundary");
+            if (Part.Name.empty()) Part.Name = Param(value, "name");
+        } else if (name == "content-transfer-encoding") {
+            Part.Encoding = Lower(value.data(), value.size());
+        } else if (name == "content-disposition") {
+            std::string file = Param(value, "filename");
+            if (file.size()) Part.Name = file;
+        }
+    }
+}
+
+static void SplitPart(const char* Data, size_t Len, const std::string& Known, int Depth, std::vector<MimePart>& Parts) {
+    MimePart part;
+    std::string boundary;
+    /* 只取得了正文（BODY[TEXT]）时直接从分隔行开始，没有首部 */
+    bool bare = Known.size() && Len >= Known.size() + 2 && memcmp(Data, "--", 2) == 0
+                && memcmp(Data + 2, Known.data(), Known.size()) == 0;
+    size_t body = bare ? 0 : BodyStart(Data, Len);
+    ParseHeader(Data, body, part, boundary);
+    if (boundary.empty() && (part.Type.empty() || part.Type.compare(0, 10, "multipart/") == 0)) boundary = Known;
+    part.Data = Data + body;
+    part.Len = Len - body;
+    if (boundary.empty() || Depth >= MIME_MAX_DEPTH || (part.Type.size() && part.Type.compare(0, 10, "multipart/"))) {
+        Parts.push_back(part);
+        return;
+    }
+    /* 按行首的--boundary切分，--boundary--结束 */
+    std::string delim = "--" + boundary;
+    const char* p = part.Data, * end = part.Data + part.Len, * start = NULL;
+    while (p < end) {
+        const char* hit = (const char*)memmem(p, end - p, delim.data(), delim.size());
+        if (hit == NULL) break;
+        p = hit + delim.size();
+        if (hit != part.Data && hit[-1] != '\n') continue;
+        if (start) {
+            /* 分隔行之前的换行属于分隔行 */
+            const char* last = hit;
+            if (last > start && last[-1] == '\n') last--;
+            if (last > start && last[-1] == '\r') last--;
+            SplitPart(start, last - start, std::string(), Depth + 1, Parts);
+        }
+        if (p + 1 < end && p[0] == '-' && p[1] == '-') return;
+        const char* nl = (const char*)memchr(p, '\n', end - p);
+        if (nl == NULL) return;
+        start = p = nl + 1;
+    }
+    /* 没有结束分隔行（内容不完整）时保留最后一部分 */
+    if (start && start < end) SplitPart(start, end - start, std::string(), Depth + 1, Parts);
+    else if (start == NULL) Parts.push_back(part);
+}
+
+size_t SplitMime(const char* Data, size_t Len, const std::string& Boundary, std::vector<MimePart>& Parts) {
+    size_t before = Parts.size();
+    SplitPart(Data, Len, Boundary, 0, Parts);
+    return Parts.size() - before;
+}
+
+/* 附件名只保留安全的字符，避免写到其他目录 */
+static std::string SafeName(const std::string& Name) {
+    std::string s;
+    for (size_t i = 0; i < Name.size() && s.size() < MIME_NAME_MAX; i++) {
+        unsigned char c = Name[i];
+        if (c == '/' || c == '\\' || c < 0x20 || (c == '.' && s.empty())) s.push_back('_');
+        else s.push_back(c);
+    }
+    return s;
+}
+
+int SaveMimeParts(const std::string& Text, const std::string& Boundary, const std::string& Base) {
+    std::vector<MimePart> parts;
+    SplitMime(Text.data(), Text.size(), Boundary, parts);
+    std::string decoded;
+    int saved = 0;
+    for (size_t i = 0; i < parts.size(); i++) {
+        const MimePart& part = parts[i];
+        bool b64 = part.Encoding == "base64", qp = part.Encoding == "quoted-printable";
+        if (b64 == false && qp == false && part.Name.empty()) continue;
+        decoded.clear();
+        if (b64) DecodeBase64(part.Data, part.Len, decoded);
+        else if (qp) DecodeQP(part.Data, part.Len, decoded);
+        else decoded.assign(part.Data, part.Len);
+        std::string file = Base + "." + std::to_string(i + 1);
+        if (part.Name.size()) file += "-" + SafeName(part.Name);
+        else if (part.Type == "text/html") file += ".html";
+        else if (part.Type.empty() || part.Type.compare(0, 5, "text/") == 0) file += ".txt";
+        else file += ".bin";
+        FILE* out = fopen(file.c_str(), "wb");
+        if (out == NULL) return -1;
+        bool ok = fwrite(decoded.data(), 1, decoded.size(), out) == decoded.size();
+        if (fclose(out) != 0 || ok == false) return -1;
+        saved++;
+    }
+    return saved;
+}
@@ -0,0 +1,38 @@
+/*---------------------
+* target: MIME结构的拆分以及base64、quoted-printable的向量化解码
+* -------------------*/
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+
+/* multipart嵌套的最大层数，更深的部分作为一个整体 */
+#define MIME_MAX_DEPTH  8
+/* 部分文件名中取自附件名的最大长度 */
+#define MIME_NAME_MAX   100
+
+/* 一个叶子部分，Data指向原文中未解码的内容 */
+struct MimePart {
+    std::string Type;       /* Content-Type的类型（小写），没有时为空 */
+    std::string Encoding;   /* Content-Transfer-Encoding（小写） */
+    std::string Name;       /* Content-Disposition的filename或Content-Type的name */
+    const char* Data;
+    size_t Len;
+};
+
+/* 解码base64，跳过空白等非base64字符，遇到'='结束，结果追加到Out；
+* 按CPU选择AVX2（32字节一组）、SSSE3（16字节一组）或查表的实现；等长的各行（如76字符）连同换行在向量循环中
+* 直接解码，不先复制去掉换行，其余的行（长度不同、含有'='或其他字符）逐行处理 */
+void DecodeBase64(const char* Data, size_t Len, std::string& Out);
+/* 解码quoted-printable（=XX和软换行），结果追加到Out；'='之间的部分用memchr/memcpy整段复制 */
+void DecodeQP(const char* Data, size_t Len, std::string& Out);
+/* 当前使用的base64实现名称："avx2"、"ssse3"或"scalar"；环境变量IMAP_BASE64设为其中之一时不使用更高的实现 */
+const char* Base64KernelName();
+
+/* 按MIME结构把邮件（首部和正文）拆分为叶子部分；Boundary为已知的最外层boundary
+* （Message中的bound），首部中没有时使用；返回叶子部分的个数 */
+size_t SplitMime(const char* Data, size_t Len, const std::string& Boundary, std::vector<MimePart>& Parts);
+/* 把需要解码（base64、quoted-printable）或有附件名的部分解码后保存为Base.序号-附件名，
+* 没有附件名时按类型使用.txt、.html或.bin；返回保存的部分数，写入失败返回-1 */
+int SaveMimeParts(const std::string& Text, const std::string& Boundary, const std::string& Base);
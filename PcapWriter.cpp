@@ -0,0 +1,164 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include "PcapWriter.h"
+
+PcapWriter::PcapWriter(const char* FileName, const pcap_file_header& Header) : Buf(WRITE_BUFFER_SIZE) {
+    /* "-"表示写到标准输出 */
+    if (strcmp(FileName, "-") == 0) Fd = dup(STDOUT_FILENO);
+    else Fd = open(FileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (Fd < 0) throw(FILE_OPEN_ERR);
+    Records = 0;    Failed = false;
+    memcpy(Buf.data(), &Header, sizeof(Header));
+    Used = Pos = sizeof(Header);
+}
+
+PcapWriter::~PcapWriter() {
+    Close();
+}
+
+void PcapWriter::Flush() {
+    size_t done = 0;
+    while (done < Used && Failed == false) {
+        ssize_t n = write(Fd, Buf.data() + done, Used - done);
+        if (n <= 0) Failed = true;
+        else done += n;
+    }
+    Used = 0;
+}
+
+u_int64_t PcapWriter::Write(const pcap_pkthdr& Header, const u_int8* Data) {
+    u_int64_t at = Pos;
+    size_t len = 16 + Header.caplen;
+    if (Used + len > Buf.size()) Flush();
+    /* 比缓冲区还大的记录直接写出 */
+    if (len > Buf.size()) Buf.resize(len);
+    memcpy(Buf.data() + Used, &Header, 16);
+    memcpy(Buf.data() + Used + 16, Data, Header.caplen);
+    Used += len;
+    Pos += len;
+    Records++;
+    return at;
+}
+
+int PcapWriter::Close() {
+    if (Fd < 0) return Failed ? NO : OK;
+    Flush();
+    if (close(Fd) != 0) Failed = true;
+    Fd = -1;
+    return Failed ? NO : OK;
+}
+
+void FlowIndex::Add(const sock& Key, u_int64_t Offset, int64_t Time) {
+    std::map<sock, FlowRecord>::iterator it = Flows.find(Key);
+    if (it == Flows.end()) {
+        it = Flows.emplace(Key, FlowRecord()).first;
+        it->second.First = Time;
+    }
+    it->second.Last = Time;
+    it->second.Offsets.push_back(Offset);
+}
+
+static void PutVarint(std::string& out, u_int64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+int FlowIndex::Save(const char* FileName) const {
+    FILE* out = fopen(FileName, "wb");
+    if (out == NULL) return NO;
+    std::string buf(INDEX_MAGIC);
+    bool ok = true;
+    PutVarint(buf, Flows.size());
+    for (std::map<sock, FlowRecord>::const_iterator it = Flows.begin(); it != Flows.end() && ok; it++) {
+        const sock& key = it->first;
+        const FlowRecord& rec = it->second;
+        buf.append((const char*)&key.IP_fir, 4);
+        buf.append((const char*)&key.IP_sec, 4);
+        buf.append((const char*)&key.Port_fir, 2);
+        buf.append((const char*)&key.Port_sec, 2);
+        PutVarint(buf, rec.First);
+        PutVarint(buf, rec.Last);
+        PutVarint(buf, rec.User.size());
+        buf += rec.User;
+        PutVarint(buf, rec.Offsets.size());
+        u_int64_t prev = 0;
+        for (size_t i = 0; i < rec.Offsets.size(); i++) {
+            PutVarint(buf, rec.Offsets[i] - prev);
+            prev = rec.Offsets[i];
+        }
+        /* 分批写出，编码的缓冲区不超过WRITE_BUFFER_SIZE */
+        if (buf.size() >= WRITE_BUFFER_SIZE) {
+            ok = fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+            buf.clear();
+        }
+    }
+    ok = ok && fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+    return fclose(out) == 0 && ok ? OK : NO;
+}
+
+static bool GetVarint(FILE* in, u_int64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if (c == EOF) return false;
+        v |= (u_int64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+int FlowIndex::Load(const char* FileName) {
+    FILE* in = fopen(FileName, "rb");
+    if (in == NULL) return NO;
+    setvbuf(in, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+    Flows.clear();
+    char magic[8];
+    u_int64_t count, v;
+    bool ok = fread(magic, 1, 8, in) == 8 && memcmp(magic, INDEX_MAGIC, 8) == 0 && GetVarint(in, count);
+    for (u_int64_t i = 0; ok && i < count; i++) {
+        sock key(0, 0, 0, 0);
+        FlowRecord rec;
+        u_int64_t first, last, len, packets;
+        ok = fread(&key.IP_fir, 4, 1, in) == 1 && fread(&key.IP_sec, 4, 1, in) == 1
+             && fread(&key.Port_fir, 2, 1, in) == 1 && fread(&key.Port_sec, 2, 1, in) == 1
+             && GetVarint(in, first) && GetVarint(in, last) && GetVarint(in, len) && len < 65536;
+        if (ok == false) break;
+        rec.First = first;  rec.Last = last;
+        rec.User.resize(len);
+        ok = (len == 0 || fread(&rec.User[0], 1, len, in) == len) && GetVarint(in, packets);
+        u_int64_t pos = 0;
+        for (u_int64_t j = 0; ok && j < packets; j++) {
+            ok = GetVarint(in, v);
+            pos += v;
+            rec.Offsets.push_back(pos);
+        }
+        if (ok) Flows.emplace(key, std::move(rec));
+    }
+    fclose(in);
+    if (ok == false) Flows.clear();
+    return ok ? OK : NO;
+}
+
+size_t FlowIndex::Select(const char* User, u_int32 ClientIP, u_int16 ClientPort, std::vector<u_int64_t>& Offsets) const {
+    size_t selected = 0;
+    for (std::map<sock, FlowRecord>::const_iterator it = Flows.begin(); it != Flows.end(); it++) {
+        const sock& key = it->first;
+        if (User && it->second.User != User) continue;
+        if (ClientIP || ClientPort) {
+            /* 服务器端口为143，另一端即为客户端 */
+            bool fir = ntohs(key.Port_fir) != IMAP_PORT;
+            u_int32 ip = ntohl(fir ? key.IP_fir : key.IP_sec);
+            u_int16 port = ntohs(fir ? key.Port_fir : key.Port_sec);
+            if ((ClientIP && ip != ClientIP) || (ClientPort && port != ClientPort)) continue;
+        }
+        Offsets.insert(Offsets.end(), it->second.Offsets.begin(), it->second.Offsets.end());
+        selected++;
+    }
+    /* 各会话内已经有序，合并后整体排序，使重新处理时只向后移动 */
+    std::sort(Offsets.begin(), Offsets.end());
+    return selected;
+}
@@ -0,0 +1,70 @@
+/*---------------------
+* target: 顺序写出pcap文件，以及按会话记录数据包位置的索引
+* -------------------*/
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+#include "PeelHeader.h"
+
+/* 写缓冲区的大小，缓冲区满时一次写出 */
+#define WRITE_BUFFER_SIZE   (4 << 20)
+/* 索引文件开头的魔数 */
+#define INDEX_MAGIC         "IMAPIDX1"
+
+/*------------------------------------------------------------------------------
+* class PcapWriter
+* 写出普通（不压缩）的pcap文件，文件头由调用者给出（通常复制自输入文件）；
+* 数据先复制到大块缓冲区中，满了才调用write，得到大块的顺序写；文件名为"-"时写到标准输出；打开失败抛出FILE_OPEN_ERR
+* ----------------------------------------------------------------------------*/
+class PcapWriter {
+    int Fd;
+    std::vector<char> Buf;
+    size_t Used;
+    /* Pos为下一个记录在文件中的偏移，Records为已写入的记录数 */
+    u_int64_t Pos, Records;
+    bool Failed;
+
+    void Flush();
+    PcapWriter(const PcapWriter&);
+    PcapWriter& operator=(const PcapWriter&);
+public:
+    PcapWriter(const char* FileName, const pcap_file_header& Header);
+    ~PcapWriter();
+    /* 追加一个记录，返回记录（含16字节记录头）在文件中的偏移 */
+    u_int64_t Write(const pcap_pkthdr& Header, const u_int8* Data);
+    u_int64_t Offset() const {return Pos;}
+    u_int64_t size() const {return Records;}
+    /* 写出剩余数据并关闭文件，写入出错时返回NO */
+    int Close();
+};
+
+/*------------------------------------------------------------------------------
+* class FlowIndex
+* 按会话（sock）记录各数据包记录在pcap文件中的偏移，以及首末数据包的时间（微秒）；
+* 文件格式：魔数，会话数，之后每个会话为四元组（网络字节序，同sock）、首末时间、用户名、
+* 数据包数以及各偏移与前一个偏移的差；除四元组外的整数均为varint；
+* 处理会话时建立的索引（main -X）偏移指向输入文件并记录用户名，抽取时建立的（-x -X）指向抽取出的文件，
+* 没有用户名；按索引重新处理（Package::Replay）时应使用对应的文件
+* ----------------------------------------------------------------------------*/
+struct FlowRecord {
+    int64_t First, Last;
+    std::string User;
+    std::vector<u_int64_t> Offsets;
+};
+
+class FlowIndex {
+    std::map<sock, FlowRecord> Flows;
+public:
+    /* Offsets按添加的顺序保存，调用者应按文件顺序添加 */
+    void Add(const sock& Key, u_int64_t Offset, int64_t Time);
+    std::map<sock, FlowRecord>& GetFlows() {return Flows;}
+    size_t size() const {return Flows.size();}
+    /* 写入出错时返回NO */
+    int Save(const char* FileName) const;
+    /* 读入索引（替换已有内容），文件不存在或格式错误时返回NO */
+    int Load(const char* FileName);
+    /* 选出用户为User（NULL表示不限）并且客户端为ClientIP:ClientPort（主机字节序，0表示不限）的会话，
+    * 各数据包的偏移按文件顺序合并到Offsets，返回选中的会话数 */
+    size_t Select(const char* User, u_int32 ClientIP, u_int16 ClientPort, std::vector<u_int64_t>& Offsets) const;
+};
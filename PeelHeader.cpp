@@ -1,4 +1,6 @@
 #include "PeelHeader.h"
+#include "Profile.h"
+#include "PcapWriter.h"
 
 sock::sock(u_int32 FIP, u_int32 SIP, u_int16 FPort, u_int16 SPort) {
     /* 保证小端口在前，维持顺序，一个sock结构唯一确定一个会话 */
@@ -24,106 +26,296 @@ bool sock::operator==(const sock& obj) const {
     return ((IP_fir == obj.IP_fir) && (IP_sec == obj.IP_sec) && (Port_fir == obj.Port_fir) && (Port_sec == obj.Port_sec));
 }
 
-Package::Package(const char* FileName) {
-    if((InputFile = fopen(FileName, "r")) == NULL)  throw(FILE_OPEN_ERR);
-    if(fread(&FileHeader, sizeof(pcap_file_header), 1, InputFile) != 1) throw(NO_PCAP);
+/* 会话编号在所有引擎（实时抓包的各线程）之间共用，保证唯一 */
+static std::atomic<u_int64_t> NextFlowId(1);
+
+ImapEngine::ImapEngine(int LinkType) {
+    if (SetLinkType(LinkType) != OK) throw(NO_PCAP);
+    Listener = NULL;
+    SaveOnClose = true;
+    Store = NULL;
+    Checkpoint = NULL;
+}
+
+ImapEngine::~ImapEngine() {
+    CloseAll();
+}
 
+int ImapEngine::SetLinkType(int LinkType) {
     /* 计算当前数据链路帧首部的长度 */
-    switch (FileHeader.linktype)
+    switch (LinkType)
     {
     case ETHERNET:
-        /* code */
         LinkLen = ETHER_HEAD;
         break;
     case LINUXCOOKED:
         LinkLen = LINUX_COOKED_CAPTURE_HEAD;
         break;
+    default:
+        return NO;
     }
-    CurPos = 24;
+    return OK;
 }
 
-Package::~Package() {
-    fclose(InputFile);
+void ImapEngine::CloseAll() {
+    /* 没有等到FIN/RST而被强制结束的会话计为淘汰 */
     for (std::map<sock, Session*>::iterator it = sessions.begin(); it != sessions.end(); it++) {
         delete it->second;
+        GStats.SessionsClosed++;
+        GStats.SessionsEvicted++;
     }
+    sessions.clear();
 }
 
-int Package::GetData() {
-    pcap_pkthdr*    DataHeader = new pcap_pkthdr;
-    IPHeader_t*     IpHeader = new IPHeader_t;
-    TCPHeader_t*    TcpHeader = new TCPHeader_t;
-    char DataTime[STR_SIZE];
-    char src_ip[30], dst_ip[30];
-    std::string MailBuff;
-    int src_port, dst_port;
+std::string ImapEngine::GetUserName(const sock& Key) const {
+    std::map<sock, Session*>::const_iterator it = sessions.find(Key);
+    return it == sessions.end() ? std::string() : it->second->GetUserName();
+}
 
-    /* 先调整文件指针到下一个数据的起始位置 */
-    /* 如果已经到了文件末尾，返回读取失败 */
-    while (fseek(InputFile, CurPos, SEEK_SET) == 0) {
-        memset(DataHeader, 0, sizeof((void*)DataHeader));
-        memset(IpHeader, 0, sizeof((void*)IpHeader));
-        memset(TcpHeader, 0, sizeof((void*)TcpHeader));
-        MailBuff.clear();
-
-        if(fread(DataHeader, 16, 1, InputFile) != 1) {
-            printf("Analysis has been finished!\n");
-            break;
-        }
+void ImapEngine::Measure(MemReport& report) {
+    for (std::map<sock, Session*>::iterator it = sessions.begin(); it != sessions.end(); it++)
+        it->second->Measure(report);
+}
 
-        /* 计算下一个数据包的偏移值 */
-        CurPos += (16 + DataHeader->caplen);
-        /* 读取pcap包时间戳，转换成标准格式时间 */
-        struct tm *timeinfo;
-        time_t t = (time_t)(DataHeader->ts.tv_sec);
-        timeinfo = localtime(&t);
-        strftime(DataTime, sizeof(DataTime), "%Y-%m-%d %H:%M:%S", timeinfo);
-        //printf("%s: ", DataTime);
+int ImapEngine::Decode(const u_int8* Frame, u_int32 CapLen, FrameInfo& Info) {
+    IPHeader_t      IpHeader;
+    TCPHeader_t     TcpHeader;
+    int src_port, dst_port;
+    /* 被过滤的数据包在返回时结束计时 */
+    StageTimer decode(STAGE_DECODE);
 
-        /* 忽略数据帧头 */
-        fseek(InputFile, LinkLen, SEEK_CUR); /* 忽略数据帧头 */
+    Info.TcpFlags = 0;
+    /* 忽略数据帧头 */
+    u_int32 off = LinkLen;
+    if(off + sizeof(IPHeader_t) > CapLen) {
+        GStats.Truncated++;
+        return NO;
+    }
+    memcpy(&IpHeader, Frame + off, sizeof(IPHeader_t));
+    if(IpHeader.Protocol != 6) {
+        /* 不是TCP，直接跳过 */
+        GStats.NotTcp++;
+        return NO;
+    }
+    /* 按首部中的长度字段跳过IP首部和TCP首部（含选项） */
+    off += (IpHeader.Ver_HLen & 0x0f) * 4;
+    if(off + sizeof(TCPHeader_t) > CapLen) {
+        GStats.Truncated++;
+        return NO;
+    }
+    memcpy(&TcpHeader, Frame + off, sizeof(TCPHeader_t));
+    /* 注意网络字节序和电脑字节序相反，先转换后比较 */
+    src_port = ntohs(TcpHeader.SrcPort);
+    dst_port = ntohs(TcpHeader.DstPort);
+    if(dst_port != IMAP_PORT && src_port != IMAP_PORT) {
+        GStats.NotImap++;
+        return NO;
+    }
+    /* 控制包不交给会话，但保留四元组和标志，供EndFlow结束会话 */
+    Info.SrcIP = ntohl(IpHeader.SrcIP);
+    Info.DstIP = ntohl(IpHeader.DstIP);
+    Info.SrcPort = src_port;
+    Info.DstPort = dst_port;
+    Info.TcpFlags = TcpHeader.Flags;
+    if((TcpHeader.Flags)&(u_int8)(TCP_FIN | TCP_SYN)) {
+        GStats.Control++;
+        return NO;
+    }
 
-        if(fread(IpHeader, sizeof(IPHeader_t), 1, InputFile) != 1) {
-            break;
-        }
-        inet_ntop(AF_INET, (void *)&(IpHeader->SrcIP), src_ip, 16);
-        inet_ntop(AF_INET, (void *)&(IpHeader->DstIP), dst_ip, 16);
-        //printf("SourIP: %s, DestIP: %s, Protocol: %d\n", src_ip, dst_ip, IpHeader->Protocol);
-        if(IpHeader->Protocol != 6) {
-            /* 不是TCP，直接跳过 */
-            continue;
-        }
+    u_int32 HeadLen = (IpHeader.Ver_HLen & 0x0f) * 4 + (TcpHeader.HeaderLen >> 4) * 4;
+    int TcpLen = ntohs(IpHeader.TotalLen) - HeadLen;
+    off += (TcpHeader.HeaderLen >> 4) * 4;
+    /* 抓包长度可能小于实际长度，只取实际抓到的部分 */
+    if(off + TcpLen > CapLen) TcpLen = CapLen > off ? CapLen - off : 0;
+    if(TcpLen <= 0) {
+        GStats.Empty++;
+        return NO;
+    }
+    Info.Seq = ntohl(TcpHeader.SeqNO);
+    Info.PayloadOff = off;
+    Info.PayloadLen = TcpLen;
+    return OK;
+}
 
-        if(fread(TcpHeader, sizeof(TCPHeader_t), 1, InputFile) != 1) {
-            break;
-        }
-        /* 注意网络字节序和电脑字节序相反，先转换后比较 */
-        src_port = ntohs(TcpHeader->SrcPort);
-        dst_port = ntohs(TcpHeader->DstPort);
-        //printf("SourPort: %d, DestPort: %d\n", src_port, dst_port);
-        if((dst_port != 143 && src_port != 143) || (TcpHeader->Flags)&(u_int8)3) continue;
-
-        int TcpLen = ntohs(IpHeader->TotalLen) - 40;
-        if(TcpLen == 0) continue ;
-        char tmp;
-        for (int i = 0; i < TcpLen && (tmp = fgetc(InputFile)) != EOF; i++)
-            MailBuff.push_back(tmp);
-        AppendDataForSession(sock(IpHeader->SrcIP, IpHeader->DstIP, TcpHeader->SrcPort, TcpHeader->DstPort), MailBuff, htonl(TcpHeader->SeqNO), (src_port == 143?SERVER:CLIENT));
-    }
-
-    delete DataHeader;
-    delete IpHeader;
-    delete TcpHeader;
+int ImapEngine::EndFlow(const FrameInfo& Info) {
+    if ((Info.TcpFlags & (TCP_FIN | TCP_RST)) == 0) return NO;
+    std::map<sock, Session*>::iterator it = sessions.find(Info.Key());
+    if (it == sessions.end()) return NO;
+    /* RST立即结束；FIN只结束一个方向，另一方向仍可能有数据 */
+    if ((Info.TcpFlags & TCP_RST) == 0 && it->second->EndDirection(Info.SrcPort == IMAP_PORT ? SERVER : CLIENT) == false)
+        return NO;
+    delete it->second;
+    sessions.erase(it);
+    GStats.SessionsClosed++;
     return OK;
 }
 
-void Package::AppendDataForSession(sock index_session, std::string new_data, u_int32 seq_no, int CS) {
+int ImapEngine::PushFrame(const u_int8* Frame, u_int32 CapLen, int64_t Time) {
+    FrameInfo info;
+    int ret = Decode(Frame, CapLen, info);
+    if (ret == OK) ret = PushPayload(info.SrcIP, info.DstIP, info.SrcPort, info.DstPort, info.Seq,
+                                     (const char*)Frame + info.PayloadOff, info.PayloadLen, Time);
+    EndFlow(info);
+    return ret;
+}
+
+int ImapEngine::PushPayload(u_int32 SrcIP, u_int32 DstIP, u_int16 SrcPort, u_int16 DstPort, u_int32 Seq,
+                            const char* Data, size_t Len, int64_t Time) {
+    int CS = (SrcPort == IMAP_PORT ? SERVER : CLIENT);
+    FlowInfo flow;
+    flow.Id = 0;    flow.Time = Time;
+    if (CS == SERVER) {
+        flow.ClientIP = DstIP;  flow.ClientPort = DstPort;
+        flow.ServerIP = SrcIP;  flow.ServerPort = SrcPort;
+    } else {
+        flow.ClientIP = SrcIP;  flow.ClientPort = SrcPort;
+        flow.ServerIP = DstIP;  flow.ServerPort = DstPort;
+    }
+    /* 会话表的键使用网络字节序，与按文件处理时一致 */
+    return Dispatch(sock(htonl(SrcIP), htonl(DstIP), htons(SrcPort), htons(DstPort)), Data, Len, Seq, CS, flow);
+}
+
+void ImapEngine::AppendDataForSession(sock index_session, std::string new_data, u_int32 seq_no, int CS) {
+    FlowInfo flow;
+    memset(&flow, 0, sizeof(flow));
+    Dispatch(index_session, new_data.data(), new_data.size(), seq_no, CS, flow);
+}
+
+int ImapEngine::Dispatch(const sock& index_session, const char* Data, size_t Len, u_int32 seq_no, int CS, FlowInfo& flow) {
     /* 先查看是否已经建立了对应的会话， 如果没有先建立 */
+    StageTimer lookup(STAGE_LOOKUP);
     std::map<sock, Session*>::iterator it = sessions.find(index_session);
     if (it == sessions.end()) {
         Session* new_session = new Session;
+        flow.Id = NextFlowId++;
+        new_session->SetListener(Listener, flow);
+        new_session->SetSaveOnClose(SaveOnClose);
+        new_session->SetStore(Store);
+        new_session->SetCheckpoint(Checkpoint);
         it = sessions.emplace(index_session, new_session).first;
+        GStats.SessionsCreated++;
+    }
+    lookup.Stop();
+    /* 已经交付过的数据段（重复包、重传）在复制数据之前丢弃，与交付过的部分重叠的只保留之后的新数据 */
+    size_t fresh = it->second->Unseen(seq_no, Len, CS);
+    if (fresh == 0) {
+        GStats.Duplicates++;
+        GStats.BytesDeduplicated += Len;
+        return NO;
+    }
+    if (fresh < Len) {
+        GStats.BytesDeduplicated += Len - fresh;
+        Data += Len - fresh;
+        seq_no += Len - fresh;
+        Len = fresh;
     }
+    it->second->SetTime(flow.Time);
+    GStats.PacketsDispatched[CS == CLIENT ? 0 : 1]++;
+    GStats.BytesDispatched[CS == CLIENT ? 0 : 1] += Len;
     /* 下一步应该由指定的session进行数据的处理 */
-    it->second->ReceiveData(new_data, seq_no, CS);
-}
\ No newline at end of file
+    it->second->ReceiveData(std::string(Data, Len), seq_no, CS);
+    return OK;
+}
+
+Package::Package(const char* FileName) {
+    InputFile = new InputStream(FileName);
+    if(InputFile->Read(&FileHeader, sizeof(pcap_file_header)) != sizeof(pcap_file_header)
+       || Engine.SetLinkType(FileHeader.linktype) != OK) {
+        delete InputFile;
+        throw(NO_PCAP);
+    }
+    CurPos = 24;
+    Reporter = NULL;
+    Index = NULL;
+}
+
+Package::~Package() {
+    delete InputFile;
+    CloseAll();
+}
+
+int Package::ProcessRecord() {
+    pcap_pkthdr     DataHeader;
+    FrameInfo       info;
+
+    u_int64_t at = CurPos;
+    if(InputFile->Read(&DataHeader, 16) != 16) return NO;
+    /* 计算下一个数据包的偏移值 */
+    CurPos += (16 + DataHeader.caplen);
+    GStats.PacketsRead++;
+    GStats.BytesRead += 16 + DataHeader.caplen;
+    if (Reporter && Reporter->Due()) {
+        MemReport report;
+        Measure(report);
+        Reporter->Report(&report, false);
+    }
+    if (PktBuf.size() < DataHeader.caplen) PktBuf.resize(DataHeader.caplen);
+    if (InputFile->Read(PktBuf.data(), DataHeader.caplen) != DataHeader.caplen) return NO;
+    int64_t time = (int64_t)DataHeader.ts.tv_sec * 1000000 + DataHeader.ts.tv_usec;
+    /* 带负载的RST已经在这里加入索引，下面不能再加一次 */
+    bool indexed = false;
+    if (Engine.Decode(PktBuf.data(), DataHeader.caplen, info) == OK) {
+        if (Index) Index->Add(info.Key(), at, time);
+        indexed = true;
+        Engine.PushPayload(info.SrcIP, info.DstIP, info.SrcPort, info.DstPort, info.Seq,
+                           (const char*)PktBuf.data() + info.PayloadOff, info.PayloadLen, time);
+    }
+    if (info.TcpFlags & (TCP_FIN | TCP_RST)) {
+        /* 会话可能就此结束，先记下用户名；按索引重新处理时也需要这个包 */
+        if (Index) {
+            if (indexed == false) Index->Add(info.Key(), at, time);
+            SetIndexUser(info.Key());
+        }
+        Engine.EndFlow(info);
+    }
+    return OK;
+}
+
+int Package::GetData() {
+    /* 输入为顺序流（可能来自解压线程），每次读入一个完整的数据包再进行解析 */
+    while (ProcessRecord() == OK) ;
+    if (Index) {
+        std::map<sock, FlowRecord>& flows = Index->GetFlows();
+        for (std::map<sock, FlowRecord>::iterator it = flows.begin(); it != flows.end(); it++)
+            SetIndexUser(it->first);
+    }
+    return OK;
+}
+
+void Package::SetIndexUser(const sock& Key) {
+    std::map<sock, FlowRecord>& flows = Index->GetFlows();
+    std::map<sock, FlowRecord>::iterator it = flows.find(Key);
+    if (it == flows.end()) return;
+    /* 已经结束的会话不在引擎中，保留之前记下的用户名 */
+    std::string user = Engine.GetUserName(Key);
+    if (user.empty() == false) it->second.User = user;
+}
+
+int Package::Replay(const std::vector<u_int64_t>& Offsets) {
+    for (size_t i = 0; i < Offsets.size(); i++) {
+        if (Offsets[i] < CurPos || InputFile->Skip(Offsets[i] - CurPos) == false) return NO;
+        CurPos = Offsets[i];
+        if (ProcessRecord() != OK) return NO;
+    }
+    return OK;
+}
+
+int Package::Extract(PcapWriter& Out, FlowIndex* Index) {
+    pcap_pkthdr     DataHeader;
+    FrameInfo       info;
+
+    while (InputFile->Read(&DataHeader, 16) == 16) {
+        CurPos += (16 + DataHeader.caplen);
+        GStats.PacketsRead++;
+        GStats.BytesRead += 16 + DataHeader.caplen;
+        if (Reporter && Reporter->Due()) Reporter->Report(NULL, false);
+        if (PktBuf.size() < DataHeader.caplen) PktBuf.resize(DataHeader.caplen);
+        if (InputFile->Read(PktBuf.data(), DataHeader.caplen) != DataHeader.caplen) break;
+        /* 被过滤的包中，端口为143的控制包（TcpFlags已填写）也要保留 */
+        if (Engine.Decode(PktBuf.data(), DataHeader.caplen, info) != OK
+            && (info.TcpFlags & (TCP_SYN | TCP_FIN | TCP_RST)) == 0) continue;
+        u_int64_t at = Out.Write(DataHeader, PktBuf.data());
+        if (Index) Index->Add(info.Key(), at, (int64_t)DataHeader.ts.tv_sec * 1000000 + DataHeader.ts.tv_usec);
+    }
+    return OK;
+}
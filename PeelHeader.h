@@ -8,6 +8,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "ImapResolve.h"
+#include "InputStream.h"
+#include "Stats.h"
 
 
 /* obsolete */
@@ -20,6 +22,7 @@
 #define NO_TCP   -6
 #define NO_PCAP  -7
 #define FILE_OPEN_ERR   -2
+#define NO_CODEC -8
 /* end of obsolete */
 
 /* IMAP 返回字符串的分析 */
@@ -105,6 +108,11 @@ typedef struct TCPHeader_t {/* TCP数据报头 */
     u_int16 UrgentPointer;  /* 紧急指针 */
 } TCPHeader_t;
 
+/* TCP控制标志 */
+#define TCP_FIN     0x01
+#define TCP_SYN     0x02
+#define TCP_RST     0x04
+
 struct sock {
     u_int32 IP_fir, IP_sec;
     u_int16 Port_fir, Port_sec;
@@ -113,16 +121,126 @@ struct sock {
     bool operator==(const sock& obj) const;
 };
 
+/* 解析数据帧首部的结果，地址和端口为主机字节序，负载为帧中的偏移和长度 */
+struct FrameInfo {
+    u_int32 SrcIP, DstIP;
+    u_int16 SrcPort, DstPort;
+    u_int32 Seq;
+    u_int32 PayloadOff, PayloadLen;
+    /* TCP标志，端口不是143时为0 */
+    u_int8 TcpFlags;
+    /* 会话表的键（网络字节序） */
+    sock Key() const {return sock(htonl(SrcIP), htonl(DstIP), htons(SrcPort), htons(DstPort));}
+};
+
+/*------------------------------------------------------------------------------
+* class ImapEngine
+* 不依赖文件的处理入口，可以嵌入到其他抓包程序中：
+*   1） PushFrame推入从链路层首部开始的完整数据帧，按与处理pcap文件相同的规则过滤和解析首部，
+*       只解析首部而不处理时使用Decode；
+*   2） PushPayload直接推入一段TCP负载及其四元组（主机字节序）和序列号；
+*   3） 时间为微秒，只用于事件中的FlowInfo；
+*   4） SetListener设置的回调对之后新建的会话生效，事件在数据推入的线程中同步调用；
+*   5） SetSaveOnClose(false)时会话结束不写目录，只通过回调取得结果；
+*   6） SetStore设置用户级存储后，会话结束时并入其中，由存储统一保存（不再按SaveOnClose保存）；
+*   7） 连接被RST或两个方向都FIN后会话立即结束（PushFrame自动处理，使用Decode时调用EndFlow），
+*       其余会话在CloseAll时结束；
+*   8） 会话每个方向已经交付过的数据段（镜像端口的重复包、TCP重传）在复制数据之前丢弃，
+*       计入GStats.Duplicates；开头与交付过的部分重叠的只复制、交付之后的新数据；
+*   9） SetCheckpoint之后新建的会话按设置定期把完整的邮件写入检查点目录并释放（见CheckpointPolicy），
+*       会话结束保存时链接到检查点文件；检查点目录由调用者建立和清理；
+* 引擎不是线程安全的，多线程使用时每个线程（按四元组分流）各用一个引擎
+* ----------------------------------------------------------------------------*/
+#define IMAP_PORT   143
+
+class ImapEngine {
+    int LinkLen;
+    std::map<sock, Session*> sessions;
+    SessionListener* Listener;
+    bool SaveOnClose;
+    UserStore* Store;
+    const CheckpointPolicy* Checkpoint;
+
+    /* 重复的数据段返回NO */
+    int Dispatch(const sock& index_session, const char* Data, size_t Len, u_int32 seq_no, int CS, FlowInfo& flow);
+    ImapEngine(const ImapEngine&);
+    ImapEngine& operator=(const ImapEngine&);
+public:
+    /* 链路类型为ETHERNET或LINUXCOOKED，其他类型抛出NO_PCAP */
+    ImapEngine(int LinkType = ETHERNET);
+    ~ImapEngine();
+    int SetLinkType(int LinkType);
+    void SetListener(SessionListener* listener) {Listener = listener;}
+    void SetSaveOnClose(bool save) {SaveOnClose = save;}
+    /* 对之后新建的会话生效，同一存储可以由多个引擎共用 */
+    void SetStore(UserStore* store) {Store = store;}
+    /* policy在引擎的整个生命周期内有效，NULL为不使用检查点 */
+    void SetCheckpoint(const CheckpointPolicy* policy) {Checkpoint = policy;}
+
+    /* 端口为143且有负载的TCP包返回OK并填写Info，被过滤时返回NO（计入GStats） */
+    int Decode(const u_int8* Frame, u_int32 CapLen, FrameInfo& Info);
+    /* Decode之后调用：Info为FIN或RST并使会话结束时返回OK */
+    int EndFlow(const FrameInfo& Info);
+    /* 数据被交给会话处理时返回OK，被过滤或是已经交付过的重复数据段时返回NO */
+    int PushFrame(const u_int8* Frame, u_int32 CapLen, int64_t Time);
+    int PushPayload(u_int32 SrcIP, u_int32 DstIP, u_int16 SrcPort, u_int16 DstPort, u_int32 Seq,
+                    const char* Data, size_t Len, int64_t Time);
+    /* 添加会话数据，如果会话不存在则新建，需要数据的序列号以及数据来源 */
+    void AppendDataForSession(sock index_session, std::string new_data, u_int32 seq_no, int CS);
+    size_t size() const {return sessions.size();}
+    /* 会话的用户名，会话不存在或还没有登录时为空 */
+    std::string GetUserName(const sock& Key) const;
+    /* 统计所有会话的内存使用 */
+    void Measure(MemReport& report);
+    /* 结束所有会话（触发OnClose，按设置保存数据） */
+    void CloseAll();
+};
+
+class PcapWriter;
+class FlowIndex;
+
 class Package {
-    int LinkLen, CurPos;
+    /* 下一个数据包在（解压后）数据流中的偏移 */
+    u_int64_t CurPos;
     pcap_file_header FileHeader;
-    FILE* InputFile;
-    std::map<sock, Session*> sessions;
+    InputStream* InputFile;
+    /* 当前数据包的缓冲区，按最大包长扩充，避免每个包都重新分配 */
+    std::vector<u_int8> PktBuf;
+    ImapEngine Engine;
+    /* 周期统计报告，NULL表示不输出 */
+    StatsReporter* Reporter;
+    /* 处理时建立的会话索引，NULL表示不建立 */
+    FlowIndex* Index;
+
+    /* 读入一个数据包记录并交给引擎，文件结束时返回NO */
+    int ProcessRecord();
+    /* 把会话当前的用户名填入索引 */
+    void SetIndexUser(const sock& Key);
 public:
+    /* 输入文件可以是普通pcap，也可以是gzip/zstd压缩的pcap */
     Package(const char* FileName);
     ~Package();
 
     int GetData();
-    /* 添加会话数据，如果会话不存在则新建，需要数据的序列号以及数据来源 */
-    void AppendDataForSession(sock index_session, std::string new_data, u_int32 seq_no, int CS);
-};
\ No newline at end of file
+    /* 只处理给出的偏移（按升序，来自FlowIndex::Select）处的数据包记录，向后跳过其余部分；
+    * 普通pcap文件直接定位，压缩文件仍需解压跳过的部分；偏移不是升序或读取失败时返回NO */
+    int Replay(const std::vector<u_int64_t>& Offsets);
+    /* 不解析会话，只把端口为143且有负载的TCP包，以及这些连接的SYN/FIN/RST包（EndFlow据此
+    * 结束会话）原样写入Out，首部的解析和过滤与GetData相同；
+    * Index不为NULL时按会话记录各数据包在Out中的偏移 */
+    int Extract(PcapWriter& Out, FlowIndex* Index);
+    const pcap_file_header& GetFileHeader() const {return FileHeader;}
+    void AppendDataForSession(sock index_session, std::string new_data, u_int32 seq_no, int CS) {
+        Engine.AppendDataForSession(index_session, new_data, seq_no, CS);
+    }
+    void Measure(MemReport& report) {Engine.Measure(report);}
+    void SetReporter(StatsReporter* reporter) {Reporter = reporter;}
+    void SetListener(SessionListener* listener) {Engine.SetListener(listener);}
+    void SetSaveOnClose(bool save) {Engine.SetSaveOnClose(save);}
+    void SetStore(UserStore* store) {Engine.SetStore(store);}
+    void SetCheckpoint(const CheckpointPolicy* policy) {Engine.SetCheckpoint(policy);}
+    /* GetData时记录各会话的数据包偏移，结束时（CloseAll之前）填入用户名 */
+    void SetIndex(FlowIndex* index) {Index = index;}
+    /* 结束所有会话（保存数据） */
+    void CloseAll() {Engine.CloseAll();}
+};
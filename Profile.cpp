@@ -0,0 +1,107 @@
+#include <cstring>
+#include <ctime>
+#include "Profile.h"
+
+Profiler GProfile;
+thread_local StageCounts GStages;
+
+static const char* StageNames[STAGES] = {"decode", "lookup", "receive", "fetch", "save"};
+
+void LatencyHist::clear() {
+    memset(Counts, 0, sizeof(Counts));
+    Total = Max = Sum = 0;
+}
+
+void LatencyHist::Add(const LatencyHist& other) {
+    for (int b = 0; b < HIST_BUCKETS; b++) Counts[b] += other.Counts[b];
+    Total += other.Total;   Sum += other.Sum;
+    if (other.Max > Max) Max = other.Max;
+}
+
+void StageCounts::Add(const StageCounts& other) {
+    for (int i = 0; i < STAGES; i++) {
+        Calls[i] += other.Calls[i];
+        Hist[i].Add(other.Hist[i]);
+    }
+}
+
+u_int64_t LatencyHist::Percentile(double q) const {
+    if (Total == 0) return 0;
+    u_int64_t rank = (u_int64_t)(q * Total);
+    if (rank >= Total) rank = Total - 1;
+    u_int64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += Counts[b];
+        if (seen > rank) {
+            u_int64_t v = Upper(b);
+            return v < Max ? v : Max;
+        }
+    }
+    return Max;
+}
+
+static u_int64_t NowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_int64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void Profiler::Enable(u_int32_t Every) {
+    u_int32_t n = 1;
+    while (Every > 1 && n <= Every / 2) n <<= 1;
+    Mask = n - 1;
+    if (StartCycles == 0) {
+        StartCycles = ReadCycles();
+        StartNs = NowNs();
+    }
+    Enabled = true;
+}
+
+/* 每纳秒的周期数，运行时间太短时无法换算，返回0 */
+static double CyclesPerNs(const Profiler& p) {
+    if (p.StartCycles == 0) return 0;
+    u_int64_t ns = NowNs() - p.StartNs;
+    if (ns < 1000000) return 0;
+    return (double)(ReadCycles() - p.StartCycles) / ns;
+}
+
+static const double Quantiles[] = {0.5, 0.9, 0.99, 0.999};
+#define QUANTILES (sizeof(Quantiles) / sizeof(Quantiles[0]))
+
+void Profiler::Dump(FILE* out) {
+    double rate = CyclesPerNs(*this);
+    fprintf(out, "latency (cycles, sampled 1/%u", Mask + 1);
+    if (rate > 0) fprintf(out, ", %.2f cycles/ns", rate);
+    fprintf(out, "):\n");
+    fprintf(out, "  %-8s %12s %10s %10s %10s %10s %10s %12s\n",
+            "stage", "samples", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (int i = 0; i < STAGES; i++) {
+        const LatencyHist& h = GStages.Hist[i];
+        fprintf(out, "  %-8s %12llu %10.0f", StageNames[i], (unsigned long long)h.count(), h.mean());
+        for (size_t j = 0; j < QUANTILES; j++)
+            fprintf(out, " %10llu", (unsigned long long)h.Percentile(Quantiles[j]));
+        fprintf(out, " %12llu\n", (unsigned long long)h.max());
+    }
+    if (rate > 0) {
+        fprintf(out, "  p99 (us):");
+        for (int i = 0; i < STAGES; i++)
+            fprintf(out, " %s=%.2f", StageNames[i], GStages.Hist[i].Percentile(0.99) / rate / 1000);
+        fprintf(out, "\n");
+    }
+}
+
+void Profiler::WriteJson(FILE* out) {
+    double rate = CyclesPerNs(*this);
+    fprintf(out, "{\"latency\":{\"sample\":%u,\"cycles_per_ns\":%.3f", Mask + 1, rate);
+    for (int i = 0; i < STAGES; i++) {
+        const LatencyHist& h = GStages.Hist[i];
+        fprintf(out, ",\"%s\":{\"calls\":%llu,\"samples\":%llu,\"mean\":%.0f,\"p50\":%llu,\"p90\":%llu,"
+                "\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                StageNames[i], (unsigned long long)GStages.Calls[i], (unsigned long long)h.count(), h.mean(),
+                (unsigned long long)h.Percentile(0.5), (unsigned long long)h.Percentile(0.9),
+                (unsigned long long)h.Percentile(0.99), (unsigned long long)h.Percentile(0.999),
+                (unsigned long long)h.max());
+    }
+    fprintf(out, "}}\n");
+    fflush(out);
+}
@@ -0,0 +1,123 @@
+/*---------------------
+* target: 处理阶段的延迟直方图（按周期计数抽样）
+* -------------------*/
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/* 统计的阶段 */
+#define STAGE_DECODE    0   /* GetData中的首部解析 */
+#define STAGE_LOOKUP    1   /* AppendDataForSession中的会话查找 */
+#define STAGE_RECEIVE   2   /* Session::ReceiveData */
+#define STAGE_FETCH     3   /* Session::fetch */
+#define STAGE_SAVE      4   /* 会话结束时的保存（或并入UserStore），以及检查点 */
+#define STAGES          5
+
+/* 直方图：每个2的幂区间再分为2^HIST_SUB_BITS个子区间，相对误差约为1/16 */
+#define HIST_SUB_BITS   4
+#define HIST_BUCKETS    ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/* 读取时间戳计数器；非x86平台使用单调时钟的纳秒数 */
+inline u_int64_t ReadCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u_int64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/*------------------------------------------------------------------------------
+* class LatencyHist
+* HDR风格的对数-线性直方图：小于2^HIST_SUB_BITS的值精确记录，更大的值按最高位
+* 所在的区间和其后HIST_SUB_BITS位分桶；记录为O(1)，百分位数按桶的上界估计
+* ----------------------------------------------------------------------------*/
+class LatencyHist {
+    u_int64_t Counts[HIST_BUCKETS];
+    u_int64_t Total, Max, Sum;
+
+    static int Bucket(u_int64_t v) {
+        if (v < (1u << HIST_SUB_BITS)) return (int)v;
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - HIST_SUB_BITS;
+        return ((shift + 1) << HIST_SUB_BITS) + (int)((v >> shift) & ((1u << HIST_SUB_BITS) - 1));
+    }
+    /* 桶内的最大值 */
+    static u_int64_t Upper(int b) {
+        if (b < (1 << HIST_SUB_BITS)) return b;
+        int shift = (b >> HIST_SUB_BITS) - 1;
+        u_int64_t base = ((u_int64_t)(1u << HIST_SUB_BITS) | (b & ((1u << HIST_SUB_BITS) - 1))) << shift;
+        return base + ((u_int64_t)1 << shift) - 1;
+    }
+public:
+    LatencyHist() {clear();}
+    void clear();
+    void Record(u_int64_t v) {
+        Counts[Bucket(v)]++;
+        Total++;    Sum += v;
+        if (v > Max) Max = v;
+    }
+    /* 合并另一个直方图（如其他线程的） */
+    void Add(const LatencyHist& other);
+    u_int64_t count() const {return Total;}
+    u_int64_t max() const {return Max;}
+    double mean() const {return Total ? (double)Sum / Total : 0;}
+    /* q为0到1之间的比例 */
+    u_int64_t Percentile(double q) const;
+};
+
+/* 各阶段的调用次数和延迟直方图，每个线程一份（GStages），只由本线程写入；
+* 多线程实时抓包结束后由LiveCapture合并到主线程 */
+struct StageCounts {
+    u_int64_t Calls[STAGES];
+    LatencyHist Hist[STAGES];
+
+    StageCounts() {memset(Calls, 0, sizeof(Calls));}
+    void Add(const StageCounts& other);
+};
+
+extern thread_local StageCounts GStages;
+
+/*------------------------------------------------------------------------------
+* struct Profiler
+* 全局的开关和抽样设置（GProfile）；运行时开启后，每个阶段每Mask+1次调用测量一次，
+* 关闭时每次调用只多一次判断；结束时输出调用线程（GStages）中各阶段的百分位数
+* （周期数和换算的纳秒数）
+* ----------------------------------------------------------------------------*/
+struct Profiler {
+    bool Enabled;
+    u_int32_t Mask;
+    /* 开启时的周期数和时间，用来换算周期与纳秒 */
+    u_int64_t StartCycles, StartNs;
+
+    Profiler() : Enabled(false), Mask(0), StartCycles(0), StartNs(0) {}
+    /* 每Every次调用抽样一次，Every应为2的幂（不是则向下取整） */
+    void Enable(u_int32_t Every);
+    void Disable() {Enabled = false;}
+    void Dump(FILE* out);
+    void WriteJson(FILE* out);
+};
+
+extern Profiler GProfile;
+
+/* 作用域计时，构造时决定是否抽样；Stop可提前结束计时，之后析构不再记录 */
+class StageTimer {
+    int Stage;
+    u_int64_t Start;
+public:
+    explicit StageTimer(int stage) : Stage(stage), Start(0) {
+        if (GProfile.Enabled && (GStages.Calls[stage]++ & GProfile.Mask) == 0) Start = ReadCycles();
+    }
+    ~StageTimer() {Stop();}
+    void Stop() {
+        if (Start) GStages.Hist[Stage].Record(ReadCycles() - Start);
+        Start = 0;
+    }
+};
@@ -0,0 +1,134 @@
+#include <cstring>
+#include "Scanner.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/* 结构字符表，逐字节实现和尾部处理使用 */
+static bool IsStruct[256];
+
+static bool InitTable() {
+    const char chars[] = "\r\n\"{}()[] ";
+    memset(IsStruct, 0, sizeof(IsStruct));
+    for (int i = 0; chars[i]; i++) IsStruct[(u_int8_t)chars[i]] = true;
+    return true;
+}
+static bool TableReady = InitTable();
+
+/* 每个实现处理blocks个完整的64字节块，每块输出一个64位掩码 */
+typedef void (*ScanKernel)(const char* data, size_t blocks, u_int64_t* out);
+
+static void ScanScalar(const char* data, size_t blocks, u_int64_t* out) {
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        u_int64_t mask = 0;
+        for (int i = 0; i < 64; i++)
+            if (IsStruct[(u_int8_t)data[i]]) mask |= (u_int64_t)1 << i;
+        out[b] = mask;
+    }
+}
+
+#ifdef SCAN_X86
+static inline u_int32_t Match16(__m128i v) {
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(']')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    return (u_int32_t)_mm_movemask_epi8(m);
+}
+
+static void ScanSSE2(const char* data, size_t blocks, u_int64_t* out) {
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        u_int64_t m0 = Match16(_mm_loadu_si128((const __m128i*)data));
+        u_int64_t m1 = Match16(_mm_loadu_si128((const __m128i*)(data + 16)));
+        u_int64_t m2 = Match16(_mm_loadu_si128((const __m128i*)(data + 32)));
+        u_int64_t m3 = Match16(_mm_loadu_si128((const __m128i*)(data + 48)));
+        out[b] = m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline u_int32_t Match32(__m256i v) {
+    __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('}')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('(')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(')')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(']')));
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+    return (u_int32_t)_mm256_movemask_epi8(m);
+}
+
+__attribute__((target("avx2")))
+static void ScanAVX2(const char* data, size_t blocks, u_int64_t* out) {
+    for (size_t b = 0; b < blocks; b++, data += 64) {
+        u_int64_t lo = Match32(_mm256_loadu_si256((const __m256i*)data));
+        u_int64_t hi = Match32(_mm256_loadu_si256((const __m256i*)(data + 32)));
+        out[b] = lo | (hi << 32);
+    }
+}
+#endif
+
+/* 运行时选择实现，只在第一次使用时判断一次 */
+static ScanKernel ChooseKernel(const char** name) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return ScanAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        *name = "sse2";
+        return ScanSSE2;
+    }
+#endif
+    *name = "scalar";
+    return ScanScalar;
+}
+
+static const char* KernelName = NULL;
+static ScanKernel Kernel = ChooseKernel(&KernelName);
+
+const char* ScanKernelName() {
+    return KernelName;
+}
+
+void StructIndex::Build(const char* data, size_t size) {
+    Data = data;    Size = size;
+    size_t blocks = size / 64, rest = size % 64;
+    Bits.resize(blocks + (rest ? 1 : 0));
+    if (blocks) Kernel(data, blocks, Bits.data());
+    if (rest) {
+        /* 最后不足64字节的部分逐字节处理，避免越界读取 */
+        u_int64_t mask = 0;
+        const char* tail = data + blocks * 64;
+        for (size_t i = 0; i < rest; i++)
+            if (IsStruct[(u_int8_t)tail[i]]) mask |= (u_int64_t)1 << i;
+        Bits[blocks] = mask;
+    }
+}
+
+size_t StructIndex::NextAny(size_t from) const {
+    if (from >= Size) return Size;
+    size_t word = from / 64;
+    /* 去掉from之前的位 */
+    u_int64_t mask = Bits[word] & (~(u_int64_t)0 << (from % 64));
+    while (mask == 0) {
+        if (++word == Bits.size()) return Size;
+        mask = Bits[word];
+    }
+    return word * 64 + __builtin_ctzll(mask);
+}
+
+size_t StructIndex::Next(size_t from, char ch) const {
+    size_t pos = NextAny(from);
+    while (pos < Size && Data[pos] != ch) pos = NextAny(pos + 1);
+    return pos;
+}
@@ -0,0 +1,33 @@
+/*---------------------
+* target: IMAP 结构字符的向量化扫描
+* -------------------*/
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <sys/types.h>
+
+/*------------------------------------------------------------------------------
+* class StructIndex
+* 对一段响应数据做一次扫描，得到结构字符的位图（每字节对应一位），结构字符为：
+*   \r \n " { } ( ) [ ] 以及空格
+* 扫描按64字节分块，运行时根据CPU选择AVX2（32字节一组）、SSE2（16字节一组）
+* 或逐字节的实现；之后解析器通过Next在位图上跳跃查找，不必再逐字节比较；
+* 对于FETCH中的大块文字量，解析器直接跳过，其中的位不会被访问
+* ----------------------------------------------------------------------------*/
+class StructIndex {
+    const char* Data;
+    size_t Size;
+    std::vector<u_int64_t> Bits;
+public:
+    StructIndex() : Data(NULL), Size(0) {}
+    StructIndex(const char* data, size_t size) {Build(data, size);}
+    void Build(const char* data, size_t size);
+    /* 从from开始（含）查找下一个字符为ch的结构字符位置，找不到返回Size */
+    size_t Next(size_t from, char ch) const;
+    /* 从from开始（含）查找下一个任意结构字符的位置 */
+    size_t NextAny(size_t from) const;
+    size_t size() const {return Size;}
+};
+
+/* 当前使用的扫描实现名称："avx2"、"sse2"或"scalar" */
+const char* ScanKernelName();
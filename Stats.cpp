@@ -0,0 +1,99 @@
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <sys/resource.h>
+#include "Stats.h"
+#include "ImapResolve.h"
+
+thread_local Stats GStats;
+
+/* 峰值之前的成员都是u_int64_t计数器，按数组处理 */
+#define STAT_COUNTERS   (offsetof(Stats, PeakSessions) / sizeof(u_int64_t))
+
+/* 与命令编号对应的名称，用作JSON中的键 */
+static const char* KindNames[STAT_KINDS] = {
+    "other", "login", "select", "create", "delete", "rename", "subscribe", "unsubscribe",
+    "append", "copy", "compress", "uid", "uid_copy", NULL, NULL, NULL,
+};
+
+void Stats::UpdatePeak(const MemReport& report) {
+    if (report.Sessions > PeakSessions) PeakSessions = report.Sessions;
+    if (report.Messages > PeakMessages) PeakMessages = report.Messages;
+    if (report.MessageBytes > PeakMessageBytes) PeakMessageBytes = report.MessageBytes;
+    if (report.BodyBytes > PeakBodyBytes) PeakBodyBytes = report.BodyBytes;
+    if (report.IndexBytes + report.UidBytes > PeakIndexBytes) PeakIndexBytes = report.IndexBytes + report.UidBytes;
+    if (report.ReassemblyBytes > PeakReassemblyBytes) PeakReassemblyBytes = report.ReassemblyBytes;
+}
+
+void Stats::Add(const Stats& other) {
+    u_int64_t* mine = &PacketsRead;
+    const u_int64_t* theirs = &other.PacketsRead;
+    for (size_t i = 0; i < STAT_COUNTERS; i++) mine[i] += theirs[i];
+    PeakSessions = std::max(PeakSessions, other.PeakSessions);
+    PeakMessages = std::max(PeakMessages, other.PeakMessages);
+    PeakMessageBytes = std::max(PeakMessageBytes, other.PeakMessageBytes);
+    PeakBodyBytes = std::max(PeakBodyBytes, other.PeakBodyBytes);
+    PeakIndexBytes = std::max(PeakIndexBytes, other.PeakIndexBytes);
+    PeakReassemblyBytes = std::max(PeakReassemblyBytes, other.PeakReassemblyBytes);
+}
+
+void Stats::ClearCounters() {
+    memset(&PacketsRead, 0, STAT_COUNTERS * sizeof(u_int64_t));
+}
+
+static void WriteKinds(FILE* out, const char* name, const u_int64_t* counts) {
+    fprintf(out, "\"%s\":{", name);
+    bool first = true;
+    for (int i = 0; i < STAT_KINDS; i++) {
+        if (KindNames[i] == NULL || counts[i] == 0) continue;
+        fprintf(out, "%s\"%s\":%llu", first ? "" : ",", KindNames[i], (unsigned long long)counts[i]);
+        first = false;
+    }
+    fprintf(out, "}");
+}
+
+void Stats::WriteJson(FILE* out, bool Final) {
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    getrusage(RUSAGE_SELF, &usage);
+#define U(x) (unsigned long long)(x)
+    fprintf(out, "{\"time\":%lld,\"final\":%s,", (long long)time(NULL), Final ? "true" : "false");
+    fprintf(out, "\"read\":{\"packets\":%llu,\"bytes\":%llu},", U(PacketsRead), U(BytesRead));
+    fprintf(out, "\"filtered\":{\"not_tcp\":%llu,\"not_imap\":%llu,\"control\":%llu,\"empty\":%llu,\"truncated\":%llu},",
+            U(NotTcp), U(NotImap), U(Control), U(Empty), U(Truncated));
+    fprintf(out, "\"dispatched\":{\"client\":{\"packets\":%llu,\"bytes\":%llu},\"server\":{\"packets\":%llu,\"bytes\":%llu}},",
+            U(PacketsDispatched[0]), U(BytesDispatched[0]), U(PacketsDispatched[1]), U(BytesDispatched[1]));
+    fprintf(out, "\"sessions\":{\"created\":%llu,\"closed\":%llu,\"evicted\":%llu,\"anonymous\":%llu},",
+            U(SessionsCreated), U(SessionsClosed), U(SessionsEvicted), U(SessionsAnonymous));
+    WriteKinds(out, "commands", Commands);
+    fprintf(out, ",");
+    WriteKinds(out, "responses", Responses);
+    fprintf(out, ",\"responses_no\":%llu,\"data\":{\"fetch\":%llu,\"list\":%llu,\"status\":%llu,\"expunge\":%llu},",
+            U(ResponsesNo), U(Fetches), U(Lists), U(Statuses), U(Expunges));
+    fprintf(out, "\"reassembly\":{\"gaps\":%llu,\"retransmits\":%llu,\"bytes_dropped\":%llu,"
+            "\"unmatched_commands\":%llu,\"unmatched_responses\":%llu,\"duplicates\":%llu,\"bytes_deduplicated\":%llu},",
+            U(Gaps), U(Retransmits), U(BytesDropped), U(UnmatchedCommands), U(UnmatchedResponses),
+            U(Duplicates), U(BytesDeduplicated));
+    fprintf(out, "\"capture\":{\"packets\":%llu,\"drops\":%llu,\"freezes\":%llu},",
+            U(CapturePackets), U(CaptureDrops), U(CaptureFreezes));
+    fprintf(out, "\"checkpoint\":{\"runs\":%llu,\"messages\":%llu,\"bytes\":%llu},",
+            U(Checkpoints), U(MessagesFlushed), U(BytesFlushed));
+    fprintf(out, "\"peak_memory\":{\"sessions\":%llu,\"messages\":%llu,\"message_bytes\":%llu,\"body_bytes\":%llu,"
+            "\"index_bytes\":%llu,\"reassembly_bytes\":%llu,\"rss_kb\":%llu}}\n",
+            U(PeakSessions), U(PeakMessages), U(PeakMessageBytes), U(PeakBodyBytes),
+            U(PeakIndexBytes), U(PeakReassemblyBytes), U(usage.ru_maxrss));
+#undef U
+    fflush(out);
+}
+
+StatsReporter::StatsReporter(FILE* out, int interval) {
+    Out = out;  Interval = interval;
+    Next = time(NULL) + interval;
+}
+
+void StatsReporter::Report(const MemReport* report, bool Final) {
+    if (Out == NULL) return ;
+    if (report) GStats.UpdatePeak(*report);
+    GStats.WriteJson(Out, Final);
+    Next = time(NULL) + Interval;
+}
@@ -0,0 +1,82 @@
+/*---------------------
+* target: 运行统计与JSON报告
+* -------------------*/
+#pragma once
+#include <cstdio>
+#include <ctime>
+#include <sys/types.h>
+
+/* 按命令类型统计的槽位数，下标为ImapResolve.h中的命令编号，0为不关心的命令 */
+#define STAT_KINDS      16
+/* 默认的周期报告间隔（秒），以及每处理多少个数据包检查一次时间 */
+#define STAT_INTERVAL   10
+#define STAT_CHECK_MASK 1023
+
+struct MemReport;
+
+/*------------------------------------------------------------------------------
+* struct Stats
+* 整个处理流程的计数器（GStats），每个线程一份，处理线程只写自己的一份，不加锁；
+* 单线程处理时即为全部计数，多线程实时抓包时由LiveCapture把各线程的计数汇总到主线程后报告；
+*   1） 读取：数据包数、字节数（含pcap记录头）；
+*   2） 过滤：非TCP、端口不是143、SYN/FIN、没有负载、首部被截断；
+*   3） 分发：按方向统计交给会话的数据包和字节数；会话的建立、关闭、淘汰（输入结束或停止抓包时
+*       还没有FIN/RST、由CloseAll强制结束的会话，同时计入关闭）；
+*   4） 解析：按命令类型统计命令和带tag的响应，失败的响应，FETCH等数据响应；
+*   5） 重组：序列号空洞、重传、因此丢弃的字节数，会话结束时没有配对的命令/响应，
+*       分发前去掉的重复数据段；
+*   6） 内存：每次报告时统计各部分内存，记录峰值；
+*   7） 抓包：实时抓包时内核环形缓冲区收到和丢弃的数据包数，缓冲区满被冻结的次数；
+*   8） 检查点：长时间的会话定期写出并释放的邮件
+* ----------------------------------------------------------------------------*/
+struct Stats {
+    u_int64_t PacketsRead, BytesRead;
+    u_int64_t NotTcp, NotImap, Control, Empty, Truncated;
+    /* 下标0为客户端，1为服务器 */
+    u_int64_t PacketsDispatched[2], BytesDispatched[2];
+    u_int64_t SessionsCreated, SessionsClosed, SessionsEvicted;
+    /* 没有取得用户名、按客户端地址保存的会话 */
+    u_int64_t SessionsAnonymous;
+    u_int64_t Commands[STAT_KINDS], Responses[STAT_KINDS], ResponsesNo;
+    u_int64_t Fetches, Lists, Statuses, Expunges;
+    u_int64_t Gaps, Retransmits, BytesDropped, UnmatchedCommands, UnmatchedResponses;
+    /* 分发前按序列号丢弃的重复数据段（不计入PacketsDispatched），部分重叠的数据段只计入重叠的字节 */
+    u_int64_t Duplicates, BytesDeduplicated;
+    u_int64_t CapturePackets, CaptureDrops, CaptureFreezes;
+    /* 检查点的次数，写入并释放的邮件数和内容字节数 */
+    u_int64_t Checkpoints, MessagesFlushed, BytesFlushed;
+    size_t PeakSessions, PeakMessages, PeakMessageBytes, PeakBodyBytes, PeakIndexBytes, PeakReassemblyBytes;
+
+    /* 用一次内存统计的结果更新峰值 */
+    void UpdatePeak(const MemReport& report);
+    /* 累加另一份的计数，峰值取较大的 */
+    void Add(const Stats& other);
+    /* 计数清零，保留峰值 */
+    void ClearCounters();
+    /* 输出一行JSON，Final表示最终报告 */
+    void WriteJson(FILE* out, bool Final);
+};
+
+extern thread_local Stats GStats;
+
+/*------------------------------------------------------------------------------
+* class StatsReporter
+* 按时间间隔输出报告；Tick在数据包循环中调用，只在每STAT_CHECK_MASK+1个数据包时读取一次时间
+* ----------------------------------------------------------------------------*/
+class StatsReporter {
+    FILE* Out;
+    int Interval;
+    time_t Next;
+public:
+    /* Out为NULL表示不输出报告，Interval为0表示只输出最终报告 */
+    StatsReporter(FILE* out = NULL, int interval = STAT_INTERVAL);
+    bool Enabled() {return Out != NULL;}
+    /* 到达报告时间时返回true，由调用者统计内存后调用Report */
+    bool Due() {
+        if (GStats.PacketsRead & STAT_CHECK_MASK) return false;
+        return TimeDue();
+    }
+    /* 只按时间判断，用于不在数据包循环中的调用者 */
+    bool TimeDue() {return Out != NULL && Interval > 0 && time(NULL) >= Next;}
+    void Report(const MemReport* report, bool Final);
+};
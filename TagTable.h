@@ -0,0 +1,207 @@
+/*---------------------
+* target: 以整数编码的tag作为索引的命令/响应表
+* -------------------*/
+#pragma once
+#include <string>
+#include <vector>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <sys/types.h>
+
+/* 无效的tag编码，表示没有完整的响应 */
+#define TAG_NONE        0
+/* 会话内按顺序查找的tag前缀上限，超过后的前缀放在哈希表中；后者记满时清空重来 */
+#define TAG_PREFIXES    64
+#define TAG_OVERFLOW    16384
+/* 表的初始容量和最大容量（均为2的幂），以及表项的最大存活时间（以插入次数计） */
+#define TAG_INIT_CAP    16
+#define TAG_MAX_CAP     1024
+#define TAG_MAX_AGE     512
+
+/*------------------------------------------------------------------------------
+* class TagCodec
+* 客户端的tag几乎都是"字母前缀+递增数字"的形式（A0001、a12、1.23等），
+* 将其编码为一个64位整数：前缀编号（16位）+ 数字位数（8位）+ 数字值（32位）；
+* 数字位数参与编码，保证A01和A001不同；前缀编号从1开始，所以编码一定不为0；
+* 前缀在会话内记录，查找时直接与原始数据比较，不需要构造字符串；
+* 前缀超过TAG_PREFIXES个（多为随机tag）时，之后的前缀按字符串查哈希表，编号取前缀的哈希，
+* 已被其他前缀占用时顺延，所以不同的前缀编号一定不同；哈希表记满TAG_OVERFLOW个前缀时清空，
+* 此时旧的编号可能被重新分配，但表中对应的命令早已过期（见TagTable）
+* ----------------------------------------------------------------------------*/
+class TagCodec {
+    std::vector<std::string> Prefixes;
+    std::unordered_map<std::string, u_int32_t> Overflow;
+    std::unordered_set<u_int32_t> Taken;
+
+    u_int32_t OverflowId(const char* tag, int plen) {
+        std::string key(tag, plen);
+        std::unordered_map<std::string, u_int32_t>::iterator it = Overflow.find(key);
+        if (it != Overflow.end()) return it->second;
+        if (Overflow.size() >= TAG_OVERFLOW) {
+            Overflow.clear();
+            Taken.clear();
+        }
+        u_int32_t h = 2166136261u;
+        for (int i = 0; i < plen; i++) h = (h ^ (u_int8_t)tag[i]) * 16777619u;
+        u_int32_t slot = h % (0xffff - TAG_PREFIXES);
+        while (Taken.count(slot)) slot = (slot + 1) % (0xffff - TAG_PREFIXES);
+        Taken.insert(slot);
+        Overflow.emplace(key, slot);
+        return slot;
+    }
+public:
+    u_int64_t Parse(const char* tag, int len) {
+        int digits = 0;
+        u_int32_t counter = 0;
+        while (digits < len && digits < 9 && tag[len-1-digits] <= '9' && tag[len-1-digits] >= '0') digits++;
+        for (int i = len - digits; i < len; i++) counter = counter * 10 + tag[i] - '0';
+        int plen = len - digits;
+        u_int64_t prefix = 0;
+        for (size_t i = 0; i < Prefixes.size(); i++) {
+            if ((int)Prefixes[i].size() == plen && memcmp(Prefixes[i].data(), tag, plen) == 0) {
+                prefix = i + 1;
+                break;
+            }
+        }
+        if (prefix == 0) {
+            if (Prefixes.size() < TAG_PREFIXES) {
+                Prefixes.push_back(std::string(tag, plen));
+                prefix = Prefixes.size();
+            } else prefix = TAG_PREFIXES + 1 + OverflowId(tag, plen);
+        }
+        return (prefix << 40) | ((u_int64_t)digits << 32) | counter;
+    }
+};
+
+/*------------------------------------------------------------------------------
+* class TagTable
+* 开放寻址（线性探测）的哈希表，键为TagCodec的编码；
+*   1） 查找、插入、删除均为O(1)，删除时后移填补空位，不留墓碑；
+*   2） 每个表项记录插入时的时钟，负载超过一半时先清理超过TAG_MAX_AGE的过期项，
+*       使一直没有对应命令的响应（或没有响应的命令）不会无限积累；
+*   3） 清理后仍超过一半时扩容，到达最大容量后一次淘汰较旧的一半表项；
+*       清理和淘汰都是O(容量)的，但之后至少要再插入容量/4次才会再次触发，均摊仍为O(1)
+* ----------------------------------------------------------------------------*/
+template <typename T>
+class TagTable {
+    struct Slot {
+        u_int64_t Key;
+        u_int32_t Stamp;
+        T Val;
+    };
+    std::vector<Slot> Slots;
+    size_t Count;
+    u_int32_t Clock;
+
+    size_t Home(u_int64_t key) const {
+        return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (Slots.size() - 1);
+    }
+    /* 删除下标为i的表项，并将后面同一探测链上的表项前移 */
+    void RemoveAt(size_t i) {
+        size_t mask = Slots.size() - 1, j = i;
+        Slots[i].Key = TAG_NONE;    Slots[i].Val = T();
+        while (true) {
+            j = (j + 1) & mask;
+            if (Slots[j].Key == TAG_NONE) break;
+            size_t h = Home(Slots[j].Key);
+            /* h不在(i, j]区间内时，j处的表项可以移到i */
+            if ((i <= j) ? (h <= i || h > j) : (h <= i && h > j)) {
+                std::swap(Slots[i], Slots[j]);
+                i = j;
+            }
+        }
+        Count--;
+    }
+    void Rehash(size_t cap) {
+        std::vector<Slot> old;
+        old.swap(Slots);
+        Slots.resize(cap);
+        for (size_t i = 0; i < cap; i++) Slots[i].Key = TAG_NONE;
+        Count = 0;
+        for (size_t i = 0; i < old.size(); i++)
+            if (old[i].Key != TAG_NONE) Place(old[i]);
+    }
+    void Place(Slot& s) {
+        size_t i = Home(s.Key), mask = Slots.size() - 1;
+        while (Slots[i].Key != TAG_NONE) i = (i + 1) & mask;
+        std::swap(Slots[i], s);
+        Count++;
+    }
+    /* 清理过期表项，返回清理的数量 */
+    size_t Expire() {
+        size_t removed = 0;
+        for (size_t i = 0; i < Slots.size(); i++) {
+            while (Slots[i].Key != TAG_NONE && Clock - Slots[i].Stamp > TAG_MAX_AGE) {
+                RemoveAt(i);
+                removed++;
+            }
+        }
+        return removed;
+    }
+    /* 淘汰存活时间不小于中位数的表项，即较旧的一半 */
+    void EvictOlder() {
+        if (Count == 0) return ;
+        std::vector<u_int32_t> ages;
+        ages.reserve(Count);
+        for (size_t i = 0; i < Slots.size(); i++)
+            if (Slots[i].Key != TAG_NONE) ages.push_back(Clock - Slots[i].Stamp);
+        std::nth_element(ages.begin(), ages.begin() + ages.size() / 2, ages.end());
+        u_int32_t limit = ages[ages.size() / 2];
+        for (size_t i = 0; i < Slots.size(); i++) {
+            while (Slots[i].Key != TAG_NONE && Clock - Slots[i].Stamp >= limit) RemoveAt(i);
+        }
+    }
+public:
+    TagTable() : Count(0), Clock(0) {Rehash(TAG_INIT_CAP);}
+
+    T* Find(u_int64_t key) {
+        size_t i = Home(key), mask = Slots.size() - 1;
+        while (Slots[i].Key != TAG_NONE) {
+            if (Slots[i].Key == key) return &Slots[i].Val;
+            i = (i + 1) & mask;
+        }
+        return NULL;
+    }
+    /* 插入或覆盖（同一tag被重用时以新的为准） */
+    void Insert(u_int64_t key, const T& val) {
+        Clock++;
+        size_t i = Home(key), mask = Slots.size() - 1;
+        while (Slots[i].Key != TAG_NONE) {
+            if (Slots[i].Key == key) {
+                Slots[i].Stamp = Clock; Slots[i].Val = val;
+                return ;
+            }
+            i = (i + 1) & mask;
+        }
+        if ((Count + 1) * 2 > Slots.size()) {
+            Expire();
+            if ((Count + 1) * 2 > Slots.size()) {
+                if (Slots.size() < TAG_MAX_CAP) Rehash(Slots.size() * 2);
+                else EvictOlder();
+            }
+        }
+        Slot s;
+        s.Key = key;    s.Stamp = Clock;    s.Val = val;
+        Place(s);
+    }
+    void Erase(u_int64_t key) {
+        size_t i = Home(key), mask = Slots.size() - 1;
+        while (Slots[i].Key != TAG_NONE) {
+            if (Slots[i].Key == key) {
+                RemoveAt(i);
+                return ;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+    void clear() {Slots.clear(); Rehash(TAG_INIT_CAP);}
+    size_t size() const {return Count;}
+
+    /* 按槽位遍历，Capacity为槽位数，KeyAt为TAG_NONE表示空槽 */
+    size_t Capacity() const {return Slots.size();}
+    u_int64_t KeyAt(size_t i) const {return Slots[i].Key;}
+    T& ValAt(size_t i) {return Slots[i].Val;}
+};
@@ -0,0 +1,548 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <queue>
+#include "TextIndex.h"
+#include "EventWriter.h"
+
+static void PutVarint(std::string& out, u_int64_t v) {
+    while (v >= 0x80) {
+        out.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static bool GetVarint(FILE* in, u_int64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = getc(in);
+        if (c == EOF) return false;
+        v |= (u_int64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/* 从内存中读取，越界时返回false */
+static bool GetVarint(const u_int8_t*& p, const u_int8_t* end, u_int64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        u_int8_t c = *p++;
+        v |= (u_int64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+/* 词表和邮件偏移表紧跟在变长数据之后，不保证8字节对齐，按字节复制读取 */
+static inline u_int64_t Get64(const u_int8_t* p) {
+    u_int64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static void PutString(std::string& out, const std::string& s) {
+    PutVarint(out, s.size());
+    out += s;
+}
+
+static bool GetString(FILE* in, std::string& s) {
+    u_int64_t len;
+    if (GetVarint(in, len) == false || len > SEGMENT_LIMIT) return false;
+    s.resize(len);
+    return len == 0 || fread(&s[0], 1, len, in) == len;
+}
+
+/* 词中的字符转为小写后的值，不属于词的字符为0，切分时查表 */
+struct TokenTable {
+    u_int8_t Map[256];
+    TokenTable() {
+        for (int c = 0; c < 256; c++)
+            Map[c] = c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ? c : 0;
+        for (int c = 'A'; c <= 'Z'; c++) Map[c] = c + 'a' - 'A';
+    }
+};
+static const TokenTable Tokens;
+
+static inline bool IsTokenChar(unsigned char c) {
+    return Tokens.Map[c] != 0;
+}
+
+static inline bool IsAddrChar(unsigned char c) {
+    return IsTokenChar(c) || c == '.' || c == '_' || c == '-' || c == '+';
+}
+
+/* 没有空格、全部为base64字符的长行，通常是附件的编码 */
+static bool IsBase64Line(const char* p, size_t len) {
+    if (len < 40) return false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = p[i];
+        if (c == '\r') continue;
+        if (c >= 0x80 || (IsTokenChar(c) == false && c != '+' && c != '/' && c != '=')) return false;
+    }
+    return true;
+}
+
+/* 从Pos开始取出下一个词（转为小写），没有更多的词时返回false；Token重复使用，避免每个词分配 */
+static bool NextToken(const char* Data, size_t Len, size_t& Pos, std::string& Token) {
+    while (Pos < Len) {
+        while (Pos < Len && IsTokenChar(Data[Pos]) == false) Pos++;
+        size_t start = Pos;
+        while (Pos < Len && IsTokenChar(Data[Pos])) Pos++;
+        size_t n = Pos - start;
+        if (n < TOKEN_MIN || n > TOKEN_MAX) continue;
+        Token.resize(n);
+        for (size_t j = 0; j < n; j++) Token[j] = Tokens.Map[(u_int8_t)Data[start + j]];
+        return true;
+    }
+    return false;
+}
+
+void TextIndexer::Tokenize(const char* Data, size_t Len, std::vector<std::string>& Tokens) {
+    size_t pos = 0;
+    std::string tok;
+    while (NextToken(Data, Len, pos, tok)) Tokens.push_back(tok);
+}
+
+TextIndexer::TextIndexer(const char* File) : FileName(File) {
+    Docs = Terms = 0;
+    Failed = false;
+}
+
+TextIndexer::~TextIndexer() {
+    for (std::map<std::thread::id, Segment*>::iterator it = Segments.begin(); it != Segments.end(); it++)
+        delete it->second;
+    for (size_t i = 0; i < SegmentFiles.size(); i++) unlink(SegmentFiles[i].c_str());
+}
+
+TextIndexer::Segment* TextIndexer::Current() {
+    std::lock_guard<std::mutex> guard(Lock);
+    Segment*& seg = Segments[std::this_thread::get_id()];
+    if (seg == NULL) seg = new Segment;
+    return seg;
+}
+
+void TextIndexer::AddTerm(Segment* seg, const std::string& Term) {
+    u_int32_t id = seg->Docs.size();
+    std::unordered_map<std::string, Posting>::iterator it = seg->Terms.find(Term);
+    if (it == seg->Terms.end()) {
+        Posting p = {0, 0, std::string()};
+        it = seg->Terms.emplace(Term, p).first;
+        seg->Bytes += Term.size() + sizeof(Posting) + 32;
+    }
+    Posting& p = it->second;
+    /* 同一封邮件中重复的词只记录一次 */
+    if (p.Last == id + 1) return;
+    size_t before = p.Data.size();
+    PutVarint(p.Data, p.Last ? id - (p.Last - 1) : id);
+    p.Last = id + 1;
+    p.Count++;
+    seg->Bytes += p.Data.size() - before;
+}
+
+void TextIndexer::AddText(Segment* seg, const std::string& Prefix, const char* Data, size_t Len, bool Body) {
+    std::string& tok = seg->Token;
+    size_t start = 0;
+    while (start < Len) {
+        /* 正文逐行处理，跳过编码后的附件 */
+        const char* eol = Body ? (const char*)memchr(Data + start, '\n', Len - start) : NULL;
+        size_t end = eol ? eol - Data : Len, pos = 0;
+        if (Body == false || IsBase64Line(Data + start, end - start) == false) {
+            while (NextToken(Data + start, end - start, pos, tok)) {
+                AddTerm(seg, tok);
+                if (Prefix.size()) AddTerm(seg, seg->Key.assign(Prefix).append(tok));
+            }
+        }
+        start = end + 1;
+    }
+}
+
+/* 邮件地址整体作为一个词 */
+static void Addresses(const std::string& Value, std::vector<std::string>& Addrs) {
+    size_t at = 0;
+    while ((at = Value.find('@', at)) != std::string::npos) {
+        size_t b = at, e = at + 1;
+        while (b > 0 && IsAddrChar(Value[b - 1])) b--;
+        while (e < Value.size() && IsAddrChar(Value[e])) e++;
+        if (b < at && e > at + 1 && e - b <= 256) {
+            Addrs.push_back(Value.substr(b, e - b));
+            std::string& addr = Addrs.back();
+            for (size_t j = 0; j < addr.size(); j++)
+                if (addr[j] >= 'A' && addr[j] <= 'Z') addr[j] += 'a' - 'A';
+        }
+        at = e;
+    }
+}
+
+/* Message-ID去掉尖括号和空白，转为小写 */
+static std::string NormalizeMsgId(const std::string& Value) {
+    std::string id;
+    for (size_t i = 0; i < Value.size(); i++) {
+        char c = Value[i];
+        if (c == '<' || c == '>' || c == ' ' || c == '\t' || c == '\r' || c == '\n') continue;
+        id.push_back(c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c);
+    }
+    return id;
+}
+
+/* 逐个取出首部字段（折行已展开），Name转为小写 */
+static bool NextField(const std::string& Header, size_t& Pos, std::string& Name, std::string& Value) {
+    while (Pos < Header.size()) {
+        size_t eol = Header.find('\n', Pos);
+        if (eol == std::string::npos) eol = Header.size();
+        std::string line(Header, Pos, eol - Pos);
+        Pos = eol + 1;
+        /* 后续以空白开头的行属于同一字段 */
+        while (Pos < Header.size() && (Header[Pos] == ' ' || Header[Pos] == '\t')) {
+            eol = Header.find('\n', Pos);
+            if (eol == std::string::npos) eol = Header.size();
+            line.append(Header, Pos, eol - Pos);
+            Pos = eol + 1;
+        }
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0) continue;
+        Name.assign(line, 0, colon);
+        for (size_t j = 0; j < Name.size(); j++)
+            if (Name[j] >= 'A' && Name[j] <= 'Z') Name[j] += 'a' - 'A';
+        size_t b = colon + 1, e = line.size();
+        while (b < e && (line[b] == ' ' || line[b] == '\t')) b++;
+        while (e > b && (line[e - 1] == '\r' || line[e - 1] == ' ')) e--;
+        Value.assign(line, b, e - b);
+        return true;
+    }
+    return false;
+}
+
+void TextIndexer::OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password) {
+    Current()->Users[Flow.Id] = User;
+}
+
+void TextIndexer::OnClose(const FlowInfo& Flow, const std::string& User) {
+    /* 抓包结束后在主线程中CloseAll时找不到，留到最后一起释放 */
+    Current()->Users.erase(Flow.Id);
+}
+
+void TextIndexer::OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part) {
+    Segment* seg = Current();
+    std::string text = Mail.GetText();
+    std::string header = Mail.GetHeader();
+    size_t body = 0;
+    /* BODY[]得到的是完整邮件，首部在第一个空行之前；BODY[TEXT]只有正文 */
+    if (header.empty() && Part == BODY_FULL) {
+        size_t end = text.find("\r\n\r\n");
+        if (end != std::string::npos) body = end + 4;
+        else if ((end = text.find("\n\n")) != std::string::npos) body = end + 2;
+        header.assign(text, 0, body);
+    }
+
+    TextDoc doc;
+    std::map<u_int64_t, std::string>::iterator user = seg->Users.find(Flow.Id);
+    if (user != seg->Users.end()) doc.User = user->second;
+    doc.Box = Box;
+    doc.Uid = Mail.GetUid();
+    doc.Hash = Fnv1a(text);
+    doc.Time = Flow.Time;
+    if (seg->Seen.insert(Fnv1a(doc.User + '\0' + doc.Box) ^ doc.Hash).second == false) return;
+
+    std::string name, value, msgid = NormalizeMsgId(Mail.GetMsgId());
+    std::vector<std::string> addrs;
+    size_t pos = 0;
+    while (NextField(header, pos, name, value)) {
+        const char* prefix = NULL;
+        if (name == "subject") {
+            prefix = "subject:";
+            if (doc.Subject.empty()) doc.Subject = value.substr(0, 256);
+        } else if (name == "from") prefix = "from:";
+        else if (name == "to" || name == "cc") prefix = "to:";
+        else if (name == "message-id" && msgid.empty()) msgid = NormalizeMsgId(value);
+        if (prefix == NULL) continue;
+        AddText(seg, prefix, value.data(), value.size(), false);
+        if (name == "subject") continue;
+        addrs.clear();
+        Addresses(value, addrs);
+        for (size_t i = 0; i < addrs.size(); i++) AddTerm(seg, prefix + addrs[i]);
+    }
+    if (msgid.size()) AddTerm(seg, "msgid:" + msgid);
+    AddText(seg, "", text.data() + body, text.size() - body, true);
+
+    seg->Bytes += sizeof(TextDoc) + doc.User.size() + doc.Box.size() + doc.Subject.size();
+    seg->Docs.push_back(doc);
+    if (seg->Bytes >= SEGMENT_LIMIT) Flush(seg);
+}
+
+void TextIndexer::Flush(Segment* seg) {
+    if (seg->Docs.empty()) return;
+    std::string file;
+    {
+        std::lock_guard<std::mutex> guard(Lock);
+        file = FileName + ".seg" + std::to_string(SegmentFiles.size());
+        SegmentFiles.push_back(file);
+    }
+    std::vector<std::unordered_map<std::string, Posting>::iterator> terms;
+    terms.reserve(seg->Terms.size());
+    for (std::unordered_map<std::string, Posting>::iterator it = seg->Terms.begin(); it != seg->Terms.end(); it++)
+        terms.push_back(it);
+    std::sort(terms.begin(), terms.end(),
+              [](const std::unordered_map<std::string, Posting>::iterator& a,
+                 const std::unordered_map<std::string, Posting>::iterator& b) {return a->first < b->first;});
+
+    FILE* out = fopen(file.c_str(), "wb");
+    bool ok = out != NULL;
+    std::string buf(SEGMENT_MAGIC);
+    PutVarint(buf, seg->Docs.size());
+    PutVarint(buf, terms.size());
+    for (size_t i = 0; i < terms.size() && ok; i++) {
+        /* 词，邮件数，最后的编号，倒排表 */
+        PutString(buf, terms[i]->first);
+        PutVarint(buf, terms[i]->second.Count);
+        PutVarint(buf, terms[i]->second.Last - 1);
+        PutString(buf, terms[i]->second.Data);
+        if (buf.size() >= (1 << 20)) {
+            ok = fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+            buf.clear();
+        }
+    }
+    for (size_t i = 0; i < seg->Docs.size() && ok; i++) {
+        const TextDoc& doc = seg->Docs[i];
+        PutString(buf, doc.User);
+        PutString(buf, doc.Box);
+        PutString(buf, doc.Subject);
+        PutVarint(buf, doc.Uid);
+        buf.append((const char*)&doc.Hash, 8);
+        buf.append((const char*)&doc.Time, 8);
+        if (buf.size() >= (1 << 20)) {
+            ok = fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+            buf.clear();
+        }
+    }
+    ok = ok && fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+    if (out && fclose(out) != 0) ok = false;
+    if (ok == false) {
+        std::lock_guard<std::mutex> guard(Lock);
+        Failed = true;
+    }
+    seg->Terms.clear();
+    seg->Docs.clear();
+    seg->Bytes = 0;
+}
+
+/* 归并时读取一个段文件，先按顺序读出各个词，之后是邮件 */
+struct SegmentReader {
+    FILE* In;
+    u_int64_t Docs, Terms, Base;
+    std::string Term, Data;
+    u_int64_t Count, Last;
+
+    SegmentReader() : In(NULL), Docs(0), Terms(0), Base(0) {}
+    ~SegmentReader() {if (In) fclose(In);}
+    bool Open(const std::string& FileName) {
+        In = fopen(FileName.c_str(), "rb");
+        if (In == NULL) return false;
+        setvbuf(In, NULL, _IOFBF, 1 << 20);
+        char magic[8];
+        return fread(magic, 1, 8, In) == 8 && memcmp(magic, SEGMENT_MAGIC, 8) == 0
+               && GetVarint(In, Docs) && GetVarint(In, Terms);
+    }
+    /* 读入下一个词，没有更多的词或出错时返回false */
+    bool Next() {
+        if (Terms == 0) return false;
+        Terms--;
+        return GetString(In, Term) && GetVarint(In, Count) && GetVarint(In, Last) && GetString(In, Data) && Data.size();
+    }
+};
+
+int TextIndexer::Merge() {
+    std::vector<SegmentReader> readers(SegmentFiles.size());
+    u_int64_t base = 0;
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (readers[i].Open(SegmentFiles[i]) == false) return NO;
+        readers[i].Base = base;
+        base += readers[i].Docs;
+    }
+    if (base > 0xffffffffull) return NO;
+    FILE* out = fopen(FileName.c_str(), "wb");
+    if (out == NULL) return NO;
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    bool ok = fseek(out, TEXT_HEADER_SIZE, SEEK_SET) == 0;
+    u_int64_t pos = TEXT_HEADER_SIZE;
+
+    /* 按（词，段的顺序）取最小者，同一个词的倒排表按段的顺序连接，编号保持升序 */
+    typedef std::pair<std::string, size_t> Head;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+    for (size_t i = 0; i < readers.size(); i++)
+        if (readers[i].Next()) heads.push(Head(readers[i].Term, i));
+    std::string blob, entries, chunk;
+    u_int64_t terms = 0;
+    while (heads.empty() == false && ok) {
+        std::string term = heads.top().first;
+        u_int64_t start = pos, count = 0, last = 0;
+        bool first = true;
+        while (heads.empty() == false && heads.top().first == term) {
+            SegmentReader& r = readers[heads.top().second];
+            heads.pop();
+            /* 只改写第一个差值：段内从0开始，改为相对前一段最后的编号 */
+            const u_int8_t* p = (const u_int8_t*)r.Data.data();
+            const u_int8_t* end = p + r.Data.size();
+            u_int64_t v;
+            if (GetVarint(p, end, v) == false) {
+                ok = false;
+                break;
+            }
+            chunk.clear();
+            PutVarint(chunk, first ? r.Base + v : r.Base + v - last);
+            chunk.append((const char*)p, end - p);
+            ok = fwrite(chunk.data(), 1, chunk.size(), out) == chunk.size();
+            pos += chunk.size();
+            count += r.Count;
+            last = r.Base + r.Last;
+            first = false;
+            if (r.Next()) heads.push(Head(r.Term, &r - &readers[0]));
+        }
+        u_int64_t entry[4] = {blob.size(), (count << 32) | term.size(), start, pos - start};
+        entries.append((const char*)entry, sizeof(entry));
+        blob += term;
+        terms++;
+    }
+    /* 各段的词已读完，接着是邮件，按段的顺序复制并记录偏移 */
+    std::vector<u_int64_t> offsets;
+    offsets.reserve(base);
+    std::string rec, s;
+    for (size_t i = 0; i < readers.size() && ok; i++) {
+        SegmentReader& r = readers[i];
+        if (r.Terms != 0) ok = false;
+        for (u_int64_t j = 0; j < r.Docs && ok; j++) {
+            u_int64_t uid;
+            char fixed[16];
+            rec.clear();
+            for (int k = 0; k < 3 && ok; k++) {
+                ok = GetString(r.In, s);
+                PutString(rec, s);
+            }
+            ok = ok && GetVarint(r.In, uid) && fread(fixed, 1, 16, r.In) == 16;
+            PutVarint(rec, uid);
+            rec.append(fixed, 16);
+            offsets.push_back(pos);
+            ok = ok && fwrite(rec.data(), 1, rec.size(), out) == rec.size();
+            pos += rec.size();
+        }
+    }
+    u_int64_t header[4] = {base, terms, pos, 0};
+    ok = ok && fwrite(offsets.data(), 8, offsets.size(), out) == offsets.size();
+    pos += offsets.size() * 8;
+    /* 词表中词的偏移改为文件中的绝对偏移 */
+    u_int64_t blob_at = pos;
+    ok = ok && fwrite(blob.data(), 1, blob.size(), out) == blob.size();
+    pos += blob.size();
+    header[3] = pos;
+    for (size_t i = 0; i < entries.size(); i += TERM_ENTRY_SIZE) {
+        u_int64_t at = Get64((const u_int8_t*)&entries[i]) + blob_at;
+        memcpy(&entries[i], &at, 8);
+    }
+    ok = ok && fwrite(entries.data(), 1, entries.size(), out) == entries.size();
+    ok = ok && fseek(out, 0, SEEK_SET) == 0 && fwrite(TEXT_MAGIC, 1, 8, out) == 8
+         && fwrite(header, 8, 4, out) == 4;
+    if (fclose(out) != 0) ok = false;
+    Docs = base;
+    Terms = terms;
+    return ok ? OK : NO;
+}
+
+int TextIndexer::Close() {
+    for (std::map<std::thread::id, Segment*>::iterator it = Segments.begin(); it != Segments.end(); it++)
+        Flush(it->second);
+    int ret = Failed ? NO : Merge();
+    for (size_t i = 0; i < SegmentFiles.size(); i++) unlink(SegmentFiles[i].c_str());
+    SegmentFiles.clear();
+    return ret;
+}
+
+TextIndex::TextIndex(const char* FileName) {
+    int fd = open(FileName, O_RDONLY);
+    if (fd < 0) throw(FILE_OPEN_ERR);
+    off_t size = lseek(fd, 0, SEEK_END);
+    void* map = size >= TEXT_HEADER_SIZE ? mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) throw(FILE_OPEN_ERR);
+    Map = (const u_int8_t*)map;
+    MapSize = size;
+    const u_int64_t* header = (const u_int64_t*)(Map + 8);
+    DocCount = header[0];   TermCount = header[1];
+    DocTable = header[2];   TermTable = header[3];
+    if (memcmp(Map, TEXT_MAGIC, 8) != 0 || DocTable + DocCount * 8 > MapSize
+        || TermTable + TermCount * TERM_ENTRY_SIZE != MapSize) {
+        munmap((void*)Map, MapSize);
+        throw(FILE_OPEN_ERR);
+    }
+}
+
+TextIndex::~TextIndex() {
+    munmap((void*)Map, MapSize);
+}
+
+size_t TextIndex::Lookup(const std::string& Term, std::vector<u_int32_t>& Docs) const {
+    Docs.clear();
+    u_int64_t lo = 0, hi = TermCount;
+    while (lo < hi) {
+        u_int64_t mid = (lo + hi) / 2;
+        const u_int8_t* entry = Map + TermTable + mid * TERM_ENTRY_SIZE;
+        u_int64_t e[4] = {Get64(entry), Get64(entry + 8), Get64(entry + 16), Get64(entry + 24)};
+        size_t len = e[1] & 0xffffffff;
+        if (e[0] + len > MapSize) return 0;
+        int c = memcmp(Map + e[0], Term.data(), std::min(len, Term.size()));
+        if (c == 0) c = len < Term.size() ? -1 : (len > Term.size() ? 1 : 0);
+        if (c < 0) lo = mid + 1;
+        else if (c > 0) hi = mid;
+        else {
+            if (e[2] + e[3] > MapSize) return 0;
+            const u_int8_t* p = Map + e[2], * end = p + e[3];
+            u_int64_t v, id = 0;
+            Docs.reserve(e[1] >> 32);
+            while (p < end && GetVarint(p, end, v)) {
+                id += v;
+                Docs.push_back(id);
+            }
+            return Docs.size();
+        }
+    }
+    return 0;
+}
+
+size_t TextIndex::Search(const std::vector<std::string>& Terms, std::vector<u_int32_t>& Docs) const {
+    Docs.clear();
+    if (Terms.empty()) return 0;
+    std::vector<std::vector<u_int32_t> > lists(Terms.size());
+    for (size_t i = 0; i < Terms.size(); i++)
+        if (Lookup(Terms[i], lists[i]) == 0) return 0;
+    /* 从最短的倒排表开始求交集 */
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<u_int32_t>& a, const std::vector<u_int32_t>& b) {return a.size() < b.size();});
+    Docs.swap(lists[0]);
+    std::vector<u_int32_t> tmp;
+    for (size_t i = 1; i < lists.size() && Docs.size(); i++) {
+        tmp.clear();
+        std::set_intersection(Docs.begin(), Docs.end(), lists[i].begin(), lists[i].end(), std::back_inserter(tmp));
+        Docs.swap(tmp);
+    }
+    return Docs.size();
+}
+
+int TextIndex::GetDoc(u_int32_t Id, TextDoc& Doc) const {
+    if (Id >= DocCount) return NO;
+    u_int64_t off = Get64(Map + DocTable + (u_int64_t)Id * 8);
+    if (off >= DocTable) return NO;
+    const u_int8_t* p = Map + off, * end = Map + DocTable;
+    std::string* fields[3] = {&Doc.User, &Doc.Box, &Doc.Subject};
+    u_int64_t v;
+    for (int i = 0; i < 3; i++) {
+        if (GetVarint(p, end, v) == false || v > (u_int64_t)(end - p)) return NO;
+        fields[i]->assign((const char*)p, v);
+        p += v;
+    }
+    if (GetVarint(p, end, v) == false || end - p < 16) return NO;
+    Doc.Uid = v;
+    memcpy(&Doc.Hash, p, 8);
+    memcpy(&Doc.Time, p + 8, 8);
+    return OK;
+}
@@ -0,0 +1,121 @@
+/*---------------------
+* target: 邮件内容的全文倒排索引（建立与查询）
+* -------------------*/
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "PeelHeader.h"
+
+/* 索引文件和临时段文件开头的魔数 */
+#define TEXT_MAGIC          "IMAPTXT1"
+#define SEGMENT_MAGIC       "IMAPSEG1"
+/* 内存中的段估计超过这个大小时写出为临时段文件 */
+#define SEGMENT_LIMIT       (64 << 20)
+/* 词的长度范围（字节），超出的不索引 */
+#define TOKEN_MIN           2
+#define TOKEN_MAX           32
+/* 索引文件首部：魔数，邮件数，词数，以及邮件表、词表的偏移（均为8字节） */
+#define TEXT_HEADER_SIZE    40
+/* 词表每项：词的偏移，词长，邮件数，倒排表的偏移和字节数 */
+#define TERM_ENTRY_SIZE     32
+
+/* 一封被索引的邮件，Hash与body事件中的相同（-b保存为hash.eml） */
+struct TextDoc {
+    std::string User, Box, Subject;
+    u_int32_t Uid;
+    u_int64_t Hash;
+    int64_t Time;
+};
+
+/*------------------------------------------------------------------------------
+* class TextIndexer
+* 作为会话的事件回调，在得到完整邮件（OnBody）时建立索引：
+*   1） 正文和Subject、From、To/Cc的词不分字段索引，同时以"subject:"、"from:"、"to:"
+*       为前缀再索引一次，From和To中的完整地址以及Message-ID（"msgid:"）整体索引；
+*   2） 词为连续的字母数字（以及非ASCII字节，UTF-8的词保持完整），转为小写；
+*       正文中像base64的长行跳过；
+*   3） 每个抓包线程有自己的段，邮件编号在段内递增，倒排表为编号差的varint；
+*       段超过SEGMENT_LIMIT时按词排序写出为临时文件（索引文件名.segN）；
+*   4） Close时写出剩余的段，按词归并所有段得到索引文件，段内编号加上之前各段的邮件数，
+*       归并时只需要改写每个倒排表的第一个差值；
+*   5） 同一线程中同一用户、同一邮箱下内容相同的邮件（再次FETCH）只索引一次；
+*       只取了正文（BODY[TEXT]）时没有首部，不按首部解析
+* 索引文件：首部，各倒排表，邮件表（每封邮件为varint编码的记录，之后为各记录的偏移），
+* 词（按字节序排列），词表（定长，可以二分查找）；整数除varint外均为本机字节序的8或4字节
+* ----------------------------------------------------------------------------*/
+class TextIndexer : public SessionListener {
+    struct Posting {
+        u_int32_t Last;         /* 最后加入的邮件编号加一，0表示还没有 */
+        u_int32_t Count;
+        std::string Data;
+    };
+    struct Segment {
+        std::unordered_map<std::string, Posting> Terms;
+        std::vector<TextDoc> Docs;
+        /* 会话编号到用户名，同一会话的事件总在同一线程 */
+        std::map<u_int64_t, std::string> Users;
+        /* 已经索引的邮件（用户、邮箱和内容的哈希），写出段后仍然保留 */
+        std::unordered_set<u_int64_t> Seen;
+        /* 切分时重复使用的缓冲区 */
+        std::string Token, Key;
+        size_t Bytes;
+        Segment() : Bytes(0) {}
+    };
+    std::string FileName;
+    std::map<std::thread::id, Segment*> Segments;
+    std::vector<std::string> SegmentFiles;
+    std::mutex Lock;
+    u_int64_t Docs, Terms;
+    bool Failed;
+
+    Segment* Current();
+    void AddTerm(Segment* seg, const std::string& Term);
+    void AddText(Segment* seg, const std::string& Prefix, const char* Data, size_t Len, bool Body);
+    /* 按词排序写出段并清空 */
+    void Flush(Segment* seg);
+    int Merge();
+    TextIndexer(const TextIndexer&);
+    TextIndexer& operator=(const TextIndexer&);
+public:
+    TextIndexer(const char* FileName);
+    ~TextIndexer();
+    /* 在所有抓包线程结束后调用，写出索引文件并删除临时段，失败时返回NO */
+    int Close();
+    u_int64_t size() const {return Docs;}
+    u_int64_t TermCount() const {return Terms;}
+
+    void OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password);
+    void OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part);
+    void OnClose(const FlowInfo& Flow, const std::string& User);
+
+    /* 把一段文本切分为词（已转为小写），建立索引和查询使用相同的规则 */
+    static void Tokenize(const char* Data, size_t Len, std::vector<std::string>& Tokens);
+};
+
+/*------------------------------------------------------------------------------
+* class TextIndex
+* 查询TextIndexer写出的索引文件，文件整体映射到内存，查找词为二分查找；
+* 打开失败或格式错误时抛出FILE_OPEN_ERR
+* ----------------------------------------------------------------------------*/
+class TextIndex {
+    const u_int8_t* Map;
+    size_t MapSize;
+    u_int64_t DocCount, TermCount, DocTable, TermTable;
+
+    TextIndex(const TextIndex&);
+    TextIndex& operator=(const TextIndex&);
+public:
+    TextIndex(const char* FileName);
+    ~TextIndex();
+    u_int64_t size() const {return DocCount;}
+    /* 包含Term的邮件编号（升序），返回个数 */
+    size_t Lookup(const std::string& Term, std::vector<u_int32_t>& Docs) const;
+    /* 所有Terms都包含的邮件（升序） */
+    size_t Search(const std::vector<std::string>& Terms, std::vector<u_int32_t>& Docs) const;
+    int GetDoc(u_int32_t Id, TextDoc& Doc) const;
+};
@@ -0,0 +1,44 @@
+#include "UserStore.h"
+#include "Profile.h"
+
+UserStore::UserData::UserData() {
+    /* 与Session中的根邮箱相同：根邮箱不可选择，INBOX总是存在 */
+    Root.SetSel(false);
+    Root.AppendBox("inbox");
+    Latest = 0;
+}
+
+UserStore::~UserStore() {
+    for (std::map<std::string, UserData*>::iterator it = Users.begin(); it != Users.end(); it++)
+        delete it->second;
+}
+
+void UserStore::Merge(const std::string& User, const std::string& Password, Mailbox& Root, int64_t Time) {
+    std::lock_guard<std::mutex> guard(Lock);
+    StageTimer timer(STAGE_SAVE);
+    std::map<std::string, UserData*>::iterator it = Users.find(User);
+    if (it == Users.end()) it = Users.emplace(User, new UserData).first;
+    UserData* data = it->second;
+    /* 会话不一定按时间顺序结束，以最后一个数据包的时间判断新旧 */
+    bool newer = Time >= data->Latest;
+    data->Root.Merge(Root, newer);
+    if (newer) data->Latest = Time;
+    if (Password.empty() == false && (newer || data->Password.empty())) data->Password = Password;
+}
+
+int UserStore::Save() {
+    std::lock_guard<std::mutex> guard(Lock);
+    int ret = OK;
+    for (std::map<std::string, UserData*>::iterator it = Users.begin(); it != Users.end(); it++) {
+        if (SaveUserTree(it->first, it->second->Password, it->second->Root, DecodeMime) != OK) ret = NO;
+        delete it->second;
+    }
+    Users.clear();
+    return ret;
+}
+
+void UserStore::Measure(MemReport& report) {
+    std::lock_guard<std::mutex> guard(Lock);
+    for (std::map<std::string, UserData*>::iterator it = Users.begin(); it != Users.end(); it++)
+        it->second->Root.Measure(report);
+}
@@ -0,0 +1,45 @@
+/*---------------------
+* target: 按用户合并各会话的邮箱，每个用户只保存一次
+* -------------------*/
+#pragma once
+#include <map>
+#include <mutex>
+#include <string>
+#include "ImapResolve.h"
+
+/*------------------------------------------------------------------------------
+* class UserStore
+* 同一用户的多个连接各自有一个Session和一棵邮箱树，会话结束时（不是检查点时）把邮箱树并入这里
+* （见Mailbox::Merge），邮件只保留一份，结束时每个用户写一次目录（./用户名/）：
+*   1） 按会话最后一个数据包的时间判断新旧，较新的会话的标志和邮箱数值覆盖已有的，
+*       较旧的只填补未知的部分；
+*   2） 密码取最近一次非空的；
+*   3） Merge加锁，多个抓包线程的引擎可以共用一个UserStore；
+*   4） User不能为空，没有登录的会话由Session按客户端地址命名（见Session::Owner）
+* ----------------------------------------------------------------------------*/
+class UserStore {
+    struct UserData {
+        Mailbox Root;
+        std::string Password;
+        /* 已经并入的会话中最晚的时间（微秒） */
+        int64_t Latest;
+        UserData();
+    };
+    std::map<std::string, UserData*> Users;
+    std::mutex Lock;
+    bool DecodeMime;
+
+    UserStore(const UserStore&);
+    UserStore& operator=(const UserStore&);
+public:
+    UserStore() : DecodeMime(false) {}
+    /* 保存时同时把邮件的MIME部分解码保存（见Message::save） */
+    void SetDecodeMime(bool Decode) {DecodeMime = Decode;}
+    ~UserStore();
+    /* 并入一个会话的邮箱树，之后Root为空 */
+    void Merge(const std::string& User, const std::string& Password, Mailbox& Root, int64_t Time);
+    /* 把所有用户写入当前目录并释放，有用户写入失败时返回NO */
+    int Save();
+    size_t size() const {return Users.size();}
+    void Measure(MemReport& report);
+};
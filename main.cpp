@@ -1,13 +1,311 @@
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <ftw.h>
 #include "PeelHeader.h"
 #include "ImapResolve.h"
+#include "Stats.h"
+#include "Profile.h"
+#include "EventWriter.h"
+#include "LiveCapture.h"
+#include "PcapWriter.h"
+#include "UserStore.h"
+#include "TextIndex.h"
 
 /*----------------------
-* 用argv接收要处理的文件名
-* 文件需要使用绝对路径
+* 用argv接收要处理的文件名，缺省为all_test.pcap
+* 文件可以是pcap，也可以是.pcap.gz/.pcap.zst压缩文件
+* 选项：
+*   -s file   将统计报告（每行一个JSON）写入file，"-"为标准输出
+*   -i sec    周期报告的间隔秒数，0表示只输出最终报告，缺省为STAT_INTERVAL
+*   -p n      开启各阶段的延迟统计，每n次调用抽样一次（取2的幂），结束时输出到标准错误；
+*             也可用环境变量IMAP_PROFILE=n开启；开启-s时同时写入一行JSON
+*   -e file   将会话事件（每行一个JSON，见EventWriter.h）实时写入file，"-"为标准输出
+*   -b dir    与-e同时使用，邮件内容按哈希保存到dir
+*   -n        会话结束时不保存目录结构，只输出事件
+*   -l iface  在网卡iface上实时抓包（需要CAP_NET_RAW），代替读取文件，收到SIGINT/SIGTERM时结束
+*   -t n      实时抓包的线程数，多于1时按连接分流，缺省为1
+*   -x file   不解析会话，只把IMAP的数据包写入新的pcap文件file
+*   -X file   把各会话的数据包偏移写入索引file（见PcapWriter.h）：与-x同时使用时为抽取出的文件中的偏移，
+*             否则为输入文件中的偏移，并记录各会话的用户名
+*   -r file   按索引file只重新处理选出的会话，直接定位到各数据包，耗时只与选出的会话大小有关；
+*             输入文件应是建立索引时对应的文件
+*   -u user   与-r同时使用，只处理用户user的会话
+*   -c ip[:port]  与-r同时使用，只处理该客户端的会话
+*   -m        保存时每封邮件旁边另外保存解码后的MIME部分
+*   -f sec[:size] 长时间的会话每经过sec秒（数据包时间）或收到size字节（可带K/M/G）时，把已经完整的
+*             邮件写入检查点目录并释放内存，结束保存时链接过去，之后删除该目录；检查点目录每次运行
+*             按CHECKPOINT_DIR新建（XXXXXX为随机字符），不与之前运行留下的目录混用
 * --------------------*/
+#define CHECKPOINT_DIR  "./.checkpoint.XXXXXX"
+static LiveCapture* ActiveCapture;
+/* 给人看的提示信息；事件或统计报告写到标准输出时改用标准错误，不混入JSON */
+static FILE* Console = stdout;
+
+static void StopCapture(int) {
+    if (ActiveCapture) ActiveCapture->Stop();
+}
+
+/* 解析"ip"或"ip:port"，结果为主机字节序 */
+static int ParseClient(const char* Text, u_int32& IP, u_int16& Port) {
+    std::string addr(Text);
+    size_t colon = addr.find(':');
+    Port = 0;
+    if (colon != std::string::npos) {
+        Port = atoi(addr.c_str() + colon + 1);
+        addr.erase(colon);
+    }
+    struct in_addr in;
+    if (inet_pton(AF_INET, addr.c_str(), &in) != 1) return NO;
+    IP = ntohl(in.s_addr);
+    return OK;
+}
+
+/* 解析"sec"或"sec:size"，size可带K/M/G */
+static int ParseCheckpoint(const char* Text, CheckpointPolicy& Policy) {
+    char* end;
+    Policy.Interval = (int64_t)strtol(Text, &end, 10) * 1000000;
+    if (*end == ':') {
+        Policy.Bytes = strtoull(end + 1, &end, 10);
+        switch (*end) {
+        case 'G': case 'g': Policy.Bytes <<= 30;    end++;  break;
+        case 'M': case 'm': Policy.Bytes <<= 20;    end++;  break;
+        case 'K': case 'k': Policy.Bytes <<= 10;    end++;  break;
+        }
+    }
+    if (*end != '\0' || Policy.Interval < 0 || (Policy.Interval == 0 && Policy.Bytes == 0)) return NO;
+    return OK;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+/* 会话结束时并入用户级存储，之后每个用户保存一次；之前先报告内存使用；有用户保存失败时返回NO */
+template <class Input>
+static int Finish(Input& data, UserStore& Users, StatsReporter& Reporter) {
+    MemReport report;
+    data.Measure(report);
+    Users.Measure(report);
+    report.Print(Console);
+    data.CloseAll();
+    if (Users.size() > 0) fprintf(Console, "Saving %llu users\n", (unsigned long long)Users.size());
+    int ret = Users.Save();
+    if (ret != OK) fprintf(stderr, "Cannot save some users\n");
+    Reporter.Report(&report, true);
+    return ret;
+}
+
 int main(int args, char* argv[]) {
-    Package data("all_test.pcap");
-    data.GetData();
-    return 0;
-}
\ No newline at end of file
+    const char* StatsFile = NULL, * EventFile = NULL, * BodyDir = NULL, * Interface = NULL;
+    const char* ExtractFile = NULL, * IndexFile = NULL, * ReplayFile = NULL, * User = NULL, * TextFile = NULL;
+    u_int32 ClientIP = 0;
+    u_int16 ClientPort = 0;
+    bool Save = true, Decode = false;
+    int Saved = OK;
+    /* 出错但仍然处理完其余部分时置位，以非0退出 */
+    bool Failed = false;
+    CheckpointPolicy Policy, * Checkpoint = NULL;
+    int Interval = STAT_INTERVAL, Sample = 0, Threads = 1, opt;
+    if (getenv("IMAP_PROFILE")) Sample = atoi(getenv("IMAP_PROFILE"));
+    while ((opt = getopt(args, argv, "s:i:p:e:b:nml:t:x:X:r:u:c:I:f:")) != -1) {
+        switch (opt) {
+        case 's':
+            StatsFile = optarg;
+            break;
+        case 'i':
+            Interval = atoi(optarg);
+            break;
+        case 'p':
+            Sample = atoi(optarg);
+            break;
+        case 'e':
+            EventFile = optarg;
+            break;
+        case 'b':
+            BodyDir = optarg;
+            break;
+        case 'n':
+            Save = false;
+            break;
+        case 'm':
+            Decode = true;
+            break;
+        case 'l':
+            Interface = optarg;
+            break;
+        case 't':
+            Threads = atoi(optarg);
+            break;
+        case 'x':
+            ExtractFile = optarg;
+            break;
+        case 'X':
+            IndexFile = optarg;
+            break;
+        case 'r':
+            ReplayFile = optarg;
+            break;
+        case 'u':
+            User = optarg;
+            break;
+        case 'I':
+            TextFile = optarg;
+            break;
+        case 'f':
+            if (ParseCheckpoint(optarg, Policy) != OK) {
+                fprintf(stderr, "Bad checkpoint setting %s\n", optarg);
+                return 1;
+            }
+            Checkpoint = &Policy;
+            break;
+        case 'c':
+            if (ParseClient(optarg, ClientIP, ClientPort) != OK) {
+                fprintf(stderr, "Bad client address %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s stats.json] [-i seconds] [-p sample] [-e events.json [-b dir]] [-I text.idx] [-n | -m] [-f sec[:size]] [-l iface [-t threads] | [-x out.pcap] [-X out.idx] [-r in.idx [-u user] [-c ip:port]] file]\n", argv[0]);
+            return 1;
+        }
+    }
+    const char* FileName = optind < args ? argv[optind] : "all_test.pcap";
+
+    FILE* StatsOut = NULL;
+    if (StatsFile) {
+        StatsOut = strcmp(StatsFile, "-") == 0 ? stdout : fopen(StatsFile, "w");
+        if (StatsOut == NULL) {
+            fprintf(stderr, "Cannot write %s\n", StatsFile);
+            return 1;
+        }
+    }
+    FILE* EventOut = NULL;
+    if (EventFile) {
+        EventOut = strcmp(EventFile, "-") == 0 ? stdout : fopen(EventFile, "w");
+        if (EventOut == NULL) {
+            fprintf(stderr, "Cannot write %s\n", EventFile);
+            return 1;
+        }
+    }
+    if (StatsOut == stdout || EventOut == stdout) Console = stderr;
+    StatsReporter Reporter(StatsOut, Interval);
+    EventWriter* Events = EventOut ? new EventWriter(EventOut, BodyDir) : NULL;
+    TextIndexer* Indexer = TextFile ? new TextIndexer(TextFile) : NULL;
+    ListenerGroup Listeners;
+    Listeners.Add(Events);
+    Listeners.Add(Indexer);
+    SessionListener* Listener = Listeners.empty() ? NULL : &Listeners;
+    /* -n时不保存，会话也不必并入 */
+    UserStore Users;
+    UserStore* Store = Save ? &Users : NULL;
+    /* -m时每封.eml旁边另外保存解码后的MIME部分 */
+    Users.SetDecodeMime(Decode);
+    /* 不保存时检查点只释放内容，不写文件 */
+    char CheckpointDir[] = CHECKPOINT_DIR;
+    if (Checkpoint && Save) {
+        if (mkdtemp(CheckpointDir) == NULL) {
+            fprintf(stderr, "Cannot create %s\n", CheckpointDir);
+            return 1;
+        }
+        Policy.Dir = CheckpointDir;
+    }
+    if (Sample > 0) GProfile.Enable(Sample);
+    try {
+        if (Interface) {
+            LiveCapture live(Interface, Threads);
+            live.SetReporter(&Reporter);
+            live.SetListener(Listener);
+            live.SetSaveOnClose(Save);
+            live.SetStore(Store);
+            live.SetCheckpoint(Checkpoint);
+            ActiveCapture = &live;
+            signal(SIGINT, StopCapture);
+            signal(SIGTERM, StopCapture);
+            live.Run();
+            ActiveCapture = NULL;
+            fprintf(Console, "Captured %llu packets on %s, %llu dropped by the kernel\n",
+                    (unsigned long long)GStats.CapturePackets, Interface, (unsigned long long)GStats.CaptureDrops);
+            Saved = Finish(live, Users, Reporter);
+        } else if (ExtractFile) {
+            Package data(FileName);
+            data.SetReporter(&Reporter);
+            PcapWriter out(ExtractFile, data.GetFileHeader());
+            FlowIndex index;
+            data.Extract(out, IndexFile ? &index : NULL);
+            const char* failed = NULL;
+            if (out.Close() != OK) failed = ExtractFile;
+            else if (IndexFile && index.Save(IndexFile) != OK) failed = IndexFile;
+            if (failed) {
+                fprintf(stderr, "Cannot write %s\n", failed);
+                delete Events;
+                delete Indexer;
+                return 1;
+            }
+            fprintf(Console, "Extracted %llu of %llu packets (%llu bytes) to %s\n", (unsigned long long)out.size(),
+                    (unsigned long long)GStats.PacketsRead, (unsigned long long)out.Offset(), ExtractFile);
+            if (IndexFile) fprintf(Console, "Indexed %llu sessions in %s\n", (unsigned long long)index.size(), IndexFile);
+            Reporter.Report(NULL, true);
+        } else {
+            Package data(FileName);
+            data.SetReporter(&Reporter);
+            data.SetListener(Listener);
+            data.SetSaveOnClose(Save);
+            data.SetStore(Store);
+            data.SetCheckpoint(Checkpoint);
+            FlowIndex index;
+            if (ReplayFile) {
+                std::vector<u_int64_t> offsets;
+                if (index.Load(ReplayFile) != OK) {
+                    fprintf(stderr, "Cannot read index %s\n", ReplayFile);
+                    delete Events;
+                    delete Indexer;
+                    return 1;
+                }
+                size_t selected = index.Select(User, ClientIP, ClientPort, offsets);
+                fprintf(Console, "Replaying %llu of %llu sessions (%llu packets)\n", (unsigned long long)selected,
+                        (unsigned long long)index.size(), (unsigned long long)offsets.size());
+                if (data.Replay(offsets) != OK) {
+                    fprintf(stderr, "%s does not match the index %s\n", FileName, ReplayFile);
+                    Failed = true;
+                }
+            } else {
+                if (IndexFile) data.SetIndex(&index);
+                data.GetData();
+                if (IndexFile && index.Save(IndexFile) != OK) fprintf(stderr, "Cannot write %s\n", IndexFile);
+            }
+            Saved = Finish(data, Users, Reporter);
+        }
+    } catch (int err) {
+        if (Interface) fprintf(stderr, "Cannot capture on %s (error %d: %s)\n", Interface, err, strerror(errno));
+        else fprintf(stderr, "Cannot read %s (error %d)\n", FileName, err);
+        delete Events;
+        delete Indexer;
+        return 1;
+    }
+    /* 保存的邮件已经链接到检查点文件，保存失败时保留检查点，其中可能有没能保存的邮件 */
+    if (Saved != OK) {
+        if (Policy.Dir.size()) fprintf(stderr, "Checkpoint files are kept in %s\n", CheckpointDir);
+        Failed = true;
+    } else if (Policy.Dir.size()) nftw(CheckpointDir, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    /* 等待写线程写完所有事件 */
+    delete Events;
+    if (EventOut && EventOut != stdout) fclose(EventOut);
+    /* 归并各线程的段，写出全文索引 */
+    if (Indexer) {
+        if (Indexer->Close() == OK)
+            fprintf(Console, "Indexed %llu messages (%llu terms) in %s\n", (unsigned long long)Indexer->size(),
+                    (unsigned long long)Indexer->TermCount(), TextFile);
+        else fprintf(stderr, "Cannot write %s\n", TextFile);
+        delete Indexer;
+    }
+    if (GProfile.Enabled) {
+        GProfile.Dump(stderr);
+        if (StatsOut) GProfile.WriteJson(StatsOut);
+    }
+    if (StatsOut && StatsOut != stdout) fclose(StatsOut);
+    return Failed ? 1 : 0;
+}
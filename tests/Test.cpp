@@ -0,0 +1,34 @@
+#include <cstring>
+#include "Test.h"
+
+int TestFailures = 0;
+
+static const struct {
+    const char* Name;
+    void (*Run)();
+} Tests[] = {
+    {"seqtracker", TestSeqTracker},
+    {"mailindex", TestMailIndex},
+    {"tagcodec", TestTagCodec},
+    {"mime", TestMime},
+    {"inflater", TestInflater},
+    {"replay", TestReplay},
+};
+
+/* 不带参数时运行全部测试，否则只运行给出名称的测试 */
+int main(int argc, char* argv[]) {
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(Tests) / sizeof(Tests[0]); i++) {
+        bool selected = argc == 1;
+        for (int j = 1; j < argc; j++) selected = selected || strcmp(argv[j], Tests[i].Name) == 0;
+        if (selected == false) continue;
+        int before = TestFailures;
+        Tests[i].Run();
+        if (TestFailures == before) printf("%-12s ok\n", Tests[i].Name);
+        else {
+            printf("%-12s FAILED (%d checks)\n", Tests[i].Name, TestFailures - before);
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
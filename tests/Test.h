@@ -0,0 +1,22 @@
+/*---------------------
+* target: make test运行的各项测试；CHECK失败时输出位置并计数，不中断其余检查
+* -------------------*/
+#pragma once
+#include <cstdio>
+
+extern int TestFailures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        TestFailures++; \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+/* 每项测试一个文件，见Test.cpp中的列表 */
+void TestSeqTracker();
+void TestMailIndex();
+void TestTagCodec();
+void TestMime();
+void TestInflater();
+void TestReplay();
@@ -0,0 +1,70 @@
+#include <vector>
+#include <zlib.h>
+#include "../ImapResolve.h"
+#include "Test.h"
+
+/* 把Plain压缩为原始deflate流，每个数据段之后同步刷新，与客户端实际发出的相同 */
+static std::string Deflate(const std::string& Plain) {
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    deflateInit2(&strm, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&strm, Plain.size()) + 64, '\0');
+    strm.next_in = (Bytef*)Plain.data();   strm.avail_in = Plain.size();
+    strm.next_out = (Bytef*)&out[0];    strm.avail_out = out.size();
+    deflate(&strm, Z_SYNC_FLUSH);
+    out.resize(out.size() - strm.avail_out);
+    deflateEnd(&strm);
+    return out;
+}
+
+typedef std::vector<std::pair<u_int32_t, std::string> > Segments;
+
+static std::string InflateAll(const Segments& segs, bool& broken) {
+    Inflater inflater;
+    std::string all, out;
+    for (size_t i = 0; i < segs.size(); i++)
+        if (inflater.Inflate(segs[i].second, segs[i].first, out) == OK) all += out;
+    broken = inflater.IsBroken();
+    CHECK(inflater.GetPlainSeq() == all.size());
+    return all;
+}
+
+void TestInflater() {
+    std::string plain;
+    for (int i = 0; i < 20000; i++) plain += "* " + std::to_string(i * 7919 % 10007) + " FETCH (FLAGS (\\Seen))\r\n";
+    std::string comp = Deflate(plain);
+    /* 原始序列号从回绕前开始 */
+    Segments segs;
+    for (size_t i = 0; i < comp.size(); i += 1000) segs.push_back(std::make_pair(0xfffff000u + (u_int32_t)i, comp.substr(i, 1000)));
+    bool broken;
+
+    CHECK(InflateAll(segs, broken) == plain && broken == false);
+
+    /* 相邻的数据段交换顺序：后一段先缓存，空洞补齐后一起解压 */
+    Segments swapped = segs;
+    for (size_t i = 1; i + 1 < swapped.size(); i += 2) std::swap(swapped[i], swapped[i + 1]);
+    CHECK(InflateAll(swapped, broken) == plain && broken == false);
+
+    /* 重传：完全重复的段，以及在缓存中等待、解压时只有后半部分是新数据的段 */
+    Segments retrans = swapped;
+    std::pair<u_int32_t, std::string> part = segs[3];
+    part.second.resize(500);
+    retrans.insert(retrans.begin() + 1, part);
+    retrans.push_back(segs[5]);
+    retrans.insert(retrans.begin() + 2, std::make_pair(segs[2].first + 200, segs[2].second.substr(200) + segs[3].second));
+    CHECK(InflateAll(retrans, broken) == plain && broken == false);
+
+    /* 空洞一直没有补齐：之前的数据照常输出，之后的无法解压 */
+    Segments lost = segs;
+    lost.erase(lost.begin() + lost.size() / 2);
+    std::string got = InflateAll(lost, broken);
+    CHECK(got.size() < plain.size() && plain.compare(0, got.size(), got) == 0 && got.size() > 0);
+
+    /* 缓存超过INFLATE_PENDING后放弃该方向 */
+    Segments flood;
+    flood.push_back(segs[0]);
+    std::string junk(64 << 10, 'x');
+    for (u_int32_t at = 1 << 20; at < (4 << 20); at += junk.size()) flood.push_back(std::make_pair(segs[0].first + at, junk));
+    InflateAll(flood, broken);
+    CHECK(broken);
+}
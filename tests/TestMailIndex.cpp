@@ -0,0 +1,81 @@
+#include <iterator>
+#include <map>
+#include <vector>
+#include "../ImapResolve.h"
+#include "Test.h"
+
+typedef std::vector<std::pair<int, Message*> > Entries;
+
+/* 随机操作，与std::map实现的结果比较；EraseRange后右侧键的偏移是延迟下推的，
+* 之后的查找、插入、按邮件删除和遍历都要看到偏移后的序列号 */
+void TestMailIndex() {
+    MailIndex index;
+    std::map<int, Message*> ref;
+    std::map<Message*, int> where;
+    std::vector<Message> mails(500);
+    u_int32_t seed = 12345;
+    int before = TestFailures;
+    for (int step = 0; step < 100000 && TestFailures == before; step++) {
+        seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+        int key = 1 + seed % 1000;
+        Message* mail = &mails[(seed >> 10) % mails.size()];
+        switch ((seed >> 20) % 6) {
+        case 0:
+            if (where.count(mail)) break;
+            CHECK(index.Insert(key, mail) == ref.emplace(key, mail).second);
+            if (ref[key] == mail) where[mail] = key;
+            break;
+        case 1: {
+            std::map<Message*, int>::iterator it = where.find(mail);
+            CHECK(index.EraseMail(mail) == (it != where.end()));
+            if (it != where.end()) {
+                ref.erase(it->second);
+                where.erase(it);
+            }
+            break;
+        }
+        case 2: {
+            /* 区间删除，之后的序列号前移 */
+            int end = key + (seed >> 8) % 6;
+            std::vector<Message*> removed;
+            index.EraseRange(key, end, removed);
+            std::map<int, Message*> next;
+            size_t count = 0;
+            for (std::map<int, Message*>::iterator it = ref.begin(); it != ref.end(); it++) {
+                if (it->first < key) next.insert(*it);
+                else if (it->first >= end) next[it->first - (end - key)] = it->second;
+                else {
+                    where.erase(it->second);
+                    count++;
+                }
+            }
+            CHECK(removed.size() == count);
+            ref.swap(next);
+            for (std::map<int, Message*>::iterator it = ref.begin(); it != ref.end(); it++) where[it->second] = it->first;
+            break;
+        }
+        case 3: {
+            std::map<int, Message*>::iterator it = ref.find(key);
+            CHECK(index.Find(key) == (it == ref.end() ? NULL : it->second));
+            break;
+        }
+        case 4: {
+            /* 第k封邮件与其序列号 */
+            if (ref.empty()) break;
+            int k = seed % ref.size(), seq = 0;
+            std::map<int, Message*>::iterator it = ref.begin();
+            std::advance(it, k);
+            CHECK(index.Nth(k, &seq) == it->second && seq == it->first);
+            CHECK(index.Nth(ref.size()) == NULL);
+            break;
+        }
+        default: {
+            Entries all, part;
+            index.All(all);
+            CHECK(all == Entries(ref.begin(), ref.end()) && index.size() == (int)ref.size());
+            index.Range(key, key + 100, part);
+            CHECK(part == Entries(ref.lower_bound(key), ref.lower_bound(key + 100)));
+        }
+        }
+    }
+}
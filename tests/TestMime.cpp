@@ -0,0 +1,105 @@
+#include <cstring>
+#include <string>
+#include "../Mime.h"
+#include "Test.h"
+
+static const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* 逐个字符的参考实现：跳过非base64字符，遇到'='结束 */
+static std::string RefBase64(const std::string& in) {
+    std::string out;
+    u_int32_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size() && in[i] != '='; i++) {
+        const char* p = strchr(Alphabet, in[i]);
+        if (p == NULL || in[i] == '\0') continue;
+        acc = (acc << 6) | (p - Alphabet);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return out;
+}
+
+static std::string EncodeBase64(const std::string& in, size_t width) {
+    std::string out, line;
+    for (size_t i = 0; i < in.size(); i += 3) {
+        u_int32_t v = (u_int8_t)in[i] << 16;
+        if (i + 1 < in.size()) v |= (u_int8_t)in[i + 1] << 8;
+        if (i + 2 < in.size()) v |= (u_int8_t)in[i + 2];
+        line += Alphabet[v >> 18];
+        line += Alphabet[(v >> 12) & 63];
+        line += i + 1 < in.size() ? Alphabet[(v >> 6) & 63] : '=';
+        line += i + 2 < in.size() ? Alphabet[v & 63] : '=';
+        if (line.size() >= width) {
+            out += line + "\r\n";
+            line.clear();
+        }
+    }
+    return out + line;
+}
+
+static std::string Base64(const std::string& in) {
+    std::string out = "pre";
+    DecodeBase64(in.data(), in.size(), out);
+    return out;
+}
+
+static std::string QP(const char* in) {
+    std::string out;
+    DecodeQP(in, strlen(in), out);
+    return out;
+}
+
+/* 当前CPU选择的实现，make test另外用IMAP_BASE64限制为较低的实现再运行一次 */
+void TestMime() {
+    printf("  base64 kernel: %s\n", Base64KernelName());
+    const char* fixed[] = {"QUJD\n\nREVG\n", "\nQUJDREVG", "\r\n\r\nQUJD\r\nREVG", "QUJDREVG", "QUJDRA==", "", "\n",
+                           "QUJ\nDREVG\n", "QU*JD RE\tVG", "QUJDREVG=QUJD"};
+    for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+        CHECK(Base64(fixed[i]) == "pre" + RefBase64(fixed[i]));
+    CHECK(Base64("QUJD\n\nREVG\n") == "preABCDEF");
+
+    /* 编码后按各种行宽（含76字符）切行再解码，覆盖整行在向量循环中解码的路径 */
+    u_int32_t seed = 1;
+    for (int round = 0; round < 2000; round++) {
+        seed = seed * 1103515245 + 12345;
+        std::string plain(seed % 3000, '\0');
+        for (size_t i = 0; i < plain.size(); i++) plain[i] = (char)((seed >> 16) + i * 131);
+        size_t width = round % 4 == 0 ? 76 : 4 + (seed >> 8) % 120;
+        CHECK(Base64(EncodeBase64(plain, width)) == "pre" + plain);
+    }
+
+    /* 随机的行和杂字符，与参考实现比较 */
+    for (int round = 0; round < 20000; round++) {
+        std::string s;
+        seed = seed * 1103515245 + 12345;
+        int width = seed % 5 == 0 ? (seed >> 8) % 100 : 4 * (1 + (seed >> 8) % 25);
+        bool crlf = seed & 0x10000;
+        int lines = (seed >> 20) % 20;
+        for (int l = 0; l < lines; l++) {
+            seed = seed * 1103515245 + 12345;
+            int w = seed % 8 == 0 ? (seed >> 4) % 100 : width;
+            for (int k = 0; k < w; k++) {
+                seed = seed * 1103515245 + 12345;
+                int r = (seed >> 16) % 200;
+                s += r == 0 ? '=' : r == 1 ? '\n' : r == 2 ? '*' : Alphabet[(seed >> 8) % 64];
+            }
+            s += crlf ? "\r\n" : "\n";
+        }
+        if (seed % 3 == 0) s += "==";
+        CHECK(Base64(s) == "pre" + RefBase64(s));
+    }
+
+    CHECK(QP("plain text") == "plain text");
+    CHECK(QP("a=3Db=3d") == "a=b=");
+    CHECK(QP("soft=\r\nbreak=\nhere") == "softbreakhere");
+    CHECK(QP("=E4=BD=A0") == "\xe4\xbd\xa0");
+    CHECK(QP("bad=ZZ=4") == "bad=ZZ=4");
+    CHECK(QP("end=") == "end=");
+    std::string out = "pre";
+    DecodeQP("x=41", 4, out);
+    CHECK(out == "prexA");
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "../PcapWriter.h"
+#include "../ImapResolve.h"
+#include "Test.h"
+
+#define CLIENT_IP   0x0a000001
+#define SERVER_IP   0x0a000002
+
+/* 记下会话的事件（以客户端端口开头），比较完整处理和按索引重新处理的结果 */
+class Recorder : public SessionListener {
+    void Add(const FlowInfo& Flow, const std::string& Event) {
+        Log += std::to_string(Flow.ClientPort) + " " + Event + "\n";
+    }
+public:
+    std::string Log;
+    void OnLogin(const FlowInfo& Flow, const std::string& User, const std::string& Password) {
+        Add(Flow, "login " + User);
+    }
+    void OnMailbox(const FlowInfo& Flow, const std::string& Name, int Event, Mailbox& Box) {
+        Add(Flow, "box " + Name + " " + std::to_string(Event));
+    }
+    void OnBody(const FlowInfo& Flow, const std::string& Box, Message& Mail, int Part) {
+        Add(Flow, "body " + Box + " " + std::to_string(Part));
+    }
+    void OnClose(const FlowInfo& Flow, const std::string& User) {
+        Add(Flow, "close " + User);
+    }
+};
+
+/* 只保留Log中以Prefix开头的行 */
+static std::string Only(const std::string& Log, const std::string& Prefix) {
+    std::string out;
+    for (size_t pos = 0, end; pos < Log.size(); pos = end + 1) {
+        end = Log.find('\n', pos);
+        if (Log.compare(pos, Prefix.size(), Prefix) == 0) out.append(Log, pos, end + 1 - pos);
+    }
+    return out;
+}
+
+static void WritePacket(PcapWriter& out, u_int16 port, bool FromServer, u_int32 seq, u_int8 flags, const std::string& payload) {
+    static u_int32 usec = 0;
+    FrameHeader_t eth;
+    IPHeader_t ip;
+    TCPHeader_t tcp;
+    memset(&eth, 0, sizeof(eth));   eth.FrameType = htons(0x0800);
+    memset(&ip, 0, sizeof(ip));
+    ip.Ver_HLen = 0x45; ip.TotalLen = htons(sizeof(ip) + sizeof(tcp) + payload.size());
+    ip.TTL = 64;    ip.Protocol = 6;
+    ip.SrcIP = htonl(FromServer ? SERVER_IP : CLIENT_IP);   ip.DstIP = htonl(FromServer ? CLIENT_IP : SERVER_IP);
+    memset(&tcp, 0, sizeof(tcp));
+    tcp.SrcPort = htons(FromServer ? 143 : port);   tcp.DstPort = htons(FromServer ? port : 143);
+    tcp.SeqNO = htonl(seq); tcp.HeaderLen = 5 << 4;
+    tcp.Flags = flags;  tcp.Window = htons(65535);
+    std::string frame((const char*)&eth, ETHER_HEAD);
+    frame.append((const char*)&ip, sizeof(ip));
+    frame.append((const char*)&tcp, sizeof(tcp));
+    frame += payload;
+    pcap_pkthdr hdr;
+    usec += 1000;
+    hdr.ts.tv_sec = 1700000000;  hdr.ts.tv_usec = usec;
+    hdr.caplen = hdr.len = frame.size();
+    out.Write(hdr, (const u_int8*)frame.data());
+}
+
+/* 一个会话：登录、SELECT、FETCH一封邮件，服务器最后以带负载的RST结束；
+* 另有一个不相关的连接，按索引选出会话时应被跳过 */
+static int WriteSession(const char* FileName) {
+    pcap_file_header head;
+    head.magic = 0xa1b2c3d4;    head.version_major = 2; head.version_minor = 4;
+    head.thiszone = 0;  head.sigfigs = 0;   head.snaplen = 65535;   head.linktype = ETHERNET;
+    PcapWriter out(FileName, head);
+    std::string mail = "From: a@example.com\r\nSubject: hello\r\n\r\nbody\r\n";
+    const char* client[] = {"a1 LOGIN bob secret\r\n", "a2 SELECT INBOX\r\n", "a3 FETCH 1 BODY[]\r\n"};
+    std::string server[] = {"a1 OK LOGIN completed\r\n",
+                            "* 1 EXISTS\r\n* OK [UIDNEXT 6] next\r\na2 OK [READ-WRITE] SELECT completed\r\n",
+                            "* 1 FETCH (UID 5 BODY[] {" + std::to_string(mail.size()) + "}\r\n" + mail + ")\r\na3 OK FETCH completed\r\n"};
+    u_int32 cseq = 100, sseq = 900;
+    WritePacket(out, 5000, false, cseq++, 0x02, "");
+    std::string greeting = "* OK ready\r\n";
+    WritePacket(out, 5000, true, sseq, 0x18, greeting);
+    sseq += greeting.size();
+    WritePacket(out, 5001, false, 300, 0x02, "");
+    WritePacket(out, 5001, false, 301, 0x18, "x1 NOOP\r\n");
+    for (int i = 0; i < 3; i++) {
+        WritePacket(out, 5000, false, cseq, 0x18, client[i]);
+        cseq += strlen(client[i]);
+        WritePacket(out, 5000, true, sseq, 0x18, server[i]);
+        sseq += server[i].size();
+    }
+    WritePacket(out, 5000, true, sseq, 0x14, "* BYE\r\n");
+    return out.Close();
+}
+
+static std::string Process(const char* FileName, const std::vector<u_int64_t>* Offsets, FlowIndex* Index, int& Ret) {
+    Recorder rec;
+    Package data(FileName);
+    data.SetListener(&rec);
+    data.SetSaveOnClose(false);
+    data.SetIndex(Index);
+    Ret = Offsets ? data.Replay(*Offsets) : data.GetData();
+    data.CloseAll();
+    return rec.Log;
+}
+
+void TestReplay() {
+    char dir[] = "/tmp/imaptest.XXXXXX";
+    if (mkdtemp(dir) == NULL) {
+        CHECK(false);
+        return;
+    }
+    std::string pcap = std::string(dir) + "/s.pcap", idx = std::string(dir) + "/s.idx";
+    std::string part = std::string(dir) + "/part.pcap", partidx = std::string(dir) + "/part.idx";
+    CHECK(WriteSession(pcap.c_str()) == OK);
+
+    /* 完整处理并建立索引：有负载的数据包和FIN/RST各记录一次（带负载的RST也只有一次），没有负载的SYN不记录 */
+    FlowIndex index;
+    int ret;
+    std::string full = Process(pcap.c_str(), NULL, &index, ret);
+    CHECK(full.find("5000 login bob") != std::string::npos && full.find("5000 body INBOX") != std::string::npos);
+    CHECK(full.find("5001 close") != std::string::npos);
+    full = Only(full, "5000 ");
+    CHECK(index.size() == 2);
+    std::vector<u_int64_t> offsets;
+    CHECK(index.Select("bob", 0, 0, offsets) == 1);
+    CHECK(offsets.size() == 8);
+    for (size_t i = 1; i < offsets.size(); i++) CHECK(offsets[i - 1] < offsets[i]);
+
+    /* 索引写出再读入，按用户和客户端选出 */
+    CHECK(index.Save(idx.c_str()) == OK);
+    FlowIndex loaded;
+    CHECK(loaded.Load(idx.c_str()) == OK);
+    std::vector<u_int64_t> selected;
+    CHECK(loaded.Select("bob", CLIENT_IP, 5000, selected) == 1 && selected == offsets);
+    CHECK(loaded.Select("alice", 0, 0, selected) == 0);
+    CHECK(loaded.Select(NULL, CLIENT_IP, 5002, selected) == 0);
+
+    /* 按索引重新处理，结果与完整处理相同 */
+    CHECK(Process(pcap.c_str(), &offsets, NULL, ret) == full && ret == OK);
+    /* 偏移越过文件结尾时报错 */
+    std::vector<u_int64_t> beyond = offsets;
+    beyond.push_back(offsets.back() + (1 << 20));
+    Process(pcap.c_str(), &beyond, NULL, ret);
+    CHECK(ret == NO);
+
+    /* 抽取出的文件保留SYN，它的索引同样可以重新处理 */
+    {
+        Package data(pcap.c_str());
+        PcapWriter out(part.c_str(), data.GetFileHeader());
+        FlowIndex extracted;
+        data.Extract(out, &extracted);
+        CHECK(out.Close() == OK && out.size() == 11 && extracted.size() == 2);
+        CHECK(extracted.Save(partidx.c_str()) == OK);
+    }
+    FlowIndex extracted;
+    CHECK(extracted.Load(partidx.c_str()) == OK);
+    std::vector<u_int64_t> parts;
+    CHECK(extracted.Select(NULL, CLIENT_IP, 5000, parts) == 1 && parts.size() == 9);
+    CHECK(Process(part.c_str(), &parts, NULL, ret) == full && ret == OK);
+
+    unlink(pcap.c_str());   unlink(idx.c_str());
+    unlink(part.c_str());   unlink(partidx.c_str());
+    rmdir(dir);
+}
@@ -0,0 +1,24 @@
+#include "../ImapResolve.h"
+#include "Test.h"
+
+/* SeqTracker::Seen返回数据段中没有见过的后缀长度 */
+void TestSeqTracker() {
+    SeqTracker t;
+    CHECK(t.Seen(1000, 100) == 100);    /* 第一段 */
+    CHECK(t.Seen(1050, 100) == 50);     /* 与前一段部分重叠，只有后50字节是新的 */
+    CHECK(t.Seen(1000, 150) == 0);      /* 完全重传 */
+    CHECK(t.Seen(1300, 100) == 100);    /* 前面留下空洞 */
+    CHECK(t.Seen(1350, 100) == 50);
+    CHECK(t.Seen(1250, 100) == 100);    /* 开头是新数据，与后面的记录重叠时整段交付 */
+    CHECK(t.Seen(1150, 400) == 400);    /* 补上空洞，与乱序的部分合并 */
+    CHECK(t.Seen(1400, 50) == 0);
+    CHECK(t.Seen(1550, 0) == 0);
+    CHECK(t.Seen(900, 50) == 50);       /* 第一段之前的数据无法判断 */
+
+    /* 序列号回绕 */
+    SeqTracker w;
+    CHECK(w.Seen(0xfffffff0u, 32) == 32);
+    CHECK(w.Seen(0xfffffff8u, 32) == 8);
+    CHECK(w.Seen(0x10u, 8) == 0);
+    CHECK(w.Seen(0x10u, 16) == 8);
+}
@@ -0,0 +1,33 @@
+#include <map>
+#include <string>
+#include "../TagTable.h"
+#include "Test.h"
+
+static u_int64_t Parse(TagCodec& codec, const std::string& tag) {
+    return codec.Parse(tag.data(), tag.size());
+}
+
+void TestTagCodec() {
+    TagCodec codec;
+    /* 前缀、数字位数和数值都参与编码 */
+    u_int64_t a1 = Parse(codec, "A1"), a01 = Parse(codec, "A01"), a2 = Parse(codec, "A2"), b1 = Parse(codec, "B1");
+    CHECK(a1 != TAG_NONE && a01 != TAG_NONE && a2 != TAG_NONE && b1 != TAG_NONE);
+    CHECK(a1 != a01 && a1 != a2 && a1 != b1 && a01 != a2);
+    CHECK(Parse(codec, "A1") == a1);
+    CHECK(Parse(codec, "1.23") == Parse(codec, "1.23") && Parse(codec, "1.23") != Parse(codec, "1.24"));
+
+    /* 随机前缀超过TAG_PREFIXES个后进入哈希表，不同的前缀编号不能相同 */
+    std::map<u_int64_t, std::string> seen;
+    int collisions = 0;
+    for (u_int32_t i = 0; i < TAG_OVERFLOW - TAG_PREFIXES; i++) {
+        char buf[32];
+        int n = snprintf(buf, sizeof(buf), "x%xq%u", i * 2654435761u, i % 7);
+        std::string tag(buf, n);
+        u_int64_t code = Parse(codec, tag);
+        std::map<u_int64_t, std::string>::iterator it = seen.find(code);
+        if (it != seen.end() && it->second != tag) collisions++;
+        seen[code] = tag;
+        CHECK(Parse(codec, tag) == code);
+    }
+    CHECK(collisions == 0);
+}
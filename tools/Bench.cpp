@@ -0,0 +1,224 @@
+/*---------------------
+* target: 端到端性能测试，与基线比较吞吐量
+* -------------------*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <new>
+#include <string>
+#include <vector>
+#include <map>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "../PeelHeader.h"
+#include "../Stats.h"
+
+/* 默认的重复次数（取最好的一次）和允许的吞吐量下降比例（%） */
+#define BENCH_REPEAT    3
+#define BENCH_THRESHOLD 10
+
+/* 替换全局的operator new，统计整个处理流程的分配次数和字节数 */
+static u_int64_t Allocs, AllocBytes;
+
+void* operator new(size_t size) {
+    Allocs++;   AllocBytes += size;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) {return operator new(size);}
+/* 不内联，否则GCC会把这里的free误报为与new不匹配 */
+__attribute__((noinline)) void operator delete(void* p) noexcept {free(p);}
+void operator delete[](void* p) noexcept {operator delete(p);}
+void operator delete(void* p, size_t) noexcept {operator delete(p);}
+void operator delete[](void* p, size_t) noexcept {operator delete(p);}
+
+/* 一次运行的结果，由子进程通过管道传回 */
+struct Result {
+    int Ok;
+    double Seconds;
+    u_int64_t Packets, Bytes;
+    u_int64_t Allocs, AllocBytes;
+    long RssKb;
+};
+
+static double Now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+/* 在子进程中运行完整流程（读取、解析、保存），进程隔离保证峰值内存互不影响 */
+static bool RunOnce(const char* FileName, Result& res) {
+    char dir[] = "/tmp/imapbench.XXXXXX";
+    if (mkdtemp(dir) == NULL) return false;
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result r;
+        memset(&r, 0, sizeof(r));
+        /* 保存的文件写入临时目录，GetData的提示信息丢弃 */
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, 1);
+        if (chdir(dir) == 0) {
+            try {
+                Allocs = AllocBytes = 0;
+                double start = Now();
+                Package data(FileName);
+                data.GetData();
+                data.CloseAll();
+                r.Seconds = Now() - start;
+                r.Packets = GStats.PacketsRead;
+                r.Bytes = GStats.BytesRead;
+                r.Allocs = Allocs;
+                r.AllocBytes = AllocBytes;
+                r.Ok = 1;
+            } catch (int err) {
+                r.Ok = 0;
+            }
+        }
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        r.RssKb = usage.ru_maxrss;
+        if (write(fds[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    bool ok = pid > 0 && read(fds[0], &res, sizeof(res)) == sizeof(res) && res.Ok;
+    close(fds[0]);
+    if (pid > 0) waitpid(pid, NULL, 0);
+    nftw(dir, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return ok;
+}
+
+/* 工作负载名为文件名去掉目录和扩展名 */
+static std::string WorkloadName(const char* FileName) {
+    std::string name(FileName);
+    size_t slash = name.rfind('/');
+    if (slash != std::string::npos) name.erase(0, slash + 1);
+    size_t dot = name.find('.');
+    if (dot != std::string::npos) name.erase(dot);
+    return name;
+}
+
+/* 基线文件每行为：名称 MB/s 数据包/s，#开头为注释 */
+static std::map<std::string, double> LoadBaseline(const char* FileName) {
+    std::map<std::string, double> base;
+    FILE* in = fopen(FileName, "r");
+    if (in == NULL) return base;
+    char line[256], name[128];
+    double mbps, pps;
+    while (fgets(line, sizeof(line), in)) {
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%127s %lf %lf", name, &mbps, &pps) == 3) base[name] = mbps;
+    }
+    fclose(in);
+    return base;
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-b baseline] [-u] [-t percent] [-r repeat] file.pcap...\n"
+            "  -b file     baseline to compare with (or to write with -u)\n"
+            "  -u          write the results as the new baseline\n"
+            "  -t percent  fail when MB/s drops more than this below the baseline (%d)\n"
+            "  -r repeat   runs per workload, the best one is reported (%d)\n",
+            name, BENCH_THRESHOLD, BENCH_REPEAT);
+}
+
+/*----------------------
+* 每个输入文件是一个工作负载，结果按最快的一次输出；
+* 有基线时，任何一个工作负载的MB/s下降超过阈值则返回1
+* --------------------*/
+int main(int args, char* argv[]) {
+    const char* Baseline = NULL;
+    bool Update = false;
+    int Threshold = BENCH_THRESHOLD, Repeat = BENCH_REPEAT, opt;
+    while ((opt = getopt(args, argv, "b:ut:r:")) != -1) {
+        switch (opt) {
+        case 'b': Baseline = optarg;    break;
+        case 'u': Update = true;    break;
+        case 't': Threshold = atoi(optarg); break;
+        case 'r': Repeat = atoi(optarg);    break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= args || Repeat <= 0 || (Update && Baseline == NULL)) {
+        Usage(argv[0]);
+        return 1;
+    }
+    std::map<std::string, double> base;
+    if (Baseline && Update == false) base = LoadBaseline(Baseline);
+
+    std::vector<std::pair<std::string, Result> > results;
+    bool failed = false, regressed = false;
+    printf("%-10s %10s %9s %8s %12s %9s %9s %12s %10s %s\n", "workload", "packets", "MB", "sec",
+           "packets/s", "MB/s", "RSS MB", "allocs", "allocs/pkt", "vs baseline");
+    for (int i = optind; i < args; i++) {
+        std::string name = WorkloadName(argv[i]);
+        /* 子进程会切换到临时目录，先转换为绝对路径 */
+        char path[PATH_MAX];
+        if (realpath(argv[i], path) == NULL) strcpy(path, argv[i]);
+        Result best;
+        bool ok = false;
+        for (int j = 0; j < Repeat; j++) {
+            Result r;
+            if (RunOnce(path, r) == false) continue;
+            if (ok == false || r.Seconds < best.Seconds) best = r;
+            ok = true;
+        }
+        if (ok == false) {
+            printf("%-10s cannot process %s\n", name.c_str(), argv[i]);
+            failed = true;
+            continue;
+        }
+        double mb = best.Bytes / 1048576.0, sec = best.Seconds > 0 ? best.Seconds : 1e-9;
+        printf("%-10s %10llu %9.1f %8.3f %12.0f %9.1f %9.1f %12llu %10.1f", name.c_str(),
+               (unsigned long long)best.Packets, mb, best.Seconds, best.Packets / sec, mb / sec,
+               best.RssKb / 1024.0, (unsigned long long)best.Allocs,
+               best.Packets ? (double)best.Allocs / best.Packets : 0);
+        std::map<std::string, double>::iterator it = base.find(name);
+        if (it != base.end() && it->second > 0) {
+            double change = (mb / sec - it->second) / it->second * 100;
+            bool bad = change < -Threshold;
+            printf(" %+.1f%%%s", change, bad ? " REGRESSION" : "");
+            regressed |= bad;
+        }
+        printf("\n");
+        results.push_back(std::make_pair(name, best));
+    }
+
+    if (Update) {
+        FILE* out = fopen(Baseline, "w");
+        if (out == NULL) {
+            fprintf(stderr, "Cannot write %s\n", Baseline);
+            return 1;
+        }
+        /* 基线只在测量的机器上有意义，记下机器以便看出是否适用 */
+        char host[256] = "unknown";
+        gethostname(host, sizeof(host) - 1);
+        fprintf(out, "# workload MB/s packets/s, written by make bench-baseline\n"
+                "# measured on %s with %ld CPUs; only valid on that machine, re-run make bench-baseline elsewhere\n",
+                host, sysconf(_SC_NPROCESSORS_ONLN));
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i].second;
+            double sec = r.Seconds > 0 ? r.Seconds : 1e-9;
+            fprintf(out, "%s %.1f %.0f\n", results[i].first.c_str(), r.Bytes / 1048576.0 / sec, r.Packets / sec);
+        }
+        fclose(out);
+    }
+    if (regressed) fprintf(stderr, "Throughput regressed more than %d%% against %s\n", Threshold, Baseline);
+    return failed || regressed ? 1 : 0;
+}
@@ -0,0 +1,556 @@
+/*---------------------
+* target: 生成模拟IMAP流量的pcap文件，用于性能测试
+* -------------------*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <unistd.h>
+#include "../PeelHeader.h"
+#include "../PcapWriter.h"
+
+/* pcap的snaplen减去以太网、IP和TCP首部，APPEND的文字量与命令都在一个数据包中，不能超过此长度 */
+#define SNAP_LEN        65535
+#define MAX_PAYLOAD     (SNAP_LEN - ETHER_HEAD - 20 - 20)
+#define SERVER_IP       0x0a000002  /* 10.0.0.2 */
+#define BASE_TIME       1600000000
+
+/* 命令类型，对应-x选项中的名称 */
+#define GEN_FETCH   0
+#define GEN_META    1
+#define GEN_APPEND  2
+#define GEN_COPY    3
+#define GEN_EXPUNGE 4
+#define GEN_LIST    5
+#define GEN_SELECT  6
+#define GEN_KINDS   7
+
+static const char* KindNames[GEN_KINDS] = {"fetch", "meta", "append", "copy", "expunge", "list", "select"};
+static const char* Folders[] = {"INBOX", "Archive", "Sent", "Drafts", "Work/Projects", "Work/Reports", "Lists/dev"};
+#define FOLDERS (int)(sizeof(Folders) / sizeof(Folders[0]))
+static const char* Words[] = {
+    "the", "mail", "server", "message", "report", "meeting", "project", "update", "please", "review",
+    "attached", "thanks", "schedule", "budget", "release", "client", "folder", "index", "draft", "today",
+};
+#define WORDS (int)(sizeof(Words) / sizeof(Words[0]))
+
+/*------------------------------------------------------------------------------
+* class Random
+* splitmix64，输出只由种子决定，与平台和标准库实现无关
+* ----------------------------------------------------------------------------*/
+class Random {
+    u_int64_t State;
+public:
+    explicit Random(u_int64_t seed) : State(seed) {}
+    u_int64_t Next() {
+        u_int64_t z = (State += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    /* [0, n) */
+    u_int32_t Below(u_int32_t n) {return n ? (u_int32_t)(Next() % n) : 0;}
+    /* [lo, hi] */
+    u_int32_t Range(u_int32_t lo, u_int32_t hi) {return hi > lo ? lo + Below(hi - lo + 1) : lo;}
+    /* 按百分比的概率返回true */
+    bool Chance(int percent) {return percent > 0 && (int)Below(100) < percent;}
+};
+
+struct Options {
+    u_int64_t Seed;
+    int Sessions;       /* 总会话数 */
+    int Concurrent;     /* 同时进行的会话数 */
+    int Commands;       /* 每个会话在SELECT之后的命令数 */
+    int Mails;          /* INBOX初始的邮件数 */
+    int MinSize, MaxSize;   /* 邮件大小的范围（字节） */
+    int Batch;          /* 一次FETCH的最大邮件数 */
+    int Mss;            /* 服务器数据的分段大小 */
+    int Reorder;        /* 相邻分段交换顺序的概率（%） */
+    int Retrans;        /* 分段被重传的概率（%） */
+    u_int64_t Limit;    /* 输出达到该字节数后不再开始新会话，0表示不限制 */
+    int Weights[GEN_KINDS];
+};
+
+/*------------------------------------------------------------------------------
+* class FrameWriter
+* 组装以太网/IP/TCP帧，经PcapWriter写出，时间戳单调递增
+* ----------------------------------------------------------------------------*/
+class FrameWriter {
+    PcapWriter& Pcap;
+    u_int64_t Usec;
+    std::string Frame;
+public:
+    FrameWriter(PcapWriter& pcap) : Pcap(pcap), Usec(0) {}
+    void Write(u_int32 src, u_int32 dst, u_int16 sport, u_int16 dport, u_int32 seq, u_int8 flags,
+               const std::string& payload, u_int32 gap);
+};
+
+void FrameWriter::Write(u_int32 src, u_int32 dst, u_int16 sport, u_int16 dport, u_int32 seq, u_int8 flags,
+                        const std::string& payload, u_int32 gap) {
+    FrameHeader_t eth;
+    IPHeader_t ip;
+    TCPHeader_t tcp;
+    memset(&eth, 0, sizeof(eth));   eth.FrameType = htons(0x0800);
+    memset(&ip, 0, sizeof(ip));
+    ip.Ver_HLen = 0x45; ip.TotalLen = htons(sizeof(ip) + sizeof(tcp) + payload.size());
+    ip.TTL = 64;    ip.Protocol = 6;
+    ip.SrcIP = htonl(src);  ip.DstIP = htonl(dst);
+    memset(&tcp, 0, sizeof(tcp));
+    tcp.SrcPort = htons(sport); tcp.DstPort = htons(dport);
+    tcp.SeqNO = htonl(seq); tcp.HeaderLen = 5 << 4;
+    tcp.Flags = flags;  tcp.Window = htons(65535);
+
+    Frame.assign((const char*)&eth, ETHER_HEAD);
+    Frame.append((const char*)&ip, sizeof(ip));
+    Frame.append((const char*)&tcp, sizeof(tcp));
+    Frame += payload;
+
+    Usec += gap;
+    pcap_pkthdr hdr;
+    hdr.ts.tv_sec = BASE_TIME + Usec / 1000000;
+    hdr.ts.tv_usec = Usec % 1000000;
+    hdr.caplen = hdr.len = Frame.size();
+    Pcap.Write(hdr, (const u_int8*)Frame.data());
+}
+
+struct Packet {
+    bool FromServer;
+    u_int8 Flags;
+    u_int32 Seq;
+    std::string Payload;
+};
+
+struct BoxState {
+    int Exists;
+    u_int32 UidNext;
+};
+
+/*------------------------------------------------------------------------------
+* class Flow
+* 一个IMAP会话：握手、问候、LOGIN、LIST、SELECT INBOX，之后按权重随机执行Commands条命令，
+* 最后LOGOUT并关闭连接；每次生成一轮命令和响应放入队列，由调度逐个取出，
+* 因此各会话的数据包可以交错，而会话内部保持顺序：
+*   1） 客户端的每条命令（包括APPEND的文字量）在一个数据包中，分析程序按数据包解析命令；
+*   2） 服务器的响应按Mss分段，分段可以交换顺序或被重传
+* ----------------------------------------------------------------------------*/
+class Flow {
+    const Options& Opt;
+    Random& Rand;
+    int Id;
+    u_int32 ClientIP;
+    u_int16 ClientPort;
+    u_int32 CSeq, SSeq;
+    int Step, Left, Tag;
+    int Cur;            /* 当前选择的邮箱 */
+    int Cursor;         /* 下一次FETCH的起始序列号 */
+    BoxState Boxes[FOLDERS];
+    std::deque<Packet> Queue;
+
+    void Client(const std::string& data, u_int8 flags = 0x18);
+    void Server(const std::string& data);
+    std::string NextTag();
+    std::string Body(u_int32 uid);
+    int PickKind();
+    void Fetch(bool Meta);
+    void Exchange(int Kind);
+public:
+    bool Closing;
+
+    Flow(const Options& opt, Random& rand, int id);
+    /* 取出下一个数据包，会话结束时返回false */
+    bool Pop(Packet& pkt);
+    u_int32 IP() const {return ClientIP;}
+    u_int16 Port() const {return ClientPort;}
+};
+
+Flow::Flow(const Options& opt, Random& rand, int id) : Opt(opt), Rand(rand), Id(id) {
+    ClientIP = 0x0a010000 + 1 + (id / 50000) % 60000;
+    ClientPort = 1024 + id % 50000;
+    CSeq = Rand.Next();  SSeq = Rand.Next();
+    Step = 0;   Left = Opt.Commands;    Tag = 0;
+    Cur = 0;    Cursor = 1;
+    for (int i = 0; i < FOLDERS; i++) {
+        Boxes[i].Exists = i == 0 ? Opt.Mails : Rand.Below(Opt.Mails / 4 + 1);
+        Boxes[i].UidNext = Boxes[i].Exists + 1;
+    }
+    Closing = false;
+}
+
+void Flow::Client(const std::string& data, u_int8 flags) {
+    Packet pkt;
+    pkt.FromServer = false; pkt.Flags = flags;  pkt.Seq = CSeq;
+    pkt.Payload = data;
+    CSeq += data.size() + ((flags & 3) ? 1 : 0);
+    Queue.push_back(pkt);
+}
+
+void Flow::Server(const std::string& data) {
+    std::vector<Packet> segs;
+    for (size_t off = 0; off < data.size(); off += Opt.Mss) {
+        Packet pkt;
+        pkt.FromServer = true;  pkt.Flags = 0x18;
+        pkt.Seq = SSeq + off;
+        pkt.Payload.assign(data, off, Opt.Mss);
+        segs.push_back(pkt);
+    }
+    SSeq += data.size();
+    for (size_t i = 0; i + 1 < segs.size(); i++) {
+        if (Rand.Chance(Opt.Reorder)) {
+            std::swap(segs[i], segs[i+1]);
+            i++;
+        }
+    }
+    /* 重传的分段在下一个分段之后再次出现 */
+    bool dup = false;
+    Packet last;
+    for (size_t i = 0; i < segs.size(); i++) {
+        Queue.push_back(segs[i]);
+        if (dup) Queue.push_back(last);
+        dup = Rand.Chance(Opt.Retrans);
+        last = segs[i];
+    }
+    if (dup) Queue.push_back(last);
+}
+
+std::string Flow::NextTag() {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "A%04d", ++Tag);
+    return buf;
+}
+
+std::string Flow::Body(u_int32 uid) {
+    static const char* Zones[] = {"+0000", "-0700", "+0800", "+0530"};
+    char buf[512];
+    int size = Rand.Range(Opt.MinSize, Opt.MaxSize);
+    snprintf(buf, sizeof(buf),
+             "From: user%d@example.com\r\nTo: peer%u@example.org\r\nSubject: %s %s %u\r\n"
+             "Date: %d Jul 2020 %02d:%02d:%02d %s\r\nMessage-ID: <%d.%u@example.com>\r\n\r\n",
+             Id, Rand.Below(1000), Words[Rand.Below(WORDS)], Words[Rand.Below(WORDS)], uid,
+             1 + Rand.Below(28), Rand.Below(24), Rand.Below(60), Rand.Below(60), Zones[Rand.Below(4)], Id, uid);
+    std::string body(buf);
+    int line = 0;
+    while ((int)body.size() < size) {
+        const char* w = Words[Rand.Below(WORDS)];
+        body += w;
+        line += strlen(w) + 1;
+        if (line > 70) {
+            body += "\r\n";
+            line = 0;
+        } else body += ' ';
+    }
+    body += "\r\n";
+    return body;
+}
+
+int Flow::PickKind() {
+    int total = 0;
+    for (int i = 0; i < GEN_KINDS; i++) total += Opt.Weights[i];
+    int r = Rand.Below(total);
+    for (int i = 0; i < GEN_KINDS; i++) {
+        if (r < Opt.Weights[i]) return i;
+        r -= Opt.Weights[i];
+    }
+    return GEN_FETCH;
+}
+
+void Flow::Fetch(bool Meta) {
+    BoxState& box = Boxes[Cur];
+    std::string tag = NextTag(), res;
+    char buf[256];
+    if (box.Exists == 0) {
+        Client(tag + " NOOP\r\n");
+        Server(tag + " OK NOOP completed\r\n");
+        return ;
+    }
+    if (Cursor > box.Exists) Cursor = 1;
+    int first = Cursor, last = std::min(box.Exists, first + (int)Rand.Below(Opt.Batch));
+    Cursor = last + 1;
+    bool ByUid = Rand.Chance(30);
+    /* 不跟踪EXPUNGE后具体的对应关系，只保证UID随序列号递增 */
+    u_int32 base = box.UidNext - box.Exists - 1;
+    if (ByUid) snprintf(buf, sizeof(buf), "%s UID FETCH %u:%u (UID FLAGS%s)\r\n", tag.c_str(), first + base, last + base,
+                        Meta ? " INTERNALDATE RFC822.SIZE" : " BODY.PEEK[]");
+    else snprintf(buf, sizeof(buf), "%s FETCH %d:%d (%s)\r\n", tag.c_str(), first, last,
+                  Meta ? "UID FLAGS INTERNALDATE RFC822.SIZE" : "UID FLAGS BODY.PEEK[]");
+    Client(buf);
+    for (int seq = first; seq <= last; seq++) {
+        static const char* Flags[] = {"", "\\Seen", "\\Seen \\Answered", "\\Flagged", "\\Seen \\Deleted"};
+        u_int32 uid = seq + base;
+        const char* flags = Flags[Rand.Below(5)];
+        if (Meta) {
+            snprintf(buf, sizeof(buf), "* %d FETCH (UID %u FLAGS (%s) INTERNALDATE \"%02d-Jul-2020 %02d:%02d:%02d +0000\""
+                     " RFC822.SIZE %u)\r\n", seq, uid, flags, 1 + Rand.Below(28), Rand.Below(24), Rand.Below(60),
+                     Rand.Below(60), Rand.Range(Opt.MinSize, Opt.MaxSize));
+            res += buf;
+        } else {
+            std::string body = Body(uid);
+            snprintf(buf, sizeof(buf), "* %d FETCH (UID %u FLAGS (%s) BODY[] {%u}\r\n", seq, uid, flags, (unsigned)body.size());
+            res += buf;
+            res += body;
+            res += ")\r\n";
+        }
+    }
+    Server(res + tag + (ByUid ? " OK UID FETCH completed\r\n" : " OK FETCH completed\r\n"));
+}
+
+void Flow::Exchange(int Kind) {
+    std::string tag = NextTag(), res;
+    char buf[256];
+    switch (Kind) {
+    case GEN_FETCH:
+    case GEN_META:
+        Fetch(Kind == GEN_META);
+        return ;
+    case GEN_APPEND: {
+        int to = Rand.Below(FOLDERS);
+        std::string body = Body(Boxes[to].UidNext);
+        if (body.size() > MAX_PAYLOAD - 2) body.resize(MAX_PAYLOAD - 2);
+        snprintf(buf, sizeof(buf), "%s APPEND %s (\\Seen) {%u}\r\n", tag.c_str(), Folders[to], (unsigned)body.size());
+        Client(buf);
+        Server("+ Ready for literal data\r\n");
+        Client(body + "\r\n");
+        Boxes[to].Exists++;  Boxes[to].UidNext++;
+        Server(tag + " OK APPEND completed\r\n");
+        return ;
+    }
+    case GEN_COPY: {
+        BoxState& box = Boxes[Cur];
+        int to = Rand.Below(FOLDERS);
+        if (box.Exists == 0 || to == Cur) break;
+        int first = Rand.Range(1, box.Exists), last = std::min(box.Exists, first + (int)Rand.Below(Opt.Batch));
+        snprintf(buf, sizeof(buf), "%s COPY %d:%d %s\r\n", tag.c_str(), first, last, Folders[to]);
+        Client(buf);
+        Boxes[to].Exists += last - first + 1;   Boxes[to].UidNext += last - first + 1;
+        Server(tag + " OK COPY completed\r\n");
+        return ;
+    }
+    case GEN_EXPUNGE: {
+        BoxState& box = Boxes[Cur];
+        Client(tag + " EXPUNGE\r\n");
+        /* 每行的序列号是前面的行删除之后的编号，从大到小删除则编号不变 */
+        int n = box.Exists ? Rand.Range(1, std::min(box.Exists, Opt.Batch)) : 0;
+        int seq = box.Exists;
+        for (int i = 0; i < n && seq > 0; i++) {
+            seq = Rand.Range(std::max(1, seq - 3), seq);
+            snprintf(buf, sizeof(buf), "* %d EXPUNGE\r\n", seq);
+            res += buf;
+            box.Exists--;
+            seq--;
+        }
+        Server(res + tag + " OK EXPUNGE completed\r\n");
+        return ;
+    }
+    case GEN_LIST:
+        Client(tag + " LIST \"\" \"*\"\r\n");
+        for (int i = 0; i < FOLDERS; i++) {
+            snprintf(buf, sizeof(buf), "* LIST (\\HasNoChildren) \"/\" \"%s\"\r\n", Folders[i]);
+            res += buf;
+        }
+        Server(res + tag + " OK LIST completed\r\n");
+        return ;
+    case GEN_SELECT:
+        break;
+    }
+    /* SELECT，以及不能执行的COPY */
+    Cur = Rand.Below(FOLDERS);
+    Cursor = 1;
+    snprintf(buf, sizeof(buf), "%s SELECT %s\r\n", tag.c_str(), Folders[Cur]);
+    Client(buf);
+    snprintf(buf, sizeof(buf), "* %d EXISTS\r\n* 0 RECENT\r\n* OK [UIDVALIDITY %d] UIDs valid\r\n* OK [UIDNEXT %u] Predicted next UID\r\n",
+             Boxes[Cur].Exists, 1000 + Cur, Boxes[Cur].UidNext);
+    Server(buf + tag + " OK [READ-WRITE] SELECT completed\r\n");
+}
+
+bool Flow::Pop(Packet& pkt) {
+    while (Queue.empty()) {
+        char buf[128];
+        std::string tag;
+        switch (Step++) {
+        case 0:
+            /* 三次握手，分析程序会过滤掉这些控制包 */
+            Client("", 0x02);
+            Queue.push_back(Packet());
+            Queue.back().FromServer = true; Queue.back().Flags = 0x12;  Queue.back().Seq = SSeq++;
+            Server("* OK [CAPABILITY IMAP4rev1 LITERAL+] IMAP server ready\r\n");
+            break;
+        case 1:
+            tag = NextTag();
+            snprintf(buf, sizeof(buf), "%s LOGIN user%d pass%d\r\n", tag.c_str(), Id, Id);
+            Client(buf);
+            Server(tag + " OK LOGIN completed\r\n");
+            break;
+        case 2:
+            Exchange(GEN_LIST);
+            break;
+        case 3:
+            tag = NextTag();
+            Client(tag + " SELECT INBOX\r\n");
+            snprintf(buf, sizeof(buf), "* %d EXISTS\r\n* 0 RECENT\r\n* OK [UIDVALIDITY 1000] UIDs valid\r\n",
+                     Boxes[0].Exists);
+            Server(buf + tag + " OK [READ-WRITE] SELECT completed\r\n");
+            break;
+        case 4:
+            if (Left > 0 && Closing == false) {
+                Left--;
+                Step--;
+                Exchange(PickKind());
+                break;
+            }
+            tag = NextTag();
+            Client(tag + " LOGOUT\r\n");
+            Server("* BYE IMAP server logging out\r\n" + tag + " OK LOGOUT completed\r\n");
+            break;
+        case 5:
+            Client("", 0x11);
+            Queue.push_back(Packet());
+            Queue.back().FromServer = true; Queue.back().Flags = 0x11;  Queue.back().Seq = SSeq++;
+            break;
+        default:
+            return false;
+        }
+    }
+    pkt = Queue.front();
+    Queue.pop_front();
+    return true;
+}
+
+static bool ParseWeights(const char* arg, int* weights) {
+    memset(weights, 0, sizeof(int) * GEN_KINDS);
+    std::string s(arg);
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) end = s.size();
+        size_t eq = s.find('=', pos);
+        if (eq == std::string::npos || eq > end) return false;
+        int i = 0;
+        for (; i < GEN_KINDS; i++)
+            if (s.compare(pos, eq - pos, KindNames[i]) == 0) break;
+        if (i == GEN_KINDS) return false;
+        weights[i] = atoi(s.c_str() + eq + 1);
+        pos = end + 1;
+    }
+    int total = 0;
+    for (int i = 0; i < GEN_KINDS; i++) total += weights[i];
+    return total > 0;
+}
+
+static u_int64_t ParseBytes(const char* arg) {
+    char* end;
+    u_int64_t n = strtoull(arg, &end, 10);
+    switch (*end) {
+    case 'g': case 'G': n <<= 10;
+    case 'm': case 'M': n <<= 10;
+    case 'k': case 'K': n <<= 10;
+    }
+    return n;
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr,
+            "Usage: %s [options] out.pcap|-\n"
+            "  -s seed       random seed (1)\n"
+            "  -n sessions   total sessions (100)\n"
+            "  -c count      concurrent sessions (16)\n"
+            "  -k commands   commands per session after SELECT (40)\n"
+            "  -m mails      messages in INBOX (200)\n"
+            "  -z min:max    message size in bytes (1024:16384)\n"
+            "  -b batch      max messages per FETCH/COPY/EXPUNGE (10)\n"
+            "  -M mss        server segment size (1448)\n"
+            "  -r percent    chance of swapping adjacent server segments (0)\n"
+            "  -t percent    chance of retransmitting a server segment (0)\n"
+            "  -L size       stop starting sessions after size bytes, e.g. 4G (0 = no limit)\n"
+            "  -x mix        command weights (fetch=40,meta=20,append=10,copy=10,expunge=5,list=5,select=10)\n",
+            name);
+}
+
+/*----------------------
+* 生成的文件只由选项和种子决定；-L用来生成指定大小的文件，
+* 达到大小后正在进行的会话会尽快LOGOUT，因此实际大小略大于该值
+* --------------------*/
+int main(int args, char* argv[]) {
+    Options opt;
+    opt.Seed = 1;   opt.Sessions = 100; opt.Concurrent = 16;    opt.Commands = 40;
+    opt.Mails = 200;    opt.MinSize = 1024; opt.MaxSize = 16384;    opt.Batch = 10;
+    opt.Mss = 1448; opt.Reorder = 0;    opt.Retrans = 0;    opt.Limit = 0;
+    ParseWeights("fetch=40,meta=20,append=10,copy=10,expunge=5,list=5,select=10", opt.Weights);
+
+    int c;
+    while ((c = getopt(args, argv, "s:n:c:k:m:z:b:M:r:t:L:x:")) != -1) {
+        switch (c) {
+        case 's': opt.Seed = strtoull(optarg, NULL, 10);  break;
+        case 'n': opt.Sessions = atoi(optarg);  break;
+        case 'c': opt.Concurrent = atoi(optarg);    break;
+        case 'k': opt.Commands = atoi(optarg);  break;
+        case 'm': opt.Mails = atoi(optarg); break;
+        case 'z':
+            if (sscanf(optarg, "%d:%d", &opt.MinSize, &opt.MaxSize) != 2) opt.MaxSize = opt.MinSize = atoi(optarg);
+            break;
+        case 'b': opt.Batch = atoi(optarg); break;
+        case 'M': opt.Mss = atoi(optarg);   break;
+        case 'r': opt.Reorder = atoi(optarg);   break;
+        case 't': opt.Retrans = atoi(optarg);   break;
+        case 'L': opt.Limit = ParseBytes(optarg);   break;
+        case 'x':
+            if (ParseWeights(optarg, opt.Weights) == false) {
+                fprintf(stderr, "Bad command mix: %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= args || opt.Sessions <= 0 || opt.Concurrent <= 0 || opt.Batch <= 0 || opt.Mails < 0
+        || opt.Mss <= 0 || opt.Mss > MAX_PAYLOAD || opt.MinSize <= 0 || opt.MaxSize < opt.MinSize) {
+        Usage(argv[0]);
+        return 1;
+    }
+    pcap_file_header hdr;
+    hdr.magic = 0xa1b2c3d4; hdr.version_major = 2;  hdr.version_minor = 4;
+    hdr.thiszone = 0;   hdr.sigfigs = 0;    hdr.snaplen = SNAP_LEN; hdr.linktype = ETHERNET;
+    PcapWriter* pcap;
+    try {
+        pcap = new PcapWriter(argv[optind], hdr);
+    } catch (int) {
+        fprintf(stderr, "Cannot write %s\n", argv[optind]);
+        return 1;
+    }
+
+    Random rand(opt.Seed);
+    FrameWriter writer(*pcap);
+    std::vector<Flow*> active;
+    int started = 0;
+    Packet pkt;
+    while (true) {
+        bool full = opt.Limit && pcap->Offset() >= opt.Limit;
+        while ((int)active.size() < opt.Concurrent && started < opt.Sessions && full == false)
+            active.push_back(new Flow(opt, rand, started++));
+        if (active.empty()) break;
+        size_t i = rand.Below(active.size());
+        Flow* flow = active[i];
+        if (full) flow->Closing = true;
+        if (flow->Pop(pkt) == false) {
+            delete flow;
+            active[i] = active.back();
+            active.pop_back();
+            continue;
+        }
+        if (pkt.FromServer) writer.Write(SERVER_IP, flow->IP(), 143, flow->Port(), pkt.Seq, pkt.Flags, pkt.Payload, 1 + rand.Below(50));
+        else writer.Write(flow->IP(), SERVER_IP, flow->Port(), 143, pkt.Seq, pkt.Flags, pkt.Payload, 1 + rand.Below(50));
+    }
+    u_int64_t packets = pcap->size(), bytes = pcap->Offset();
+    int ret = pcap->Close();
+    delete pcap;
+    if (ret != OK) {
+        fprintf(stderr, "Cannot write %s\n", argv[optind]);
+        return 1;
+    }
+    fprintf(stderr, "%d sessions, %llu packets, %llu bytes\n", started,
+            (unsigned long long)packets, (unsigned long long)bytes);
+    return 0;
+}
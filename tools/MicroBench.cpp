@@ -0,0 +1,353 @@
+/*---------------------
+* target: 解析和邮箱操作的微基准测试
+* -------------------*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <ftw.h>
+#include <unistd.h>
+#include "../PeelHeader.h"
+#include "../Mime.h"
+
+/* 每个规模至少运行的时间（秒） */
+#define MIN_TIME    0.2
+
+/*------------------------------------------------------------------------------
+* class State
+* 一次测量的状态：N为输入规模，循环调用KeepRunning直到达到迭代次数；
+* 每次迭代中不应计时的准备工作放在Pause和Resume之间
+* ----------------------------------------------------------------------------*/
+class State {
+    typedef std::chrono::steady_clock Clock;
+    u_int64_t Iter, Max;
+    Clock::time_point Start;
+    double Elapsed;
+    bool Running;
+public:
+    const int N;
+
+    State(int n, u_int64_t max) : Iter(0), Max(max), Elapsed(0), Running(false), N(n) {}
+    bool KeepRunning() {
+        if (Running == false && Iter == 0) Resume();
+        if (Iter++ < Max) return true;
+        Pause();
+        return false;
+    }
+    void Pause() {
+        if (Running) Elapsed += std::chrono::duration<double>(Clock::now() - Start).count();
+        Running = false;
+    }
+    void Resume() {
+        Start = Clock::now();
+        Running = true;
+    }
+    double Seconds() const {return Elapsed;}
+};
+
+typedef void (*BenchFunc)(State&);
+
+struct Benchmark {
+    const char* Name;
+    BenchFunc Func;
+    std::vector<int> Sizes;
+};
+
+/* 简单的xorshift，保证每次运行的输入相同 */
+static u_int32_t Rand() {
+    static u_int32_t seed = 2463534242u;
+    seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+    return seed;
+}
+
+static std::string Text(int size) {
+    std::string s;
+    s.reserve(size);
+    for (int i = 0; i < size; i++) s.push_back(i % 64 == 63 ? '\n' : 'a' + i % 26);
+    return s;
+}
+
+/* 带tag的结果行之前有N行FETCH数据 */
+static void BenchGetRes(State& st) {
+    Session session;
+    std::string res, data;
+    char buf[128];
+    for (int i = 1; i <= st.N; i++) {
+        snprintf(buf, sizeof(buf), "* %d FETCH (UID %d FLAGS (\\Seen))\r\n", i, i);
+        res += buf;
+    }
+    res += "A0042 OK FETCH completed\r\n";
+    while (st.KeepRunning()) {
+        data = res;
+        session.GetResFromData(data);
+    }
+}
+
+/* 只有元数据的FETCH，N为邮箱中的邮件数，依次访问各封邮件 */
+static void BenchFetchMeta(State& st) {
+    Session session;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "* %d EXISTS\r\n", st.N);
+    session.Select("INBOX", buf);
+    std::vector<std::string> res(st.N);
+    for (int i = 0; i < st.N; i++) {
+        snprintf(buf, sizeof(buf), "* %d FETCH (UID %d FLAGS (\\Seen \\Answered) INTERNALDATE \"17-Jul-1996 02:44:25 -0700\""
+                 " RFC822.SIZE %d)\r\n", i + 1, i + 1, 1000 + i);
+        res[i] = buf;
+        session.fetch(res[i]);
+    }
+    for (int i = 0; st.KeepRunning(); i = (i + 1) % st.N) session.fetch(res[i]);
+}
+
+/* 带N字节文字量的BODY[]，同一封邮件反复被取 */
+static void BenchFetchBody(State& st) {
+    Session session;
+    session.Select("INBOX", "* 1 EXISTS\r\n");
+    char buf[128];
+    snprintf(buf, sizeof(buf), "* 1 FETCH (UID 7 FLAGS (\\Seen) BODY[] {%d}\r\n", st.N);
+    std::string res = buf + Text(st.N) + ")\r\n";
+    while (st.KeepRunning()) session.fetch(res);
+}
+
+/* BODY[TEXT]<off>分为N段，每次取一段 */
+static void BenchFetchPart(State& st) {
+    Session session;
+    session.Select("INBOX", "* 1 EXISTS\r\n");
+    std::vector<std::string> res(st.N);
+    std::string part = Text(512);
+    char buf[128];
+    for (int i = 0; i < st.N; i++) {
+        snprintf(buf, sizeof(buf), "* 1 FETCH (BODY[TEXT]<%d> {512}\r\n", i * 512);
+        res[i] = buf + part + ")\r\n";
+    }
+    for (int i = 0; st.KeepRunning(); i = (i + 1) % st.N) session.fetch(res[i]);
+}
+
+/* 由N个连续的512字节片段拼接出正文 */
+static void BenchGetText(State& st) {
+    Message mail;
+    std::string part = Text(512);
+    for (int i = 0; i < st.N; i++) mail.SetPartText(i * 512, part);
+    size_t total = 0;
+    while (st.KeepRunning()) total += mail.GetText().size();
+    if (total == 0) printf("GetText returned nothing\n");
+}
+
+static std::string DeepName(int depth, int leaf) {
+    std::string name;
+    char buf[32];
+    for (int i = 0; i < depth; i++) {
+        snprintf(buf, sizeof(buf), i ? "/l%d_%d" : "l%d_%d", i, i + 1 == depth ? leaf : 0);
+        name += buf;
+    }
+    return name;
+}
+
+/* 在空的邮箱树中建立深度为N的邮箱 */
+static void BenchAppendBox(State& st) {
+    std::string name = DeepName(st.N, 0);
+    while (st.KeepRunning()) {
+        st.Pause();
+        Mailbox* root = new Mailbox;
+        st.Resume();
+        root->AppendBox(name);
+        st.Pause();
+        delete root;
+        st.Resume();
+    }
+}
+
+/* 深度为N的邮箱树，每层有16个同级邮箱，查找最深的一个 */
+static void BenchFindBox(State& st) {
+    Mailbox root;
+    for (int d = 1; d <= st.N; d++)
+        for (int leaf = 0; leaf < 16; leaf++) root.AppendBox(DeepName(d, leaf));
+    std::string name = DeepName(st.N, 15);
+    while (st.KeepRunning())
+        if (root.FindBoxByName(name) == NULL) printf("FindBoxByName failed\n");
+}
+
+/* N封邮件的邮箱，每次从中间删除N/64封，删除后在末尾补齐（补齐不计时） */
+static void BenchDeleteMail(State& st) {
+    Mailbox box;
+    int range = st.N / 64 > 0 ? st.N / 64 : 1;
+    for (int i = 1; i <= st.N; i++) box.AppendMail(i, new Message);
+    box.SetTotalMails(st.N);
+    while (st.KeepRunning()) {
+        int begin = box.GetTotalMails() / 2 + 1;
+        box.DeleteMail(begin, begin + range);
+        st.Pause();
+        for (int i = box.GetTotalMails() + 1; i <= st.N; i++) box.AppendMail(i, new Message);
+        box.SetTotalMails(st.N);
+        st.Resume();
+    }
+}
+
+/* 有N个会话时按四元组查找（同Package中的会话表） */
+static void BenchSockLookup(State& st) {
+    std::map<sock, Session*> sessions;
+    std::vector<sock> keys;
+    for (int i = 0; i < st.N; i++) {
+        sock key(htonl(0x0a010000 + Rand() % 65536), htonl(0x0a000002), htons(1024 + Rand() % 60000), htons(143));
+        sessions.emplace(key, (Session*)NULL);
+        keys.push_back(key);
+    }
+    size_t found = 0;
+    for (int i = 0; st.KeepRunning(); i = (i + 1) % st.N) found += sessions.count(keys[i]);
+    if (found == 0) printf("sock lookup found nothing\n");
+}
+
+/* 按76字符一行编码N字节随机数据 */
+static std::string Base64Text(int size) {
+    static const char Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string s;
+    u_int32_t v = 0;
+    for (int i = 0, col = 0; i < size; i++) {
+        v = (v << 8) | (Rand() & 0xff);
+        if (i % 3 != 2) continue;
+        for (int k = 18; k >= 0; k -= 6) s.push_back(Alphabet[(v >> k) & 63]);
+        if ((col += 4) == 76) {
+            s += "\r\n";
+            col = 0;
+        }
+    }
+    return s;
+}
+
+/* 解码得到N字节，作为参照的memcpy见BenchMemcpy */
+static void BenchBase64(State& st) {
+    std::string text = Base64Text(st.N), out;
+    while (st.KeepRunning()) {
+        out.clear();
+        DecodeBase64(text.data(), text.size(), out);
+    }
+    if ((int)out.size() < st.N - 2) printf("base64 decoded %llu bytes\n", (unsigned long long)out.size());
+}
+
+/* 以英文为主的正文，约每60字节一个=XX，每76字节一个软换行 */
+static void BenchQP(State& st) {
+    std::string text, out;
+    for (int col = 0; (int)text.size() < st.N; ) {
+        if (Rand() % 60 == 0) {
+            text += "=C3";
+            col += 3;
+        } else {
+            text.push_back('a' + Rand() % 26);
+            col++;
+        }
+        if (col >= 75) {
+            text += "=\r\n";
+            col = 0;
+        }
+    }
+    while (st.KeepRunning()) {
+        out.clear();
+        DecodeQP(text.data(), text.size(), out);
+    }
+}
+
+static void BenchMemcpy(State& st) {
+    std::string text = Text(st.N), out;
+    while (st.KeepRunning()) {
+        out.clear();
+        out.append(text.data(), text.size());
+    }
+}
+
+static Benchmark Benchmarks[] = {
+    {"getres",      BenchGetRes,        {1, 16, 256, 4096}},
+    {"fetch_meta",  BenchFetchMeta,     {16, 1024, 65536}},
+    {"fetch_body",  BenchFetchBody,     {256, 4096, 65536, 1048576}},
+    {"fetch_part",  BenchFetchPart,     {1, 16, 256}},
+    {"gettext",     BenchGetText,       {1, 8, 64, 512}},
+    {"appendbox",   BenchAppendBox,     {1, 4, 16, 64}},
+    {"findbox",     BenchFindBox,       {1, 4, 16, 64}},
+    {"deletemail",  BenchDeleteMail,    {1024, 16384, 262144}},
+    {"sock_lookup", BenchSockLookup,    {16, 1024, 65536, 1048576}},
+    {"base64",      BenchBase64,        {4096, 65536, 1048576}},
+    {"qp",          BenchQP,            {4096, 65536, 1048576}},
+    {"memcpy",      BenchMemcpy,        {4096, 65536, 1048576}},
+};
+#define BENCHMARKS (int)(sizeof(Benchmarks) / sizeof(Benchmarks[0]))
+
+/* 迭代次数从1开始按运行时间估算，直到总时间不少于MinTime */
+static double Measure(BenchFunc func, int n, double MinTime, u_int64_t& iters) {
+    iters = 1;
+    while (true) {
+        State st(n, iters);
+        func(st);
+        double sec = st.Seconds();
+        if (sec >= MinTime || iters >= (1ull << 30)) return sec / iters;
+        u_int64_t next = sec > 0 ? (u_int64_t)(iters * MinTime * 1.2 / sec) : iters * 100;
+        if (next > iters * 100) next = iters * 100;
+        iters = next > iters ? next : iters + 1;
+    }
+}
+
+static int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-f filter] [-t seconds] [-N max] [-o results]\n"
+            "  -f filter   run benchmarks whose name contains filter\n"
+            "  -t seconds  minimum time per size (%.1f)\n"
+            "  -N max      skip sizes larger than max\n"
+            "  -o file     also write \"name n ns/op\" lines to file\n",
+            name, MIN_TIME);
+}
+
+/*----------------------
+* 每个基准按各自的规模列表运行，输出每次操作的纳秒数；
+* 规模按倍数增长，ns/op随N的变化即为对应路径的复杂度
+* --------------------*/
+int main(int args, char* argv[]) {
+    const char* Filter = NULL, * OutFile = NULL;
+    double MinTime = MIN_TIME;
+    long MaxN = 0;
+    int opt;
+    while ((opt = getopt(args, argv, "f:t:N:o:")) != -1) {
+        switch (opt) {
+        case 'f': Filter = optarg;  break;
+        case 't': MinTime = atof(optarg);   break;
+        case 'N': MaxN = atol(optarg);  break;
+        case 'o': OutFile = optarg; break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    FILE* out = NULL;
+    if (OutFile && (out = fopen(OutFile, "w")) == NULL) {
+        fprintf(stderr, "Cannot write %s\n", OutFile);
+        return 1;
+    }
+    /* Session析构时会保存邮件，在临时目录中运行 */
+    char dir[] = "/tmp/imapmicro.XXXXXX";
+    if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return 1;
+    }
+
+    printf("base64 kernel: %s\n", Base64KernelName());
+    printf("%-12s %10s %12s %14s\n", "benchmark", "n", "iterations", "ns/op");
+    for (int i = 0; i < BENCHMARKS; i++) {
+        const Benchmark& b = Benchmarks[i];
+        if (Filter && strstr(b.Name, Filter) == NULL) continue;
+        for (size_t j = 0; j < b.Sizes.size(); j++) {
+            int n = b.Sizes[j];
+            if (MaxN && n > MaxN) continue;
+            u_int64_t iters;
+            double ns = Measure(b.Func, n, MinTime, iters) * 1e9;
+            printf("%-12s %10d %12llu %14.1f\n", b.Name, n, (unsigned long long)iters, ns);
+            fflush(stdout);
+            if (out) fprintf(out, "%s %d %.1f\n", b.Name, n, ns);
+        }
+    }
+    if (out) fclose(out);
+    if (chdir("/") == 0) nftw(dir, RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*---------------------
+* target: 把pcap文件中的数据帧发送到网卡，用于在环回或veth接口上测试实时抓包
+* -------------------*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/time.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include "../PeelHeader.h"
+
+static double Now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr, "Usage: %s -i iface [-r pps] [-l loops] file.pcap\n"
+            "  -i iface  interface to send on, e.g. lo or one end of a veth pair\n"
+            "  -r pps    limit the rate to pps packets per second (default: as fast as possible)\n"
+            "  -l loops  send the file this many times (1)\n", name);
+}
+
+/*----------------------
+* 以太网的帧原样发送，Linux cooked capture的帧把16字节首部换成以太网首部（地址为0）；
+* 帧的时间间隔不保留，只按-r限速
+* --------------------*/
+int main(int args, char* argv[]) {
+    const char* Interface = NULL;
+    double Rate = 0;
+    int Loops = 1, opt;
+    while ((opt = getopt(args, argv, "i:r:l:")) != -1) {
+        switch (opt) {
+        case 'i': Interface = optarg;   break;
+        case 'r': Rate = atof(optarg);  break;
+        case 'l': Loops = atoi(optarg); break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (Interface == NULL || optind >= args) {
+        Usage(argv[0]);
+        return 1;
+    }
+    int fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_ifindex = if_nametoindex(Interface);
+    if (addr.sll_ifindex == 0) {
+        fprintf(stderr, "No interface %s\n", Interface);
+        return 1;
+    }
+
+    std::vector<u_int8> frame;
+    u_int64_t sent = 0, failed = 0;
+    double start = Now();
+    for (int loop = 0; loop < Loops; loop++) {
+        try {
+            InputStream in(argv[optind]);
+            pcap_file_header FileHeader;
+            pcap_pkthdr DataHeader;
+            if (in.Read(&FileHeader, sizeof(FileHeader)) != sizeof(FileHeader)
+                || (FileHeader.linktype != ETHERNET && FileHeader.linktype != LINUXCOOKED)) {
+                fprintf(stderr, "%s is not an ethernet or cooked pcap\n", argv[optind]);
+                return 1;
+            }
+            int skip = FileHeader.linktype == LINUXCOOKED ? LINUX_COOKED_CAPTURE_HEAD - ETHER_HEAD : 0;
+            while (in.Read(&DataHeader, 16) == 16) {
+                if (frame.size() < DataHeader.caplen) frame.resize(DataHeader.caplen);
+                if (in.Read(frame.data(), DataHeader.caplen) != DataHeader.caplen) break;
+                if ((int)DataHeader.caplen < LINUX_COOKED_CAPTURE_HEAD) continue;
+                u_int8* data = frame.data() + skip;
+                /* cooked首部最后两个字节是协议类型，位置与以太网首部的类型相同 */
+                if (skip) memset(data, 0, ETHER_HEAD - 2);
+                if (sendto(fd, data, DataHeader.caplen - skip, 0, (struct sockaddr*)&addr, sizeof(addr)) < 0) failed++;
+                else sent++;
+                if (Rate > 0) {
+                    double wait = start + sent / Rate - Now();
+                    if (wait > 0) usleep(wait * 1e6);
+                }
+            }
+        } catch (int err) {
+            fprintf(stderr, "Cannot read %s (error %d)\n", argv[optind], err);
+            return 1;
+        }
+    }
+    double sec = Now() - start;
+    printf("Sent %llu packets in %.3f s (%.0f packets/s), %llu failed\n", (unsigned long long)sent, sec,
+           sec > 0 ? sent / sec : 0, (unsigned long long)failed);
+    close(fd);
+    return 0;
+}
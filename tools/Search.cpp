@@ -0,0 +1,92 @@
+/*---------------------
+* target: 查询main -I建立的全文索引
+* -------------------*/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/time.h>
+#include "../TextIndex.h"
+
+static double Now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void Usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-n max] [-c] index word...\n"
+            "  word      a word to match in any part, or field:word with field one of\n"
+            "            subject, from, to (To and Cc), msgid; from:/to: also take a full address\n"
+            "  -n max    print at most max messages (20, 0 for all)\n"
+            "  -c        only print the number of matching messages\n"
+            "All words must match. Each message is printed as user, mailbox, uid, hash and subject;\n"
+            "the hash is the file name used by main -b.\n", name);
+}
+
+/* 把查询词转换为索引中的词，与建立索引时的规则相同 */
+static void QueryTerms(const char* Word, std::vector<std::string>& Terms) {
+    static const char* Fields[] = {"subject", "from", "to", "msgid"};
+    std::string word(Word), field;
+    for (size_t i = 0; i < word.size(); i++)
+        if (word[i] >= 'A' && word[i] <= 'Z') word[i] += 'a' - 'A';
+    size_t colon = word.find(':');
+    for (size_t i = 0; colon != std::string::npos && i < sizeof(Fields) / sizeof(Fields[0]); i++)
+        if (word.compare(0, colon, Fields[i]) == 0) field = Fields[i];
+    if (field.size()) word.erase(0, colon + 1);
+    /* Message-ID和完整地址整体查找 */
+    if (field == "msgid") {
+        std::string id;
+        for (size_t i = 0; i < word.size(); i++)
+            if (word[i] != '<' && word[i] != '>') id.push_back(word[i]);
+        Terms.push_back("msgid:" + id);
+        return;
+    }
+    if (field.size() && word.find('@') != std::string::npos) {
+        Terms.push_back(field + ":" + word);
+        return;
+    }
+    std::vector<std::string> tokens;
+    TextIndexer::Tokenize(word.data(), word.size(), tokens);
+    for (size_t i = 0; i < tokens.size(); i++)
+        Terms.push_back(field.size() ? field + ":" + tokens[i] : tokens[i]);
+}
+
+int main(int args, char* argv[]) {
+    int Max = 20, opt;
+    bool CountOnly = false;
+    while ((opt = getopt(args, argv, "n:c")) != -1) {
+        switch (opt) {
+        case 'n': Max = atoi(optarg);   break;
+        case 'c': CountOnly = true;     break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 >= args) {
+        Usage(argv[0]);
+        return 1;
+    }
+    try {
+        double start = Now();
+        TextIndex index(argv[optind]);
+        std::vector<std::string> terms;
+        for (int i = optind + 1; i < args; i++) QueryTerms(argv[i], terms);
+        std::vector<u_int32_t> docs;
+        index.Search(terms, docs);
+        if (CountOnly) printf("%llu\n", (unsigned long long)docs.size());
+        for (size_t i = 0; CountOnly == false && i < docs.size() && (Max <= 0 || (int)i < Max); i++) {
+            TextDoc doc;
+            if (index.GetDoc(docs[i], doc) != OK) continue;
+            printf("%s\t%s\t%u\t%016llx\t%s\n", doc.User.c_str(), doc.Box.c_str(), doc.Uid,
+                   (unsigned long long)doc.Hash, doc.Subject.c_str());
+        }
+        fprintf(stderr, "%llu of %llu messages match, %.3f ms\n", (unsigned long long)docs.size(),
+                (unsigned long long)index.size(), (Now() - start) * 1000);
+    } catch (int err) {
+        fprintf(stderr, "Cannot read index %s (error %d)\n", argv[optind], err);
+        return 1;
+    }
+    return 0;
+}